@@ -0,0 +1 @@
+#include "WProgram.h"
@@ -0,0 +1,12 @@
+#ifndef HOST_EEPROM_H
+#define HOST_EEPROM_H
+
+#include <stdint.h>
+
+// Not persisted on the host
+void eeprom_initialize();
+void eeprom_busy_wait();
+uint8_t eeprom_read_byte(const uint8_t *_addr);
+void eeprom_write_byte(uint8_t *_addr, uint8_t _value);
+
+#endif
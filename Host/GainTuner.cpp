@@ -0,0 +1,414 @@
+// Gain optimiser: Nelder-Mead search of the position and wheel PID gains, the
+// PID output ranges and the distance speed / acceleration limits, on simulated
+// moves, for the shortest move time under overshoot and wheel slip limits.
+//
+// Every candidate is loaded with the same CLI commands as on the robot, then
+// runs a sequence of moves on nominal and low grip wheels, in parallel threads.
+// The result is printed as a CLI command script to send to the robot.
+#include <string.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <numeric>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Simulator.h"
+#include "ControlSystem.h"
+#include "MotorManager.h"
+#include "PositionManager.h"
+#include "TrajectoryManager.h"
+
+void setup();
+void loop();
+
+#define TUNE_FLOOR_CENTER_MM 5000.f
+#define TUNE_POSITION_TOLERANCE_MM 2.f
+#define TUNE_ANGLE_TOLERANCE_DEG 0.5f
+#define TUNE_SETTLE_S 0.2f				// time in the tolerance to end a move
+#define TUNE_MOVE_TIMEOUT_S 8.f
+#define TUNE_OVERSHOOT_LIMIT_MM 3.f		// angle overshoots are converted to a wheel travel
+#define TUNE_SLIP_LIMIT_MM_S 20.f		// motor wheel speed - ground speed
+#define TUNE_OVERSHOOT_PENALTY_S 0.5f	// per mm over the limit
+#define TUNE_SLIP_PENALTY_S 0.05f		// per mm/s over the limit
+#define TUNE_FAILURE_PENALTY_S 20.f		// move not ended or motors shut down
+
+struct TuneParam
+{
+	const char *command;	// CLI command, the value is appended
+	float min, max;			// searched range, scaled by the firmware value when relative
+	bool relative;
+	float (*get)();			// firmware value after setup()
+};
+
+static const TuneParam s_Params[] = {
+	{ "setPidDistP",		0.1f, 10.f, true, []() { return ControlSystem::Instance.GetDistancePID().GetKP(); } },
+	{ "setPidDistI",		0.1f, 10.f, true, []() { return ControlSystem::Instance.GetDistancePID().GetKI(); } },
+	{ "setPidDistD",		0.1f, 10.f, true, []() { return ControlSystem::Instance.GetDistancePID().GetKD(); } },
+	{ "setPidAngleP",		0.1f, 10.f, true, []() { return ControlSystem::Instance.GetAnglePID().GetKP(); } },
+	{ "setPidAngleI",		0.1f, 10.f, true, []() { return ControlSystem::Instance.GetAnglePID().GetKI(); } },
+	{ "setPidAngleD",		0.1f, 10.f, true, []() { return ControlSystem::Instance.GetAnglePID().GetKD(); } },
+	{ "setPidRange dist",	0.25f, 4.f, true, []() { return ControlSystem::Instance.GetDistancePID().GetOutputRange(); } },
+	{ "setPidRange angle",	0.25f, 4.f, true, []() { return ControlSystem::Instance.GetAnglePID().GetOutputRange(); } },
+	{ "setPidMotorP",		0.1f, 10.f, true, []() { return MotorManager::Instance.GetLeftMotorPID().GetKP(); } },
+	{ "setPidMotorD",		0.1f, 10.f, true, []() { return MotorManager::Instance.GetLeftMotorPID().GetKD(); } },
+	{ "setSpeedDist",		100.f, 1000.f, false, []() { return (float)DISTANCE_MAX_SPEED; } },
+	{ "setAccDist",			200.f, 3000.f, false, []() { return (float)DISTANCE_MAX_ACC; } },
+};
+static const int PARAM_COUNT = (int)(sizeof(s_Params) / sizeof(s_Params[0]));
+
+// Moves of a test: a distance in mm, or an absolute angle in degrees
+struct TuneMove
+{
+	bool angle;
+	float value;
+};
+
+static const TuneMove s_Moves[] = {
+	{ false, 500.f }, { true, 180.f }, { false, -300.f }, { true, 90.f },
+	{ false, 150.f }, { true, 135.f }, { false, 1000.f },
+};
+
+// Grip of the wheels of each test, mm/s^2
+static const float s_SlipAcc[] = { 4000.f, 2500.f };
+static const int TEST_COUNT = (int)(sizeof(s_SlipAcc) / sizeof(s_SlipAcc[0]));
+
+struct TestResult
+{
+	float cost;
+	float time;				// s, all the moves
+	float overshoot;		// mm, worst
+	float slip;				// mm/s, worst
+	bool failed;
+};
+
+typedef std::vector<float> Values;
+
+static std::string Script(const Values &_values)
+{
+	std::string Text;
+	char Line[64];
+	for (int i = 0; i < PARAM_COUNT; i++)
+	{
+		snprintf(Line, sizeof(Line), "%s %g\n", s_Params[i].command, _values[i]);
+		Text += Line;
+	}
+	return Text;
+}
+
+static void StartRobot(Simulator &_sim, float _slipAcc)
+{
+	Hal::Host::SetStdinInput(false);
+	Hal::Host::SetSerialOutput(nullptr);
+
+	// an empty floor, the robot starts in its middle
+	SimConfig Config;
+	Config.table = Float2(2.f * TUNE_FLOOR_CENTER_MM, 2.f * TUNE_FLOOR_CENTER_MM);
+	Config.obstacles.clear();
+	Config.slipAcc[0] = Config.slipAcc[1] = _slipAcc;
+	_sim.Init(Config);
+	_sim.SetStartPulled(false); // the strategy waits
+	setup();
+	PositionManager::Instance.SetPosMm(Float2(TUNE_FLOOR_CENTER_MM, TUNE_FLOOR_CENTER_MM));
+	PositionManager::Instance.SetTheoreticalPosMm(Float2(TUNE_FLOOR_CENTER_MM, TUNE_FLOOR_CENTER_MM));
+	_sim.PlaceRobotOnOdometry();
+}
+
+static void RunTest(const Values &_values, float _slipAcc, TestResult &_result)
+{
+	Simulator Sim;
+	StartRobot(Sim, _slipAcc);
+	_result = { 0.f, 0.f, 0.f, 0.f, false };
+
+	// the CLI runs one command per loop()
+	std::string Commands = Script(_values);
+	Hal::Host::InjectSerialInput(Commands.c_str());
+	for (size_t i = 0; i <= (size_t)std::count(Commands.begin(), Commands.end(), '\n'); i++)
+		loop();
+
+	const float HalfTrack = 0.5f * (float)PositionManager::Instance.GetAxleTrackMm();
+	for (const TuneMove &Move : s_Moves)
+	{
+		// rotation side, the angle error is positive past the target
+		float AngleSign = (remainderf(PositionManager::Instance.GetAngleRad() - DEG2RAD(Move.value), 2.f * (float)M_PI) < 0.f) ? 1.f : -1.f;
+		// the moves are chained on the theoretical pose, as in TrajectoryManager::GotoDistance
+		float Angle = PositionManager::Instance.GetTheoreticalAngleRad();
+		Float2 Direction = Float2(-sinf(Angle), cosf(Angle)) * (Move.value >= 0.f ? 1.f : -1.f);
+		Float2 Target = PositionManager::Instance.GetTheoreticalPosMm() + Direction * fabsf(Move.value);
+		if (Move.angle)
+			TrajectoryManager::Instance.GotoDegreeAngle(Move.value);
+		else
+			TrajectoryManager::Instance.GotoDistance(Move.value);
+
+		float Start = Hal::Host::GetTimeUs() * 1e-6f, SettledSince = -1.f, Time = TUNE_MOVE_TIMEOUT_S;
+		while (Hal::Host::GetTimeUs() * 1e-6f - Start < TUNE_MOVE_TIMEOUT_S && MotorManager::Instance.Enabled)
+		{
+			loop();
+			float t = Hal::Host::GetTimeUs() * 1e-6f - Start;
+
+			// odometry error along the move, positive past the target, in mm of wheel travel
+			float Error, Tolerance;
+			if (Move.angle)
+			{
+				Error = remainderf(PositionManager::Instance.GetAngleRad() - DEG2RAD(Move.value), 2.f * (float)M_PI) * HalfTrack * AngleSign;
+				Tolerance = DEG2RAD(TUNE_ANGLE_TOLERANCE_DEG) * HalfTrack;
+			}
+			else
+			{
+				Error = (PositionManager::Instance.GetPosMm() - Target).DotProduct(Direction);
+				Tolerance = TUNE_POSITION_TOLERANCE_MM;
+			}
+			_result.overshoot = std::max(_result.overshoot, Error);
+			_result.slip = std::max(_result.slip, std::max(fabsf(Sim.GetWheelSlip(Simulator::LEFT)),
+				fabsf(Sim.GetWheelSlip(Simulator::RIGHT))));
+
+			if (fabsf(Error) > Tolerance)
+				SettledSince = -1.f;
+			else if (SettledSince < 0.f)
+				SettledSince = t;
+			if (SettledSince >= 0.f && t - SettledSince >= TUNE_SETTLE_S && TrajectoryManager::Instance.IsEnded())
+			{
+				Time = SettledSince;
+				break;
+			}
+		}
+		if (Time >= TUNE_MOVE_TIMEOUT_S || !MotorManager::Instance.Enabled)
+		{
+			_result.failed = true;
+			_result.time += TUNE_MOVE_TIMEOUT_S;
+			break;
+		}
+		_result.time += Time;
+	}
+
+	_result.cost = _result.time
+		+ std::max(0.f, _result.overshoot - TUNE_OVERSHOOT_LIMIT_MM) * TUNE_OVERSHOOT_PENALTY_S
+		+ std::max(0.f, _result.slip - TUNE_SLIP_LIMIT_MM_S) * TUNE_SLIP_PENALTY_S
+		+ (_result.failed ? TUNE_FAILURE_PENALTY_S : 0.f);
+}
+
+class GainTuner
+{
+public:
+	GainTuner(int _threads) : m_Threads(_threads) {}
+
+	Values ReadFirmwareValues()
+	{
+		Values v(PARAM_COUNT);
+		std::thread([&v]()
+		{
+			Simulator Sim;
+			StartRobot(Sim, s_SlipAcc[0]);
+			for (int i = 0; i < PARAM_COUNT; i++)
+				v[i] = s_Params[i].get();
+		}).join();
+		return v;
+	}
+
+	void SetBounds(const Values &_firmware)
+	{
+		m_Min.resize(PARAM_COUNT);
+		m_Max.resize(PARAM_COUNT);
+		for (int i = 0; i < PARAM_COUNT; i++)
+		{
+			float Scale = s_Params[i].relative ? _firmware[i] : 1.f;
+			m_Min[i] = logf(s_Params[i].min * Scale);
+			m_Max[i] = logf(s_Params[i].max * Scale);
+		}
+	}
+
+	// Costs of a batch of candidates, all the tests run in parallel
+	std::vector<float> Evaluate(const std::vector<Values> &_candidates, std::vector<TestResult> *_details = nullptr)
+	{
+		std::vector<TestResult> Results(_candidates.size() * TEST_COUNT);
+		SimParallelFor((int)Results.size(), m_Threads, [&](int i)
+		{
+			RunTest(_candidates[i / TEST_COUNT], s_SlipAcc[i % TEST_COUNT], Results[i]);
+		});
+		m_Evaluations += (int)_candidates.size();
+
+		std::vector<float> Costs(_candidates.size(), 0.f);
+		for (size_t i = 0; i < Results.size(); i++)
+			Costs[i / TEST_COUNT] += Results[i].cost;
+		if (_details)
+			*_details = Results;
+		return Costs;
+	}
+
+	// Nelder-Mead on the logarithm of the values, kept in the bounds
+	Values Optimize(const Values &_start, int _iterations)
+	{
+		const int n = PARAM_COUNT;
+		std::vector<Values> Simplex(n + 1, ToLog(_start));
+		for (int i = 0; i < n; i++)
+			Simplex[i + 1][i] += 0.3f * (m_Max[i] - m_Min[i]) * ((Simplex[0][i] > 0.5f * (m_Min[i] + m_Max[i])) ? -1.f : 1.f);
+		std::vector<float> Costs = EvaluateLog(Simplex);
+
+		for (int it = 0; it < _iterations; it++)
+		{
+			std::vector<int> Order(n + 1);
+			std::iota(Order.begin(), Order.end(), 0);
+			std::sort(Order.begin(), Order.end(), [&Costs](int a, int b) { return Costs[a] < Costs[b]; });
+			int Best = Order[0], Worst = Order[n], SecondWorst = Order[n - 1];
+
+			if (it % 10 == 0)
+				printf("iteration %3d: best cost %.3f s (%d evaluations)\n", it, Costs[Best], m_Evaluations);
+
+			Values Centroid(n, 0.f);
+			for (int i : Order)
+				if (i != Worst)
+					for (int k = 0; k < n; k++)
+						Centroid[k] += Simplex[i][k] / n;
+
+			auto Along = [&](float _t)
+			{
+				Values v(n);
+				for (int k = 0; k < n; k++)
+					v[k] = Clamp(k, Centroid[k] + _t * (Simplex[Worst][k] - Centroid[k]));
+				return v;
+			};
+
+			// reflection and expansion are evaluated together
+			std::vector<Values> Tries = { Along(-1.f), Along(-2.f) };
+			std::vector<float> TryCosts = EvaluateLog(Tries);
+			if (TryCosts[0] < Costs[Best] && TryCosts[1] < TryCosts[0])
+				Replace(Simplex, Costs, Worst, Tries[1], TryCosts[1]);
+			else if (TryCosts[0] < Costs[SecondWorst])
+				Replace(Simplex, Costs, Worst, Tries[0], TryCosts[0]);
+			else
+			{
+				// contraction, outside or inside
+				Values Contracted = (TryCosts[0] < Costs[Worst]) ? Along(-0.5f) : Along(0.5f);
+				float ContractedCost = EvaluateLog({ Contracted })[0];
+				if (ContractedCost < std::min(Costs[Worst], TryCosts[0]))
+					Replace(Simplex, Costs, Worst, Contracted, ContractedCost);
+				else
+				{
+					// shrink towards the best
+					std::vector<Values> Shrunk;
+					for (int i = 0; i <= n; i++)
+						if (i != Best)
+						{
+							Values v(n);
+							for (int k = 0; k < n; k++)
+								v[k] = Simplex[Best][k] + 0.5f * (Simplex[i][k] - Simplex[Best][k]);
+							Shrunk.push_back(v);
+						}
+					std::vector<float> ShrunkCosts = EvaluateLog(Shrunk);
+					for (int i = 0, j = 0; i <= n; i++)
+						if (i != Best)
+						{
+							Simplex[i] = Shrunk[j];
+							Costs[i] = ShrunkCosts[j++];
+						}
+				}
+			}
+		}
+
+		int Best = (int)(std::min_element(Costs.begin(), Costs.end()) - Costs.begin());
+		return FromLog(Simplex[Best]);
+	}
+
+private:
+	float Clamp(int _k, float _x) const { return std::min(std::max(_x, m_Min[_k]), m_Max[_k]); }
+
+	Values ToLog(const Values &_v) const
+	{
+		Values Log(_v.size());
+		for (size_t k = 0; k < _v.size(); k++)
+			Log[k] = Clamp((int)k, logf(std::max(_v[k], 1e-6f)));
+		return Log;
+	}
+
+	Values FromLog(const Values &_log) const
+	{
+		Values v(_log.size());
+		for (size_t k = 0; k < _log.size(); k++)
+			v[k] = expf(_log[k]);
+		return v;
+	}
+
+	std::vector<float> EvaluateLog(const std::vector<Values> &_log)
+	{
+		std::vector<Values> Candidates;
+		for (const Values &l : _log)
+			Candidates.push_back(FromLog(l));
+		return Evaluate(Candidates);
+	}
+
+	static void Replace(std::vector<Values> &_simplex, std::vector<float> &_costs, int _i, const Values &_v, float _cost)
+	{
+		_simplex[_i] = _v;
+		_costs[_i] = _cost;
+	}
+
+	int m_Threads;
+	int m_Evaluations = 0;
+	Values m_Min, m_Max;
+};
+
+static void PrintResult(const char *_name, GainTuner &_tuner, const Values &_values)
+{
+	std::vector<TestResult> Details;
+	float Cost = _tuner.Evaluate({ _values }, &Details)[0];
+	printf("%s: cost %.3f s\n", _name, Cost);
+	for (int t = 0; t < TEST_COUNT; t++)
+	{
+		const TestResult &r = Details[t];
+		printf("  grip %4.0f mm/s^2: moves %6.3f s, overshoot %5.1f mm, slip %5.1f mm/s%s\n", s_SlipAcc[t],
+			r.time, r.overshoot, r.slip, r.failed ? ", FAILED" : "");
+	}
+}
+
+static void Usage(const char *_name)
+{
+	printf("usage: %s [--iterations n] [--threads n] [--output file]\n", _name);
+	printf("  --iterations  Nelder-Mead iterations (default 150)\n");
+	printf("  --threads     parallel simulations (default: all the cores)\n");
+	printf("  --output      write the CLI commands of the result to this file\n");
+}
+
+int main(int argc, char **argv)
+{
+	int Iterations = 150;
+	int Threads = std::max(1u, std::thread::hardware_concurrency());
+	const char *Output = nullptr;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "--iterations") && i + 1 < argc)
+			Iterations = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+			Threads = std::max(1, atoi(argv[++i]));
+		else if (!strcmp(argv[i], "--output") && i + 1 < argc)
+			Output = argv[++i];
+		else
+		{
+			Usage(argv[0]);
+			return 1;
+		}
+	}
+
+	GainTuner Tuner(Threads);
+	Values Firmware = Tuner.ReadFirmwareValues();
+	Tuner.SetBounds(Firmware);
+
+	PrintResult("firmware", Tuner, Firmware);
+	Values Best = Tuner.Optimize(Firmware, Iterations);
+	PrintResult("tuned", Tuner, Best);
+
+	std::string Commands = Script(Best);
+	printf("\nCLI commands:\n%s", Commands.c_str());
+	if (Output)
+	{
+		FILE *f = fopen(Output, "w");
+		if (!f)
+		{
+			perror(Output);
+			return 1;
+		}
+		fputs(Commands.c_str(), f);
+		fclose(f);
+	}
+	return 0;
+}
@@ -0,0 +1,439 @@
+// POSIX backend of Main/Hal.h: Arduino core functions, Scheduler and
+// hardware state seen from the host side.
+#include <stdarg.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <string>
+
+#include "HalHost.h"
+#include "SoftwareSerial.h"
+#include "EEPROM.h"
+#include "Scheduler.h"
+
+#define HOST_PIN_COUNT 64
+#define HOST_EEPROM_SIZE 2048
+#define HOST_DEFAULT_TICK_US 1000
+
+HostSerial Serial;
+
+// All the state is per thread: each thread runs its own robot
+namespace
+{
+	thread_local uint64_t s_TimeUs = 0;
+	thread_local uint64_t s_NextTickUs = HOST_DEFAULT_TICK_US;
+	thread_local uint64_t s_TickUs = HOST_DEFAULT_TICK_US;
+	thread_local bool s_InTick = false;
+	thread_local bool s_RealTime = false;
+	thread_local uint64_t s_WallStartNs = 0;
+	thread_local void (*s_TickHook)(uint64_t) = nullptr;
+	thread_local void (*s_OnOverflow)() = 0;
+
+	thread_local bool s_StdinInput = true;
+	thread_local std::string s_SerialInput;
+	thread_local FILE *s_SerialOutput = stdout;
+
+	struct Board
+	{
+		int32_t encoder[3] = {};
+
+		int pinMode[HOST_PIN_COUNT] = {};
+		int digitalOutput[HOST_PIN_COUNT] = {};
+		int analogOutput[HOST_PIN_COUNT] = {};
+		int digitalInput[HOST_PIN_COUNT];
+		int analogInput[HOST_PIN_COUNT] = {};
+
+		Hal::Host::SerialDevice *serialDevice[HOST_PIN_COUNT] = {};
+
+		uint8_t eeprom[HOST_EEPROM_SIZE];
+
+		// inputs are pulled up and the EEPROM is blank at power up
+		Board()
+		{
+			for (int i = 0; i < HOST_PIN_COUNT; i++)
+				digitalInput[i] = HIGH;
+			memset(eeprom, 0xFF, sizeof(eeprom));
+		}
+	};
+	thread_local Board s_Board;
+
+	uint64_t WallClockNs()
+	{
+		timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+	}
+
+	void SleepUntilVirtualTime()
+	{
+		uint64_t Target = s_WallStartNs + s_TimeUs * 1000ull;
+		uint64_t Now = WallClockNs();
+		if (Target <= Now)
+			return;
+		uint64_t Wait = Target - Now;
+		timespec ts = { (time_t)(Wait / 1000000000ull), (long)(Wait % 1000000000ull) };
+		nanosleep(&ts, nullptr);
+	}
+
+	void PollStdin()
+	{
+		if (!s_StdinInput)
+			return;
+		pollfd fd = { STDIN_FILENO, POLLIN, 0 };
+		while (poll(&fd, 1, 0) > 0 && (fd.revents & POLLIN))
+		{
+			char Buffer[256];
+			ssize_t n = ::read(STDIN_FILENO, Buffer, sizeof(Buffer));
+			if (n <= 0)
+			{
+				s_StdinInput = false; // end of file
+				return;
+			}
+			s_SerialInput.append(Buffer, n);
+		}
+	}
+
+	bool IsValidPin(uint8_t _pin)
+	{
+		return _pin < HOST_PIN_COUNT;
+	}
+}
+
+// Time and scheduler
+
+namespace Hal
+{
+	namespace Host
+	{
+		void SetRealTime(bool _realTime)
+		{
+			s_RealTime = _realTime;
+			s_WallStartNs = WallClockNs() - s_TimeUs * 1000ull;
+		}
+
+		uint64_t GetTimeUs()
+		{
+			return s_TimeUs;
+		}
+
+		void AdvanceTo(uint64_t _timeUs)
+		{
+			// a tick calling delay() would recurse, as an ISR it would just block
+			if (s_InTick)
+				return;
+
+			while (s_NextTickUs <= _timeUs)
+			{
+				s_TimeUs = s_NextTickUs;
+				s_NextTickUs += s_TickUs;
+
+				s_InTick = true;
+				if (s_TickHook)
+					s_TickHook(s_TimeUs);
+				if (Scheduler::onOverflow)
+					Scheduler::onOverflow();
+				s_InTick = false;
+			}
+			if (_timeUs > s_TimeUs)
+				s_TimeUs = _timeUs;
+
+			if (s_RealTime)
+			{
+				if (s_SerialOutput)
+					fflush(s_SerialOutput);
+				SleepUntilVirtualTime();
+			}
+		}
+
+		void SetTickHook(void (*_hook)(uint64_t _timeUs))
+		{
+			s_TickHook = _hook;
+		}
+	}
+}
+
+// Scheduler.cpp only implements the Teensy timer, the rest of the class is here
+
+void Scheduler::setPeriod(unsigned long usPeriod)
+{
+	s_TickUs = usPeriod ? usPeriod : 1;
+	s_NextTickUs = s_TimeUs + s_TickUs;
+}
+
+unsigned long Scheduler::getPeriod()
+{
+	return (unsigned long)s_TickUs;
+}
+
+void Scheduler::setOnOverflow(void (*func)())
+{
+	s_OnOverflow = func;
+	enabled = (func != 0);
+	onOverflow = enabled ? s_OnOverflow : 0;
+}
+
+void Scheduler::enable()
+{
+	enabled = true;
+	onOverflow = s_OnOverflow;
+}
+
+void Scheduler::disable()
+{
+	enabled = false;
+	onOverflow = 0;
+}
+
+uint32_t millis()
+{
+	return (uint32_t)(s_TimeUs / 1000);
+}
+
+uint32_t micros()
+{
+	return (uint32_t)s_TimeUs;
+}
+
+void delay(uint32_t _ms)
+{
+	Hal::Host::AdvanceTo(s_TimeUs + _ms * 1000ull);
+}
+
+void delayMicroseconds(uint32_t _us)
+{
+	Hal::Host::AdvanceTo(s_TimeUs + _us);
+}
+
+// Encoders and pins
+
+namespace Hal
+{
+	namespace Host
+	{
+		void SetEncoder(int _n, int32_t _count)			{ s_Board.encoder[_n] = _count; }
+		int32_t GetEncoder(int _n)						{ return s_Board.encoder[_n]; }
+
+		int GetPinMode(uint8_t _pin)					{ return IsValidPin(_pin) ? s_Board.pinMode[_pin] : 0; }
+		int GetDigitalOutput(uint8_t _pin)				{ return IsValidPin(_pin) ? s_Board.digitalOutput[_pin] : 0; }
+		int GetAnalogOutput(uint8_t _pin)				{ return IsValidPin(_pin) ? s_Board.analogOutput[_pin] : 0; }
+		void SetDigitalInput(uint8_t _pin, int _value)	{ if (IsValidPin(_pin)) s_Board.digitalInput[_pin] = _value; }
+		void SetAnalogInput(uint8_t _pin, int _value)	{ if (IsValidPin(_pin)) s_Board.analogInput[_pin] = _value; }
+
+		void SetSerialDevice(uint8_t _tx, SerialDevice *_device)
+		{
+			if (IsValidPin(_tx))
+				s_Board.serialDevice[_tx] = _device;
+		}
+
+		SerialDevice *GetSerialDevice(uint8_t _tx)
+		{
+			return IsValidPin(_tx) ? s_Board.serialDevice[_tx] : nullptr;
+		}
+
+		void SetStdinInput(bool _enable)
+		{
+			s_StdinInput = _enable;
+		}
+
+		void InjectSerialInput(const char *_text)
+		{
+			s_SerialInput.append(_text);
+		}
+
+		void SetSerialOutput(FILE *_file)
+		{
+			s_SerialOutput = _file;
+		}
+	}
+}
+
+void pinMode(uint8_t _pin, uint8_t _mode)
+{
+	if (IsValidPin(_pin))
+		s_Board.pinMode[_pin] = _mode;
+}
+
+void digitalWrite(uint8_t _pin, uint8_t _value)
+{
+	if (IsValidPin(_pin))
+		s_Board.digitalOutput[_pin] = _value;
+}
+
+uint8_t digitalRead(uint8_t _pin)
+{
+	return IsValidPin(_pin) ? s_Board.digitalInput[_pin] : LOW;
+}
+
+int analogRead(uint8_t _pin)
+{
+	return IsValidPin(_pin) ? s_Board.analogInput[_pin] : 0;
+}
+
+void analogWrite(uint8_t _pin, int _value)
+{
+	if (IsValidPin(_pin))
+		s_Board.analogOutput[_pin] = _value;
+}
+
+void analogWriteFrequency(uint8_t, float)
+{
+}
+
+// Streams
+
+size_t Stream::write(const uint8_t *_buffer, size_t _size)
+{
+	size_t n = 0;
+	while (_size--)
+		n += write(*_buffer++);
+	return n;
+}
+
+size_t Stream::write(const char *_str)
+{
+	return write((const uint8_t *)_str, strlen(_str));
+}
+
+size_t Stream::print(long _n, int _base)
+{
+	if (_n < 0 && _base == DEC)
+		return print('-') + print((unsigned long)-_n, _base);
+	return print((unsigned long)_n, _base);
+}
+
+size_t Stream::print(unsigned long _n, int _base)
+{
+	char Buffer[8 * sizeof(long) + 1];
+	char *p = Buffer + sizeof(Buffer) - 1;
+	*p = 0;
+	if (_base < 2)
+		_base = DEC;
+	do
+	{
+		int Digit = _n % _base;
+		*--p = (Digit < 10) ? '0' + Digit : 'A' + Digit - 10;
+		_n /= _base;
+	} while (_n);
+	return write(p);
+}
+
+size_t Stream::print(double _n, int _digits)
+{
+	return printf("%.*f", _digits, _n);
+}
+
+int Stream::printf(const char *_format, ...)
+{
+	char Buffer[256];
+	va_list args;
+	va_start(args, _format);
+	int n = vsnprintf(Buffer, sizeof(Buffer), _format, args);
+	va_end(args);
+	if (n < 0)
+		return n;
+	if ((size_t)n < sizeof(Buffer))
+		return write((const uint8_t *)Buffer, n);
+
+	std::string Long(n + 1, '\0');
+	va_start(args, _format);
+	vsnprintf(&Long[0], Long.size(), _format, args);
+	va_end(args);
+	return write((const uint8_t *)Long.data(), n);
+}
+
+// Nothing arrives while the firmware waits, so there is no timeout to wait for
+size_t Stream::readBytes(char *_buffer, size_t _length)
+{
+	size_t n = 0;
+	while (n < _length && available() > 0)
+		_buffer[n++] = (char)read();
+	return n;
+}
+
+size_t HostSerial::write(uint8_t _c)
+{
+	if (!s_SerialOutput)
+		return 1;
+	return fputc(_c, s_SerialOutput) == EOF ? 0 : 1;
+}
+
+size_t HostSerial::write(const uint8_t *_buffer, size_t _size)
+{
+	if (!s_SerialOutput)
+		return _size;
+	return fwrite(_buffer, 1, _size, s_SerialOutput);
+}
+
+int HostSerial::available()
+{
+	PollStdin();
+	return (int)s_SerialInput.size();
+}
+
+int HostSerial::read()
+{
+	if (!available())
+		return -1;
+	uint8_t c = s_SerialInput[0];
+	s_SerialInput.erase(0, 1);
+	return c;
+}
+
+int HostSerial::peek()
+{
+	return available() ? (uint8_t)s_SerialInput[0] : -1;
+}
+
+void HostSerial::flush()
+{
+	if (s_SerialOutput)
+		fflush(s_SerialOutput);
+}
+
+size_t SoftwareSerial::write(uint8_t _c)
+{
+	if (Hal::Host::SerialDevice *Device = Hal::Host::GetSerialDevice(m_Tx))
+		Device->Receive(_c);
+	return 1;
+}
+
+int SoftwareSerial::available()
+{
+	Hal::Host::SerialDevice *Device = Hal::Host::GetSerialDevice(m_Tx);
+	return Device ? Device->Available() : 0;
+}
+
+int SoftwareSerial::read()
+{
+	Hal::Host::SerialDevice *Device = Hal::Host::GetSerialDevice(m_Tx);
+	return Device ? Device->Read() : -1;
+}
+
+int SoftwareSerial::peek()
+{
+	Hal::Host::SerialDevice *Device = Hal::Host::GetSerialDevice(m_Tx);
+	return Device ? Device->Peek() : -1;
+}
+
+// EEPROM
+
+void eeprom_initialize()
+{
+}
+
+void eeprom_busy_wait()
+{
+}
+
+uint8_t eeprom_read_byte(const uint8_t *_addr)
+{
+	uintptr_t Addr = (uintptr_t)_addr;
+	return (Addr < HOST_EEPROM_SIZE) ? s_Board.eeprom[Addr] : 0xFF;
+}
+
+void eeprom_write_byte(uint8_t *_addr, uint8_t _value)
+{
+	uintptr_t Addr = (uintptr_t)_addr;
+	if (Addr < HOST_EEPROM_SIZE)
+		s_Board.eeprom[Addr] = _value;
+}
@@ -0,0 +1,85 @@
+#ifndef HAL_HOST_H
+#define HAL_HOST_H
+
+// POSIX backend of Main/Hal.h
+// The firmware sees the same API as on the robot. The Hal::Host functions
+// are the other side of the hardware, for the host executable and simulators.
+
+#include <stdint.h>
+#include <chrono>
+#include "WProgram.h"
+
+#define HAL_THREAD_LOCAL thread_local
+
+namespace Hal
+{
+	namespace Host
+	{
+		// Time is virtual: delay() advances it and runs the scheduler ticks
+		// which are due. In real time mode delay() also sleeps to keep pace
+		// with the wall clock.
+		void SetRealTime(bool _realTime);
+		uint64_t GetTimeUs();
+		// Run the scheduler ticks until the given virtual time
+		void AdvanceTo(uint64_t _timeUs);
+
+		// Hook called before every scheduler tick, to update the hardware state
+		void SetTickHook(void (*_hook)(uint64_t _timeUs));
+
+		// Encoder counters, N = 1 or 2 as Hal::Encoder<N>
+		void SetEncoder(int _n, int32_t _count);
+		int32_t GetEncoder(int _n);
+
+		// Pins as written by the firmware
+		int GetPinMode(uint8_t _pin);
+		int GetDigitalOutput(uint8_t _pin);
+		int GetAnalogOutput(uint8_t _pin);
+		// Pins as read by the firmware
+		void SetDigitalInput(uint8_t _pin, int _value);
+		void SetAnalogInput(uint8_t _pin, int _value);
+
+		// Device at the other end of the SoftwareSerial on pin _tx
+		struct SerialDevice
+		{
+			virtual ~SerialDevice() {}
+			virtual void Receive(uint8_t _c) = 0;	// byte sent by the firmware
+			virtual int Available() = 0;
+			virtual int Read() = 0;					// -1 if nothing to read
+			virtual int Peek() = 0;
+		};
+		void SetSerialDevice(uint8_t _tx, SerialDevice *_device);
+		SerialDevice *GetSerialDevice(uint8_t _tx);
+
+		// Serial: stdin is read without blocking, output goes to stdout.
+		// Input can also be injected, e.g. commands from a script.
+		void SetStdinInput(bool _enable);
+		void InjectSerialInput(const char *_text);
+		// Output file of Serial, null to discard the output
+		void SetSerialOutput(FILE *_file);
+	}
+
+	template <int N>
+	class Encoder
+	{
+	public:
+		void setup() {}
+		void start() {}
+		void zeroFTM() { Host::SetEncoder(N, 0); }
+		int32_t calcPosn() { return Host::GetEncoder(N); }
+		void ftm_isr() {}
+	};
+
+	inline void InitServoUart() {}
+	inline void SetServoTx(bool) {}
+
+	// Cycle counter: nanoseconds of the wall clock, virtual time does not tell the cost of the code
+	#define HAL_CYCLES_PER_US 1000
+	inline void InitCycleCounter() {}
+	inline uint32_t GetCycleCount()
+	{
+		return (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+}
+
+#endif
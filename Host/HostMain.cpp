@@ -0,0 +1,61 @@
+// Entry point of the firmware on Linux: setup() then loop(), as the Teensy core does
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "HalHost.h"
+#include "Platform.h"
+
+void setup();
+void loop();
+
+static void Usage(const char *_name)
+{
+	printf("usage: %s [--fast] [--duration seconds]\n", _name);
+	printf("  --fast      run as fast as possible instead of real time\n");
+	printf("  --duration  stop after this time (virtual seconds)\n");
+	printf("Commands are read from stdin, as from the USB serial on the robot.\n");
+	printf("With --fast and a file or a pipe as stdin, it is read at once,\n");
+	printf("then the commands are run one per loop() for reproducible runs.\n");
+}
+
+int main(int argc, char **argv)
+{
+	bool RealTime = true;
+	double Duration = -1.;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "--fast"))
+			RealTime = false;
+		else if (!strcmp(argv[i], "--duration") && i + 1 < argc)
+			Duration = atof(argv[++i]);
+		else
+		{
+			Usage(argv[0]);
+			return 1;
+		}
+	}
+
+	setvbuf(stdout, nullptr, _IOLBF, 0);
+	Hal::Host::SetRealTime(RealTime);
+	if (!RealTime && !isatty(STDIN_FILENO))
+	{
+		char Buffer[256];
+		size_t n;
+		while ((n = fread(Buffer, 1, sizeof(Buffer) - 1, stdin)) > 0)
+		{
+			Buffer[n] = 0;
+			Hal::Host::InjectSerialInput(Buffer);
+		}
+		Hal::Host::SetStdinInput(false);
+	}
+	// starting cord in place
+	Hal::Host::SetDigitalInput(Platform::startPull, LOW);
+
+	setup();
+	while (Duration < 0. || Hal::Host::GetTimeUs() < Duration * 1e6)
+		loop();
+
+	return 0;
+}
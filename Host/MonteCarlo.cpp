@@ -0,0 +1,206 @@
+// Monte Carlo evaluation of the strategy: many simulated matches in parallel,
+// with random wheel slip, encoder errors and opponents.
+//
+// Each match runs in a thread of its own, see SimParallelFor. The report gives
+// the distributions of the time to end all the actions, of the final odometry
+// error and of the strategy state reached.
+#include <string.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "Simulator.h"
+
+struct MatchSetup
+{
+	bool green;
+	SimConfig config;
+};
+
+struct Match
+{
+	MatchSetup setup;
+	SimMatchResult result;
+};
+
+static MatchSetup RandomSetup(uint32_t _seed, bool _green)
+{
+	std::mt19937 Random(_seed);
+	auto Uniform = [&Random](float _min, float _max) { return std::uniform_real_distribution<float>(_min, _max)(Random); };
+	std::normal_distribution<float> Calibration(0.f, 0.003f);
+
+	MatchSetup Setup;
+	Setup.green = _green;
+	SimConfig &Config = Setup.config;
+	Config.seed = _seed;
+	Config.maxWheelSpeed = Uniform(1800.f, 2200.f);
+	for (int w = 0; w < 2; w++)
+	{
+		Config.slipAcc[w] = Uniform(2500.f, 5000.f);
+		Config.ticksPerM[w] *= 1.f + Calibration(Random);
+	}
+	Config.encoderNoise = Uniform(0.f, 0.2f);
+
+	// no opponent in a quarter of the matches, else a random patrol
+	if (Uniform(0.f, 1.f) >= 0.25f)
+	{
+		int Points = 2 + Random() % 4;
+		for (int i = 0; i < Points; i++)
+			Config.opponentPath.push_back(Float2(Uniform(300.f, 2700.f), Uniform(300.f, 1500.f)));
+		Config.opponentSpeed = Uniform(100.f, 500.f);
+		Config.opponentRadius = Uniform(100.f, 180.f);
+	}
+	return Setup;
+}
+
+static void RunMatch(Match &_match)
+{
+	Hal::Host::SetStdinInput(false);
+	Hal::Host::SetSerialOutput(nullptr);
+
+	Simulator Sim;
+	Sim.Init(_match.setup.config);
+	Sim.SetGreenSide(_match.setup.green);
+	_match.result = Sim.RunMatch();
+}
+
+static float Percentile(std::vector<float> _values, float _p)
+{
+	if (_values.empty())
+		return 0.f;
+	std::sort(_values.begin(), _values.end());
+	size_t i = (size_t)lroundf(_p * (_values.size() - 1));
+	return _values[i];
+}
+
+static void PrintDistribution(const char *_name, const std::vector<float> &_values)
+{
+	if (_values.empty())
+	{
+		printf("  %-20s -\n", _name);
+		return;
+	}
+	float Sum = 0.f;
+	for (float v : _values)
+		Sum += v;
+	printf("  %-20s mean %7.1f | min %7.1f  p10 %7.1f  p50 %7.1f  p90 %7.1f  max %7.1f\n", _name,
+		Sum / _values.size(), Percentile(_values, 0.f), Percentile(_values, 0.1f),
+		Percentile(_values, 0.5f), Percentile(_values, 0.9f), Percentile(_values, 1.f));
+}
+
+static void PrintReport(const char *_title, const std::vector<Match> &_matches, int _side)
+{
+	std::vector<float> Completion, PoseError, AngleError;
+	std::map<int, int> States;
+	int Count = 0;
+	for (const Match &m : _matches)
+	{
+		if (_side >= 0 && m.setup.green != (_side == 1))
+			continue;
+		Count++;
+		if (m.result.completionTime >= 0.f)
+			Completion.push_back(m.result.completionTime);
+		PoseError.push_back(m.result.poseError);
+		AngleError.push_back(fabsf(m.result.angleError));
+		States[m.result.reachedState]++;
+	}
+	if (!Count)
+		return;
+
+	printf("%s: %d matches, actions ended in %d (%.1f %%)\n", _title, Count,
+		(int)Completion.size(), 100.f * Completion.size() / Count);
+	PrintDistribution("completion time (s)", Completion);
+	PrintDistribution("pose error (mm)", PoseError);
+	PrintDistribution("angle error (deg)", AngleError);
+	printf("  state reached:");
+	for (const auto &s : States)
+		printf("  %d: %.1f %%", s.first, 100.f * s.second / Count);
+	printf("\n");
+}
+
+static void Usage(const char *_name)
+{
+	printf("usage: %s [--matches n] [--threads n] [--seed n] [--side green|orange|both] [--csv file]\n", _name);
+	printf("  --matches  number of simulated matches (default 1000)\n");
+	printf("  --threads  parallel matches (default: all the cores)\n");
+	printf("  --seed     first random seed, match i uses seed + i\n");
+	printf("  --side     starting side (default both, one match out of two)\n");
+	printf("  --csv      write the setup and result of each match\n");
+}
+
+int main(int argc, char **argv)
+{
+	int MatchCount = 1000;
+	int ThreadCount = std::max(1u, std::thread::hardware_concurrency());
+	uint32_t Seed = 1;
+	int Side = -1; // both
+	const char *CsvFile = nullptr;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "--matches") && i + 1 < argc)
+			MatchCount = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+			ThreadCount = std::max(1, atoi(argv[++i]));
+		else if (!strcmp(argv[i], "--seed") && i + 1 < argc)
+			Seed = (uint32_t)atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--side") && i + 1 < argc)
+		{
+			i++;
+			Side = !strcmp(argv[i], "green") ? 1 : !strcmp(argv[i], "orange") ? 0 : -1;
+		}
+		else if (!strcmp(argv[i], "--csv") && i + 1 < argc)
+			CsvFile = argv[++i];
+		else
+		{
+			Usage(argv[0]);
+			return 1;
+		}
+	}
+
+	std::vector<Match> Matches(MatchCount);
+	for (int i = 0; i < MatchCount; i++)
+	{
+		bool Green = (Side < 0) ? (i & 1) : (Side == 1);
+		Matches[i].setup = RandomSetup(Seed + i, Green);
+	}
+
+	auto WallStart = std::chrono::steady_clock::now();
+
+	SimParallelFor(MatchCount, ThreadCount, [&Matches](int i) { RunMatch(Matches[i]); });
+
+	double WallS = std::chrono::duration<double>(std::chrono::steady_clock::now() - WallStart).count();
+	printf("%d matches in %.2f s on %d threads\n", MatchCount, WallS, ThreadCount);
+	PrintReport("all", Matches, -1);
+	if (Side < 0)
+	{
+		PrintReport("green", Matches, 1);
+		PrintReport("orange", Matches, 0);
+	}
+
+	if (CsvFile)
+	{
+		FILE *Csv = fopen(CsvFile, "w");
+		if (!Csv)
+		{
+			perror(CsvFile);
+			return 1;
+		}
+		fprintf(Csv, "seed,green,max_speed,slip_left,slip_right,ticks_left,ticks_right,encoder_noise,opponent_points,"
+			"state,completion_time,pose_error,angle_error\n");
+		for (const Match &m : Matches)
+		{
+			const SimConfig &c = m.setup.config;
+			fprintf(Csv, "%u,%d,%.0f,%.0f,%.0f,%.1f,%.1f,%.3f,%d,%d,%.2f,%.1f,%.2f\n", c.seed, (int)m.setup.green,
+				c.maxWheelSpeed, c.slipAcc[0], c.slipAcc[1], c.ticksPerM[0], c.ticksPerM[1], c.encoderNoise,
+				(int)c.opponentPath.size(), m.result.reachedState, m.result.completionTime,
+				m.result.poseError, m.result.angleError);
+		}
+		fclose(Csv);
+	}
+	return 0;
+}
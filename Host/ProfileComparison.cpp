@@ -0,0 +1,150 @@
+/**
+ * Host comparison of the quadramp and S-curve profiles at equal wheel slip.
+ *
+ * The profile is evaluated at the position loop period (10 ms) and its planned
+ * speed drives the wheel velocity loop at 1 kHz, modelled as a second order lag.
+ * For each profile, the highest acceleration keeping the peak wheel acceleration
+ * under the slip threshold is searched, then the resulting move times are printed.
+ * The S-curve is tried with several jerk / acceleration ratios, the fastest is kept
+ * (5/s is the ratio of DISTANCE_MAX_JERK / DISTANCE_MAX_ACC).
+ *
+ * Build and run from Host/:
+ *   make profile_comparison
+ *   ./profile_comparison [slip_acc_mm_s2]
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "QuadrampFilter.h"
+#include "SCurveFilter.h"
+
+#define MAX_SPEED 250.f			// mm/s, DISTANCE_MAX_SPEED
+#define PROFILE_PERIOD_S 0.01f	// CONTROL_SYSTEM_PERIOD_S
+#define WHEEL_PERIOD_S 0.001f	// MOTOR_CONTROL_PERIOD_S
+#define WHEEL_NATURAL_FREQ_HZ 5.f
+#define WHEEL_DAMPING 0.5f
+#define POSITION_TOLERANCE_MM 0.5f
+#define MAX_MOVE_TIME_S 20.f
+
+struct MoveResult
+{
+	float peakWheelAcc;	// mm/s^2
+	float time;			// s, until the wheel stays within the tolerance
+};
+
+template <typename Profile>
+MoveResult SimulateMove(Profile &_profile, float _distance)
+{
+	const float wn = 2.f * (float)M_PI * WHEEL_NATURAL_FREQ_HZ;
+	const int ticksPerProfile = (int)roundf(PROFILE_PERIOD_S / WHEEL_PERIOD_S);
+
+	_profile.SetEvalPeriod(PROFILE_PERIOD_S);
+	_profile.Reset(0.f);
+
+	float wheelPos = 0.f, wheelSpeed = 0.f, wheelAcc = 0.f, speedRef = 0.f;
+	MoveResult Result = { 0.f, MAX_MOVE_TIME_S };
+	float settledSince = -1.f;
+
+	for (int tick = 0; tick * WHEEL_PERIOD_S < MAX_MOVE_TIME_S; tick++)
+	{
+		if (tick % ticksPerProfile == 0)
+		{
+			_profile.Evaluate(_distance);
+			speedRef = _profile.GetVelocity();
+		}
+
+		// wheel speed / speed reference: wn^2 / (s^2 + 2.zeta.wn.s + wn^2)
+		wheelAcc += (wn * wn * (speedRef - wheelSpeed) - 2.f * WHEEL_DAMPING * wn * wheelAcc) * WHEEL_PERIOD_S;
+		wheelSpeed += wheelAcc * WHEEL_PERIOD_S;
+		wheelPos += wheelSpeed * WHEEL_PERIOD_S;
+
+		if (fabsf(wheelAcc) > Result.peakWheelAcc)
+			Result.peakWheelAcc = fabsf(wheelAcc);
+
+		float t = (tick + 1) * WHEEL_PERIOD_S;
+		if (fabsf(wheelPos - _distance) < POSITION_TOLERANCE_MM && fabsf(wheelSpeed) < 1.f)
+		{
+			if (settledSince < 0.f)
+				settledSince = t;
+		}
+		else
+			settledSince = -1.f;
+
+		if (settledSince >= 0.f && t - settledSince > 0.2f)
+		{
+			Result.time = settledSince;
+			break;
+		}
+	}
+	return Result;
+}
+
+MoveResult QuadrampMove(float _acc, float _distance)
+{
+	QuadrampFilter Filter;
+	Filter.Init();
+	Filter.Set1stOrderVars(MAX_SPEED, MAX_SPEED);
+	Filter.Set2ndOrderVars(_acc, _acc);
+	return SimulateMove(Filter, _distance);
+}
+
+static float JerkPerAcc = 5.f; // 1/s
+
+MoveResult SCurveMove(float _acc, float _distance)
+{
+	SCurveFilter Filter;
+	Filter.Init();
+	Filter.Set1stOrderVars(MAX_SPEED, MAX_SPEED);
+	Filter.Set2ndOrderVars(_acc, _acc);
+	Filter.Set3rdOrderVar(JerkPerAcc * _acc);
+	return SimulateMove(Filter, _distance);
+}
+
+// Highest profile acceleration whose peak wheel acceleration stays under _slipAcc
+float MaxAcceleration(MoveResult (*_move)(float, float), float _slipAcc, float _distance)
+{
+	float lo = 0.f, hi = 4.f * _slipAcc;
+	for (int i = 0; i < 30; i++)
+	{
+		float mid = 0.5f * (lo + hi);
+		if (_move(mid, _distance).peakWheelAcc <= _slipAcc)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+int main(int argc, char **argv)
+{
+	float SlipAcc = (argc > 1) ? atof(argv[1]) : 600.f;
+	const float Distances[] = { 100.f, 300.f, 600.f, 1000.f, 1500.f };
+	const float JerkRatios[] = { 5.f, 10.f, 20.f, 40.f, 80.f };
+
+	printf("wheel slip threshold: %.0f mm/s^2, max speed %.0f mm/s\n", SlipAcc, MAX_SPEED);
+	printf("distance |  quadramp acc   time |   s-curve acc   jerk   time\n");
+	for (float Distance : Distances)
+	{
+		float QuadAcc = MaxAcceleration(QuadrampMove, SlipAcc, Distance);
+		float QuadTime = QuadrampMove(QuadAcc, Distance).time;
+
+		float BestAcc = 0.f, BestJerk = 0.f, BestTime = MAX_MOVE_TIME_S;
+		for (float Ratio : JerkRatios)
+		{
+			JerkPerAcc = Ratio;
+			float Acc = MaxAcceleration(SCurveMove, SlipAcc, Distance);
+			float Time = SCurveMove(Acc, Distance).time;
+			if (Time < BestTime)
+			{
+				BestAcc = Acc;
+				BestJerk = Ratio * Acc;
+				BestTime = Time;
+			}
+		}
+
+		printf("%5.0f mm | %9.0f %6.2f s | %9.0f %6.0f %6.2f s\n", Distance,
+			QuadAcc, QuadTime, BestAcc, BestJerk, BestTime);
+	}
+	return 0;
+}
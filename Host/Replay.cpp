@@ -0,0 +1,419 @@
+// Replay of a recording of Main/Recorder.h ("getRecord" output): the control
+// stack starts from the recorded snapshot, then runs on the recorded encoder
+// values, trajectory inputs and setpoints. The motor commands it computes are
+// compared with the recorded ones, tick by tick.
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <ctype.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "Recorder.h"
+#include "ControlSystem.h"
+#include "MotorManager.h"
+#include "PositionManager.h"
+#include "TrajectoryManager.h"
+#include "Platform.h"
+
+void setup();
+
+static void Usage(const char *_name)
+{
+	printf("usage: %s [--csv file.csv] [--verbose] [record.txt]\n", _name);
+	printf("  record.txt  serial output containing a getRecord dump (stdin by default)\n");
+	printf("  --csv       write the recorded and replayed commands of every tick\n");
+	printf("  --verbose   show the firmware serial output\n");
+}
+
+// Bytes between the "record begin" and "record end" lines
+static bool ReadDump(FILE *_file, std::vector<uint8_t> &_data)
+{
+	char Line[512];
+	bool InRecord = false;
+	while (fgets(Line, sizeof(Line), _file))
+	{
+		if (!strncmp(Line, "record begin", 12))
+		{
+			InRecord = true;
+			_data.clear();
+			continue;
+		}
+		if (!InRecord)
+			continue;
+		if (!strncmp(Line, "record end", 10))
+			return true;
+
+		for (const char *c = Line; isxdigit(c[0]) && isxdigit(c[1]); c += 2)
+		{
+			char Byte[3] = { c[0], c[1], 0 };
+			_data.push_back((uint8_t)strtoul(Byte, nullptr, 16));
+		}
+	}
+	return false;
+}
+
+class RecordReader
+{
+public:
+	RecordReader(const std::vector<uint8_t> &_data) : m_Data(_data) {}
+
+	bool AtEnd() const { return m_Pos >= m_Data.size(); }
+	bool IsValid() const { return m_Valid; }
+	size_t GetPos() const { return m_Pos; }
+
+	template <typename T>
+	T Get()
+	{
+		T Value = T();
+		if (m_Pos + sizeof(T) > m_Data.size())
+		{
+			m_Valid = false;
+			m_Pos = m_Data.size();
+			return Value;
+		}
+		memcpy(&Value, &m_Data[m_Pos], sizeof(T));
+		m_Pos += sizeof(T);
+		return Value;
+	}
+
+	int32_t GetVarint()
+	{
+		uint32_t v = 0;
+		for (int Shift = 0; Shift < 35; Shift += 7)
+		{
+			uint8_t b = Get<uint8_t>();
+			v |= (uint32_t)(b & 0x7F) << Shift;
+			if (!(b & 0x80))
+				break;
+		}
+		return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+	}
+
+	PositionManager::State GetOdometry()
+	{
+		PositionManager::State s;
+		s.leftEncoder = Get<int32_t>();
+		s.rightEncoder = Get<int32_t>();
+		s.distanceMm = Get<double>();
+		s.angleRad = Get<double>();
+		s.xMm = Get<double>();
+		s.yMm = Get<double>();
+		s.theoreticalPosMm.x = Get<float>();
+		s.theoreticalPosMm.y = Get<float>();
+		s.theoreticalAngleRad = Get<float>();
+		return s;
+	}
+
+	ControlSetpoint GetSetpoint()
+	{
+		ControlSetpoint s;
+		s.distance = Get<float>();
+		s.angle = Get<float>();
+		s.angleQuadramp = Get<uint8_t>() != 0;
+		s.distanceMaxSpeed = Get<float>();
+		s.distanceMaxAcc = Get<float>();
+		s.angleMaxSpeed = Get<float>();
+		s.angleMaxAcc = Get<float>();
+		s.distanceMaxJerk = Get<float>();
+		s.angleMaxJerk = Get<float>();
+		s.distanceProfile = (ProfileType)Get<uint8_t>();
+		s.angleProfile = (ProfileType)Get<uint8_t>();
+		s.distanceResetId = Get<uint8_t>();
+		s.angleResetId = Get<uint8_t>();
+		s.velocityMode = Get<uint8_t>() != 0;
+		s.distanceVelocity = Get<float>();
+		s.angleVelocity = Get<float>();
+		s.brakeId = Get<uint8_t>();
+		s.distanceBrake = Get<uint8_t>() != 0;
+		s.angleBrake = Get<uint8_t>() != 0;
+		s.distanceBrakeAcc = Get<float>();
+		s.angleBrakeAcc = Get<float>();
+		s.distanceSpeedScale = Get<float>();
+		return s;
+	}
+
+private:
+	const std::vector<uint8_t> &m_Data;
+	size_t m_Pos = 0;
+	bool m_Valid = true;
+};
+
+static void ApplyFlags(uint8_t _flags)
+{
+	ControlSystem::Instance.m_Enable = (_flags & RECORD_FLAG_CONTROL_ENABLED) != 0;
+	MotorManager::Instance.Enabled = (_flags & RECORD_FLAG_MOTORS_ENABLED) != 0;
+}
+
+static void ApplyGP2(const int16_t _values[RECORDER_GP2_COUNT])
+{
+	for (int i = 0; i < RECORDER_GP2_COUNT; i++)
+		Hal::Host::SetAnalogInput(Platform::gp2Pins[i], _values[i]);
+}
+
+// Restore the control stack from the START record
+static void ApplyStart(RecordReader &_reader, int32_t _encoder[2], int32_t _command[2], int16_t _gp2[RECORDER_GP2_COUNT])
+{
+	_encoder[0] = _reader.Get<int32_t>();
+	_encoder[1] = _reader.Get<int32_t>();
+	PositionManager::State Odometry = _reader.GetOdometry();
+
+	PIDController *Pids[] = { &ControlSystem::Instance.GetDistancePID(), &ControlSystem::Instance.GetAnglePID(),
+		&MotorManager::Instance.GetLeftMotorPID(), &MotorManager::Instance.GetRightMotorPID() };
+	float Gains[4][6];
+	for (auto &g : Gains)
+		for (float &v : g)
+			v = _reader.Get<float>();
+	float FeedForward[2][2];
+	for (auto &f : FeedForward)
+		for (float &v : f)
+			v = _reader.Get<float>();
+	ControlSetpoint Active = _reader.GetSetpoint();
+	float Profiles[4];
+	for (float &v : Profiles)
+		v = _reader.Get<float>();
+	ControlSetpoint Setpoint = _reader.GetSetpoint();
+	int32_t SpeedRef[2] = { _reader.Get<int32_t>(), _reader.Get<int32_t>() };
+	_command[0] = _reader.Get<int32_t>();
+	_command[1] = _reader.Get<int32_t>();
+	uint8_t TickCounter = _reader.Get<uint8_t>();
+	uint8_t Flags = _reader.Get<uint8_t>();
+	for (int i = 0; i < RECORDER_GP2_COUNT; i++)
+		_gp2[i] = _reader.Get<int16_t>();
+	float CornerTolerance = _reader.Get<float>();
+	uint8_t TrackingMode = _reader.Get<uint8_t>();
+
+	// The robot was idle: run the idle encoders through the wheel speed windows,
+	// and let the control loop pick up the setpoint it was using
+	Hal::Host::SetEncoder(1, _encoder[0]);
+	Hal::Host::SetEncoder(2, _encoder[1]);
+	ApplyGP2(_gp2);
+	// a brake stop already planned is held from the previous setpoint,
+	// the control loop picks it up first without the brake
+	if (Active.distanceBrake || Active.angleBrake)
+	{
+		ControlSetpoint Released = Active;
+		Released.distanceBrake = false;
+		Released.angleBrake = false;
+		ControlSystem::Instance.SetSetpoint(Released);
+		delay(CONTROL_SYSTEM_DEFAULT_DIVIDER);
+	}
+	ControlSystem::Instance.SetSetpoint(Active);
+	delay(MOTOR_SPEED_WINDOW + CONTROL_SYSTEM_DEFAULT_DIVIDER);
+
+	PositionManager::Instance.SetState(Odometry);
+	for (int i = 0; i < 4; i++)
+	{
+		Pids[i]->SetKP(Gains[i][0]);
+		Pids[i]->SetKI(Gains[i][1]);
+		Pids[i]->SetKD(Gains[i][2]);
+		Pids[i]->SetOutputRange(Gains[i][3]);
+		Pids[i]->SetState(Gains[i][4], Gains[i][5]);
+	}
+	for (int i = 0; i < 2; i++)
+	{
+		ControlSystem::Instance.SetFeedForward((MotorManager::MotorId)i, FeedForward[i][0], FeedForward[i][1]);
+		MotorManager::Instance.SetSpeed((MotorManager::MotorId)i, SpeedRef[i]);
+	}
+	ControlSystem::Instance.ResetProfiles(Profiles[0], Profiles[1], Profiles[2], Profiles[3]);
+	// a setpoint published but not yet picked up is published again
+	ControlSystem::Instance.SetSetpoint(Setpoint);
+	ControlSystem::Instance.SetTickCounter(TickCounter);
+	ApplyFlags(Flags);
+	if (Flags & RECORD_FLAG_PAUSED)
+		TrajectoryManager::Instance.Pause();
+	TrajectoryManager::Instance.SetCornerTolerance(CornerTolerance);
+	TrajectoryManager::Instance.SetTrackingMode((TrajectoryManager::TrackingMode)TrackingMode);
+}
+
+struct ReplayStats
+{
+	uint64_t ticks = 0;
+	uint64_t records = 0;
+	uint64_t mismatches = 0;
+	int32_t maxDifference = 0;
+	double squareSum = 0.;
+	int64_t firstMismatch = -1;
+	int32_t firstRecorded[2], firstReplayed[2];
+};
+
+int main(int argc, char **argv)
+{
+	const char *RecordFile = nullptr;
+	const char *CsvFile = nullptr;
+	bool Verbose = false;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "--csv") && i + 1 < argc)
+			CsvFile = argv[++i];
+		else if (!strcmp(argv[i], "--verbose"))
+			Verbose = true;
+		else if (argv[i][0] != '-' && !RecordFile)
+			RecordFile = argv[i];
+		else
+		{
+			Usage(argv[0]);
+			return 1;
+		}
+	}
+
+	FILE *In = RecordFile ? fopen(RecordFile, "r") : stdin;
+	if (!In)
+	{
+		perror(RecordFile);
+		return 1;
+	}
+	std::vector<uint8_t> Data;
+	bool Found = ReadDump(In, Data);
+	if (In != stdin)
+		fclose(In);
+	if (!Found || Data.empty() || Data[0] != (uint8_t)RecordType::START)
+	{
+		fprintf(stderr, "no recording found\n");
+		return 1;
+	}
+
+	FILE *Csv = nullptr;
+	if (CsvFile)
+	{
+		Csv = fopen(CsvFile, "w");
+		if (!Csv)
+		{
+			perror(CsvFile);
+			return 1;
+		}
+		fprintf(Csv, "tick,encoder1,encoder2,recorded_left,recorded_right,replayed_left,replayed_right\n");
+	}
+
+	Hal::Host::SetStdinInput(false);
+	Hal::Host::SetSerialOutput(Verbose ? stdout : nullptr);
+	setup();
+
+	RecordReader Reader(Data);
+	Reader.Get<uint8_t>();
+	int32_t Encoder[2], Speed[2] = { 0, 0 }, Command[2];
+	int16_t GP2[RECORDER_GP2_COUNT];
+	ApplyStart(Reader, Encoder, Command, GP2);
+
+	ReplayStats Stats;
+	auto RunTick = [&]()
+	{
+		for (int i = 0; i < 2; i++)
+			Encoder[i] += Speed[i];
+		Hal::Host::SetEncoder(1, Encoder[0]);
+		Hal::Host::SetEncoder(2, Encoder[1]);
+		delay(1);
+
+		int32_t Replayed[2] = { MotorManager::Instance.GetCommand(MotorManager::LEFT), MotorManager::Instance.GetCommand(MotorManager::RIGHT) };
+		int32_t Difference = std::max(abs(Replayed[0] - Command[0]), abs(Replayed[1] - Command[1]));
+		if (Difference)
+		{
+			if (Stats.firstMismatch < 0)
+			{
+				Stats.firstMismatch = Stats.ticks;
+				memcpy(Stats.firstRecorded, Command, sizeof(Command));
+				memcpy(Stats.firstReplayed, Replayed, sizeof(Replayed));
+			}
+			Stats.mismatches++;
+			Stats.maxDifference = std::max(Stats.maxDifference, Difference);
+		}
+		Stats.squareSum += (double)(Replayed[0] - Command[0]) * (Replayed[0] - Command[0])
+			+ (double)(Replayed[1] - Command[1]) * (Replayed[1] - Command[1]);
+		if (Csv)
+			fprintf(Csv, "%llu,%d,%d,%d,%d,%d,%d\n", (unsigned long long)Stats.ticks, Encoder[0], Encoder[1],
+				Command[0], Command[1], Replayed[0], Replayed[1]);
+		Stats.ticks++;
+	};
+
+	while (!Reader.AtEnd() && Reader.IsValid())
+	{
+		size_t Pos = Reader.GetPos();
+		RecordType Type = (RecordType)Reader.Get<uint8_t>();
+		Stats.records++;
+		switch (Type)
+		{
+		case RecordType::TICK:
+		case RecordType::TICK_SMALL:
+		{
+			int32_t Change[4];
+			if (Type == RecordType::TICK)
+			{
+				for (int32_t &c : Change)
+					c = Reader.GetVarint();
+			}
+			else
+			{
+				// signed nibbles
+				uint8_t b[2] = { Reader.Get<uint8_t>(), Reader.Get<uint8_t>() };
+				for (int i = 0; i < 4; i++)
+					Change[i] = (((b[i / 2] >> (4 * (i & 1))) & 0xF) ^ 8) - 8;
+			}
+			for (int i = 0; i < 2; i++)
+			{
+				Speed[i] += Change[i];
+				Command[i] += Change[2 + i];
+			}
+			RunTick();
+			break;
+		}
+		case RecordType::IDLE:
+			for (int32_t n = Reader.GetVarint(); n > 0; n--)
+				RunTick();
+			break;
+		case RecordType::TASK:
+			ApplyFlags(Reader.Get<uint8_t>());
+			for (int i = 0; i < RECORDER_GP2_COUNT; i++)
+				GP2[i] += Reader.GetVarint();
+			ApplyGP2(GP2);
+			TrajectoryManager::Instance.Task();
+			break;
+		case RecordType::POINT:
+		{
+			Float2 Pos;
+			Pos.x = Reader.Get<float>();
+			Pos.y = Reader.Get<float>();
+			float Angle = Reader.Get<float>();
+			float Curve[SMOOTH_TRAJ_CURVE_PARAMS];
+			for (float &v : Curve)
+				v = Reader.Get<float>();
+			uint8_t Movement = Reader.Get<uint8_t>();
+			bool Now = Reader.Get<uint8_t>() != 0;
+			TrajectoryManager::Instance.ReplayPoint(Pos, Angle, Curve, Movement, Now);
+			break;
+		}
+		case RecordType::TRAJ_RESET:
+			TrajectoryManager::Instance.Reset();
+			break;
+		case RecordType::PAUSE:
+			TrajectoryManager::Instance.Pause();
+			break;
+		case RecordType::RESUME:
+			TrajectoryManager::Instance.Resume();
+			break;
+		case RecordType::SETPOINT:
+			ControlSystem::Instance.SetSetpoint(Reader.GetSetpoint());
+			break;
+		case RecordType::ODOMETRY:
+			PositionManager::Instance.SetState(Reader.GetOdometry());
+			break;
+		default:
+			fprintf(stderr, "unknown record %d at byte %zu\n", (int)Type, Pos);
+			return 1;
+		}
+	}
+	if (Csv)
+		fclose(Csv);
+	if (!Reader.IsValid())
+		fprintf(stderr, "truncated recording\n");
+
+	printf("replayed %llu ticks (%.3f s), %llu records, %zu bytes\n", (unsigned long long)Stats.ticks,
+		Stats.ticks * MOTOR_CONTROL_PERIOD_S, (unsigned long long)Stats.records, Data.size());
+	printf("motor commands: %llu ticks differ, max difference %d, rms %.3f\n", (unsigned long long)Stats.mismatches,
+		Stats.maxDifference, Stats.ticks ? sqrt(Stats.squareSum / (2. * Stats.ticks)) : 0.);
+	if (Stats.firstMismatch >= 0)
+		printf("first difference at tick %lld: recorded %d %d, replayed %d %d\n", (long long)Stats.firstMismatch,
+			Stats.firstRecorded[0], Stats.firstRecorded[1], Stats.firstReplayed[0], Stats.firstReplayed[1]);
+	return Stats.mismatches ? 2 : 0;
+}
@@ -0,0 +1,140 @@
+// Match simulator: the firmware runs on the simulated robot, on virtual time,
+// as fast as the host allows. The starting cord is handled as in a match.
+#include <string.h>
+#include <stdlib.h>
+#include <chrono>
+#include <string>
+
+#include "Simulator.h"
+#include "PositionManager.h"
+
+static void Usage(const char *_name)
+{
+	printf("usage: %s [--green] [--opponent [x,y/x,y...]] [--duration seconds] [--seed n] [--trace file.csv] [--commands file] [--quiet]\n", _name);
+	printf("  --green     start on the green side (orange by default)\n");
+	printf("  --opponent  add an opponent patrolling along the given points,\n");
+	printf("              or around the middle of the table\n");
+	printf("  --duration  stop after this time (virtual seconds, default: end of the match)\n");
+	printf("  --seed      random seed of the simulation\n");
+	printf("  --trace     write the true and estimated poses every 10 ms\n");
+	printf("  --commands  send the commands of the file to the command line interface\n");
+	printf("              instead of playing the match (the starting cord stays in),\n");
+	printf("              a \"wait <seconds>\" line delays the next commands\n");
+	printf("  --quiet     hide the firmware serial output\n");
+}
+
+// "x,y/x,y/..."
+static std::vector<Float2> ParsePath(const char *_text)
+{
+	std::vector<Float2> Path;
+	float x, y;
+	int n;
+	while (sscanf(_text, "%f,%f%n", &x, &y, &n) == 2)
+	{
+		Path.push_back(Float2(x, y));
+		_text += n;
+		if (*_text != '/')
+			break;
+		_text++;
+	}
+	return Path;
+}
+
+int main(int argc, char **argv)
+{
+	SimConfig Config;
+	bool Green = false, Quiet = false;
+	double Duration = SIM_MATCH_END_S;
+	const char *TraceFile = nullptr;
+	const char *CommandFile = nullptr;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "--green"))
+			Green = true;
+		else if (!strcmp(argv[i], "--opponent"))
+		{
+			Config.opponentPath = { Float2(1200.f, 700.f), Float2(1800.f, 700.f), Float2(1800.f, 1300.f), Float2(1200.f, 1300.f) };
+			if (i + 1 < argc && argv[i + 1][0] != '-')
+				Config.opponentPath = ParsePath(argv[++i]);
+		}
+		else if (!strcmp(argv[i], "--duration") && i + 1 < argc)
+			Duration = atof(argv[++i]);
+		else if (!strcmp(argv[i], "--seed") && i + 1 < argc)
+			Config.seed = (uint32_t)atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--trace") && i + 1 < argc)
+			TraceFile = argv[++i];
+		else if (!strcmp(argv[i], "--commands") && i + 1 < argc)
+			CommandFile = argv[++i];
+		else if (!strcmp(argv[i], "--quiet"))
+			Quiet = true;
+		else
+		{
+			Usage(argv[0]);
+			return 1;
+		}
+	}
+
+	FILE *Trace = nullptr;
+	if (TraceFile)
+	{
+		Trace = fopen(TraceFile, "w");
+		if (!Trace)
+		{
+			perror(TraceFile);
+			return 1;
+		}
+	}
+
+	std::string Commands;
+	if (CommandFile)
+	{
+		FILE *f = fopen(CommandFile, "r");
+		if (!f)
+		{
+			perror(CommandFile);
+			return 1;
+		}
+		char Line[256];
+		while (fgets(Line, sizeof(Line), f))
+			Commands += Line;
+		fclose(f);
+	}
+
+	auto WallStart = std::chrono::steady_clock::now();
+
+	Hal::Host::SetStdinInput(false);
+	Hal::Host::SetSerialOutput(Quiet ? nullptr : stdout);
+
+	Simulator Sim;
+	Sim.Init(Config);
+	Sim.SetGreenSide(Green);
+	SimMatchResult Result = { 0, -1.f, 0.f, 0.f };
+	if (CommandFile)
+		Sim.RunCommands(Commands.c_str(), Duration, Trace);
+	else
+		Result = Sim.RunMatch(Duration, Trace);
+
+	double WallS = std::chrono::duration<double>(std::chrono::steady_clock::now() - WallStart).count();
+	double SimS = Hal::Host::GetTimeUs() * 1e-6;
+	Float2 Odo = PositionManager::Instance.GetPosMm();
+
+	fflush(stdout);
+	printf("simulated %.1f s in %.3f s (x%.0f)\n", SimS, WallS, SimS / WallS);
+	if (!CommandFile)
+	{
+		printf("strategy state reached: %d\n", Result.reachedState);
+		if (Result.completionTime >= 0.f)
+			printf("actions ended after %.2f s\n", Result.completionTime);
+		else
+			printf("actions not ended\n");
+	}
+	printf("true pose:     %7.1f %7.1f %7.2f deg\n", Sim.GetPos().x, Sim.GetPos().y, Sim.GetAngle() * 180.f / (float)M_PI);
+	printf("odometry pose: %7.1f %7.1f %7.2f deg\n", Odo.x, Odo.y, PositionManager::Instance.GetAngleDeg());
+	printf("pose error:    %7.1f mm %7.2f deg\n", (Odo - Sim.GetPos()).Length(),
+		remainderf(PositionManager::Instance.GetAngleRad() - Sim.GetAngle(), 2.f * (float)M_PI) * 180.f / (float)M_PI);
+
+	if (Trace)
+		fclose(Trace);
+	return 0;
+}
@@ -0,0 +1,545 @@
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <atomic>
+#include <thread>
+
+#include "Simulator.h"
+#include "Platform.h"
+#include "PositionManager.h"
+#include "ControlSystem.h"
+#include "Strategy.h"
+
+void setup();
+void loop();
+
+// Motor outputs, see MotorManager.cpp: the RIGHT motor drives the left wheel
+#define SIM_LEFT_WHEEL_PWM 23
+#define SIM_LEFT_WHEEL_DIR 31
+#define SIM_RIGHT_WHEEL_PWM 22
+#define SIM_RIGHT_WHEEL_DIR 26
+
+#define SIM_SERVO_TX 10
+#define SIM_TRACE_PERIOD_US 10000
+
+// GP2 sensors: position on the robot (lateral, forward) and looking forward or backward
+#define SIM_GP2_LATERAL 60.f
+#define SIM_GP2_MAX_RANGE_MM 800.f
+#define SIM_ADC_MAX 1023
+#define SIM_ADC_VREF 3.3f
+
+// XL320: 1023 counts over 300 deg, speed unit 0.111 rpm, speed 0 is the maximum speed
+#define SIM_SERVO_COUNTS_PER_DEG (1023.f / 300.f)
+#define SIM_SERVO_DEG_S_PER_UNIT 0.666f
+#define SIM_SERVO_MAX_SPEED 1023
+#define SIM_XL320_READ 0x02
+#define SIM_XL320_WRITE 0x03
+#define SIM_XL320_STATUS 0x55
+
+namespace
+{
+	thread_local Simulator *s_Active = nullptr;
+
+	void TickHook(uint64_t)
+	{
+		if (s_Active)
+			s_Active->Step(MOTOR_CONTROL_PERIOD_S);
+	}
+
+	// Sharp GP2Y0A21 output against the distance
+	struct GP2Point
+	{
+		float cm, volt;
+	};
+	const GP2Point s_GP2Curve[] = {
+		{ 6.f, 3.1f }, { 10.f, 2.3f }, { 15.f, 1.65f }, { 20.f, 1.3f }, { 30.f, 0.92f },
+		{ 40.f, 0.75f }, { 50.f, 0.6f }, { 60.f, 0.5f }, { 80.f, 0.4f },
+	};
+	const float GP2_FLOOR_VOLT = 0.3f;
+
+	float GP2Voltage(float _mm)
+	{
+		float cm = _mm * 0.1f;
+		if (cm <= s_GP2Curve[0].cm)
+			return s_GP2Curve[0].volt;
+		for (unsigned i = 1; i < _countof(s_GP2Curve); i++)
+		{
+			if (cm <= s_GP2Curve[i].cm)
+			{
+				const GP2Point &a = s_GP2Curve[i - 1], &b = s_GP2Curve[i];
+				return a.volt + (b.volt - a.volt) * (cm - a.cm) / (b.cm - a.cm);
+			}
+		}
+		return GP2_FLOOR_VOLT;
+	}
+
+	// Heading of the robot, as PositionManager integrates it
+	Float2 Heading(float _angle)
+	{
+		return Float2(-sinf(_angle), cosf(_angle));
+	}
+
+	Float2 Lateral(float _angle)
+	{
+		return Float2(cosf(_angle), sinf(_angle));
+	}
+
+	// CRC-16 of the Dynamixel protocol 2.0, polynomial 0x8005
+	uint16_t DynamixelCrc(const uint8_t *_data, size_t _size)
+	{
+		uint16_t Crc = 0;
+		while (_size--)
+		{
+			Crc ^= (uint16_t)(*_data++) << 8;
+			for (int i = 0; i < 8; i++)
+				Crc = (Crc & 0x8000) ? (Crc << 1) ^ 0x8005 : (Crc << 1);
+		}
+		return Crc;
+	}
+
+	bool IsInBox(const Float2 &_p, const SimBox &_box)
+	{
+		return _p.x > _box.min.x && _p.x < _box.max.x && _p.y > _box.min.y && _p.y < _box.max.y;
+	}
+}
+
+void SimParallelFor(int _count, int _threads, const std::function<void(int)> &_job)
+{
+	std::atomic<int> Next(0);
+	std::vector<std::thread> Workers;
+	for (int t = 0; t < std::max(1, _threads); t++)
+	{
+		Workers.emplace_back([&]()
+		{
+			for (int i = Next++; i < _count; i = Next++)
+				std::thread(_job, i).join();
+		});
+	}
+	for (std::thread &w : Workers)
+		w.join();
+}
+
+void Simulator::Init(const SimConfig &_config)
+{
+	m_Config = _config;
+	m_Random.seed(_config.seed);
+
+	for (int i = 0; i < SERVO_COUNT; i++)
+		m_ServoBus.servos[i].Reset(i + 1);
+	Hal::Host::SetSerialDevice(SIM_SERVO_TX, &m_ServoBus);
+
+	if (!m_Config.opponentPath.empty())
+		m_OpponentPos = m_Config.opponentPath[0];
+	UpdateGP2();
+
+	s_Active = this;
+	Hal::Host::SetTickHook(TickHook);
+}
+
+void Simulator::SetStartPulled(bool _pulled)
+{
+	Hal::Host::SetDigitalInput(Platform::startPull, _pulled ? HIGH : LOW);
+}
+
+void Simulator::SetGreenSide(bool _green)
+{
+	Hal::Host::SetDigitalInput(Platform::buttons[2], _green ? LOW : HIGH);
+}
+
+void Simulator::PlaceRobotOnOdometry()
+{
+	m_Pos = PositionManager::Instance.GetPosMm();
+	m_Angle = PositionManager::Instance.GetAngleRad();
+}
+
+SimMatchResult Simulator::RunMatch(double _duration, FILE *_trace)
+{
+	SimMatchResult Result = { 0, -1.f, 0.f, 0.f };
+
+	SetStartPulled(false);
+	setup();
+	PlaceRobotOnOdometry();
+
+	WriteTraceHeader(_trace);
+
+	uint64_t NextTraceUs = 0;
+	uint64_t EndUs = (uint64_t)(_duration * 1e6);
+	while (Hal::Host::GetTimeUs() < EndUs)
+	{
+		double t = Hal::Host::GetTimeUs() * 1e-6;
+		SetStartPulled((t >= SIM_PLACE_PULL_S && t < SIM_PLACE_BACK_S) || t >= SIM_START_PULL_S);
+
+		loop();
+
+		t = Hal::Host::GetTimeUs() * 1e-6;
+		if (Strategy::Instance.GetState() != Strategy::State::END)
+			Result.reachedState = (int)Strategy::Instance.GetState();
+		if (Result.completionTime < 0.f && Strategy::Instance.GetState() >= Strategy::State::WAITING_END
+			&& t < SIM_START_PULL_S + SIM_MATCH_S)
+			Result.completionTime = (float)(t - SIM_START_PULL_S);
+
+		WriteTrace(_trace, NextTraceUs);
+	}
+
+	Result.poseError = (PositionManager::Instance.GetPosMm() - m_Pos).Length();
+	Result.angleError = remainderf(PositionManager::Instance.GetAngleRad() - m_Angle, 2.f * (float)M_PI) * 180.f / (float)M_PI;
+	return Result;
+}
+
+void Simulator::RunCommands(const char *_commands, double _duration, FILE *_trace)
+{
+	SetStartPulled(false);
+	setup();
+	PlaceRobotOnOdometry();
+
+	WriteTraceHeader(_trace);
+
+	uint64_t NextTraceUs = 0, NextCommandUs = 0;
+	uint64_t EndUs = (uint64_t)(_duration * 1e6);
+	while (Hal::Host::GetTimeUs() < EndUs)
+	{
+		// send the lines up to the next "wait <seconds>"
+		while (*_commands && Hal::Host::GetTimeUs() >= NextCommandUs)
+		{
+			const char *End = strchr(_commands, '\n');
+			std::string Line(_commands, End ? End - _commands + 1 : strlen(_commands));
+			_commands += Line.size();
+
+			float Wait;
+			if (sscanf(Line.c_str(), "wait %f", &Wait) == 1)
+				NextCommandUs = Hal::Host::GetTimeUs() + (uint64_t)(Wait * 1e6f);
+			else
+				Hal::Host::InjectSerialInput(Line.c_str());
+		}
+
+		loop();
+		WriteTrace(_trace, NextTraceUs);
+	}
+}
+
+void Simulator::WriteTraceHeader(FILE *_trace) const
+{
+	if (_trace)
+		fprintf(_trace, "time,x,y,angle,odo_x,odo_y,odo_angle,state\n");
+}
+
+void Simulator::WriteTrace(FILE *_trace, uint64_t &_nextUs) const
+{
+	if (!_trace || Hal::Host::GetTimeUs() < _nextUs)
+		return;
+
+	_nextUs = Hal::Host::GetTimeUs() + SIM_TRACE_PERIOD_US;
+	Float2 Odo = PositionManager::Instance.GetPosMm();
+	fprintf(_trace, "%.3f,%.1f,%.1f,%.2f,%.1f,%.1f,%.2f,%d\n", Hal::Host::GetTimeUs() * 1e-6,
+		m_Pos.x, m_Pos.y, m_Angle * 180.f / (float)M_PI,
+		Odo.x, Odo.y, PositionManager::Instance.GetAngleDeg(),
+		(int)Strategy::Instance.GetState());
+}
+
+int Simulator::GetServoPosition(int _id) const
+{
+	if (_id < 1 || _id > SERVO_COUNT)
+		return -1;
+	return (int)m_ServoBus.servos[_id - 1].position;
+}
+
+float Simulator::MotorTarget(uint8_t _pwmPin, uint8_t _dirPin, bool _forwardHigh) const
+{
+	int Pwm = Hal::Host::GetAnalogOutput(_pwmPin);
+	if (Pwm <= m_Config.pwmDeadband)
+		return 0.f;
+	float Speed = m_Config.maxWheelSpeed * (Pwm - m_Config.pwmDeadband) / (float)(255 - m_Config.pwmDeadband);
+	bool Forward = (Hal::Host::GetDigitalOutput(_dirPin) == HIGH) == _forwardHigh;
+	return Forward ? Speed : -Speed;
+}
+
+bool Simulator::IsFree(const Float2 &_pos, float _angle) const
+{
+	Float2 Front = Heading(_angle), Side = Lateral(_angle);
+	float HalfWidth = 0.5f * m_Config.width;
+	const Float2 Corners[] = {
+		_pos + Front * m_Config.front + Side * HalfWidth,
+		_pos + Front * m_Config.front - Side * HalfWidth,
+		_pos - Front * m_Config.back + Side * HalfWidth,
+		_pos - Front * m_Config.back - Side * HalfWidth,
+	};
+	for (const Float2 &c : Corners)
+	{
+		if (c.x < 0.f || c.y < 0.f || c.x > m_Config.table.x || c.y > m_Config.table.y)
+			return false;
+		for (const SimBox &Box : m_Config.obstacles)
+			if (IsInBox(c, Box))
+				return false;
+	}
+
+	if (!m_Config.opponentPath.empty())
+	{
+		// closest point of the robot rectangle to the opponent center
+		Float2 d = m_OpponentPos - _pos;
+		float f = std::min(std::max(d.DotProduct(Front), -m_Config.back), m_Config.front);
+		float s = std::min(std::max(d.DotProduct(Side), -HalfWidth), HalfWidth);
+		Float2 Closest = _pos + Front * f + Side * s;
+		if ((m_OpponentPos - Closest).Length() < m_Config.opponentRadius)
+			return false;
+	}
+	return true;
+}
+
+void Simulator::Step(float _dt)
+{
+	// motors: first order lag towards the speed set by the PWM
+	float Target[2] = {
+		MotorTarget(SIM_LEFT_WHEEL_PWM, SIM_LEFT_WHEEL_DIR, true),
+		MotorTarget(SIM_RIGHT_WHEEL_PWM, SIM_RIGHT_WHEEL_DIR, false),
+	};
+	float Lag = _dt / (m_Config.motorTimeConstant + _dt);
+	float Ground[2];
+	for (int w = 0; w < 2; w++)
+	{
+		m_MotorSpeed[w] += (Target[w] - m_MotorSpeed[w]) * Lag;
+
+		// the robot follows the wheels until they slip
+		float MaxDelta = m_Config.slipAcc[w] * _dt;
+		float Delta = m_MotorSpeed[w] - m_GroundSpeed[w];
+		Ground[w] = m_GroundSpeed[w] + std::min(std::max(Delta, -MaxDelta), MaxDelta);
+	}
+
+	// move, or pivot on the blocked side, or slide along the obstacle, or stay
+	StepOpponent(_dt);
+	float Angle = m_Angle + (Ground[RIGHT] - Ground[LEFT]) / m_Config.trackMm * _dt;
+	Float2 Move = Heading(0.5f * (m_Angle + Angle)) * (0.5f * (Ground[LEFT] + Ground[RIGHT]) * _dt);
+	float PivotAngle[2] = {
+		m_Angle + Ground[RIGHT] / m_Config.trackMm * _dt,	// left wheel blocked
+		m_Angle - Ground[LEFT] / m_Config.trackMm * _dt,	// right wheel blocked
+	};
+	// a corner rubbing on an obstacle pushes the robot aside, at most at the corner speed
+	float Push = Move.Length() + fabsf(Angle - m_Angle) * sqrtf(0.25f * m_Config.width * m_Config.width
+		+ std::max(m_Config.front, m_Config.back) * std::max(m_Config.front, m_Config.back));
+	const struct { Float2 pos; float angle; } Tries[] = {
+		{ m_Pos + Move, Angle },
+		{ m_Pos + Heading(PivotAngle[0]) * (0.5f * Ground[RIGHT] * _dt), PivotAngle[0] },
+		{ m_Pos + Heading(PivotAngle[1]) * (0.5f * Ground[LEFT] * _dt), PivotAngle[1] },
+		{ m_Pos + Move + Float2(Push, 0.f), Angle },
+		{ m_Pos + Move - Float2(Push, 0.f), Angle },
+		{ m_Pos + Move + Float2(0.f, Push), Angle },
+		{ m_Pos + Move - Float2(0.f, Push), Angle },
+		{ m_Pos + Float2(Move.x, 0.f), m_Angle },
+		{ m_Pos + Float2(0.f, Move.y), m_Angle },
+	};
+	m_Blocked = true;
+	m_GroundSpeed[LEFT] = m_GroundSpeed[RIGHT] = 0.f;
+	for (unsigned i = 0; i < _countof(Tries); i++)
+	{
+		if (!IsFree(Tries[i].pos, Tries[i].angle))
+			continue;
+
+		// the odometry wheels roll with the actual move
+		float v = (Tries[i].pos - m_Pos).DotProduct(Heading(m_Angle)) / _dt;
+		float w = (Tries[i].angle - m_Angle) * 0.5f * m_Config.trackMm / _dt;
+		m_GroundSpeed[LEFT] = v - w;
+		m_GroundSpeed[RIGHT] = v + w;
+		m_Pos = Tries[i].pos;
+		m_Angle = Tries[i].angle;
+		m_Blocked = (i != 0);
+		break;
+	}
+
+	// encoders, on the odometry wheels: they roll with the robot, not with the motors
+	std::normal_distribution<float> Noise(0.f, m_Config.encoderNoise);
+	for (int w = 0; w < 2; w++)
+	{
+		m_EncoderTicks[w] += m_GroundSpeed[w] * _dt * m_Config.ticksPerM[w] * 0.001f;
+		if (m_Config.encoderNoise > 0.f)
+			m_EncoderTicks[w] += Noise(m_Random);
+	}
+	Hal::Host::SetEncoder(1, (int32_t)lround(m_EncoderTicks[LEFT]));
+	Hal::Host::SetEncoder(2, -(int32_t)lround(m_EncoderTicks[RIGHT]));
+
+	UpdateGP2();
+	m_ServoBus.Step(_dt);
+}
+
+void Simulator::StepOpponent(float _dt)
+{
+	const std::vector<Float2> &Path = m_Config.opponentPath;
+	if (Path.size() < 2)
+		return;
+	Float2 d = Path[m_OpponentTarget] - m_OpponentPos;
+	float Step = m_Config.opponentSpeed * _dt;
+	if (d.Length() <= Step)
+	{
+		m_OpponentPos = Path[m_OpponentTarget];
+		m_OpponentTarget = (m_OpponentTarget + 1) % Path.size();
+	}
+	else
+		m_OpponentPos += d * (Step / d.Length());
+}
+
+float Simulator::GP2Distance(const Float2 &_origin, const Float2 &_dir) const
+{
+	// only the opponent is seen, the sensors are above the table borders
+	if (m_Config.opponentPath.empty())
+		return SIM_GP2_MAX_RANGE_MM;
+	Float2 d = m_OpponentPos - _origin;
+	float Along = d.DotProduct(_dir);
+	float Across2 = d.LengthSquared() - Along * Along;
+	float r2 = m_Config.opponentRadius * m_Config.opponentRadius;
+	if (Along <= 0.f || Across2 > r2)
+		return SIM_GP2_MAX_RANGE_MM;
+	return std::max(0.f, Along - sqrtf(r2 - Across2));
+}
+
+void Simulator::UpdateGP2()
+{
+	Float2 Front = Heading(m_Angle), Side = Lateral(m_Angle);
+	for (unsigned i = 0; i < _countof(Platform::gp2Pins); i++)
+	{
+		bool IsFront = Platform::gp2IsFront[i];
+		float Lat = (i & 1) ? -SIM_GP2_LATERAL : SIM_GP2_LATERAL;
+		Float2 Dir = IsFront ? Front : -Front;
+		Float2 Origin = m_Pos + Dir * (IsFront ? m_Config.front : m_Config.back) + Side * Lat;
+		float Volt = GP2Voltage(GP2Distance(Origin, Dir));
+		Hal::Host::SetAnalogInput(Platform::gp2Pins[i], (int)(Volt / SIM_ADC_VREF * SIM_ADC_MAX));
+	}
+}
+
+// XL320 servos
+
+void Simulator::Servo::Reset(int _id)
+{
+	memset(table, 0, sizeof(table));
+	Set((int)XL320::Address::MODEL_NUMBER, 350, 2);
+	Set((int)XL320::Address::ID, _id, 1);
+	Set((int)XL320::Address::BAUD_RATE, 2, 1);
+	Set((int)XL320::Address::CCW_ANGLE_LIMIT, 1023, 2);
+	Set((int)XL320::Address::CONTROL_MODE, 2, 1);
+	Set((int)XL320::Address::MAX_TORQUE, 1023, 2);
+	Set((int)XL320::Address::RETURN_LEVEL, 2, 1);
+	Set((int)XL320::Address::P_GAIN, 32, 1);
+	Set((int)XL320::Address::GOAL_POSITION, 512, 2);
+	Set((int)XL320::Address::PRESENT_POSITION, 512, 2);
+	Set((int)XL320::Address::PRESENT_VOLTAGE, 74, 1);
+	Set((int)XL320::Address::PRESENT_TEMPERATURE, 30, 1);
+	Set((int)XL320::Address::PUNCH, 32, 2);
+	position = 512.f;
+}
+
+int Simulator::Servo::Get(int _address, int _size) const
+{
+	if (_address < 0 || _address + _size > (int)sizeof(table))
+		return 0;
+	return (_size == 2) ? table[_address] | (table[_address + 1] << 8) : table[_address];
+}
+
+void Simulator::Servo::Set(int _address, int _value, int _size)
+{
+	if (_address < 0 || _address + _size > (int)sizeof(table))
+		return;
+	table[_address] = _value & 0xFF;
+	if (_size == 2)
+		table[_address + 1] = (_value >> 8) & 0xFF;
+}
+
+void Simulator::ServoBus::Receive(uint8_t _c)
+{
+	rx.push_back(_c);
+
+	// resynchronize on the FF FF FD 00 header
+	static const uint8_t Header[] = { 0xFF, 0xFF, 0xFD, 0x00 };
+	while (!rx.empty())
+	{
+		size_t n = std::min(rx.size(), sizeof(Header));
+		if (memcmp(rx.data(), Header, n) == 0)
+			break;
+		rx.erase(rx.begin());
+	}
+	if (rx.size() < 7)
+		return;
+	size_t Size = 7 + (rx[5] | (rx[6] << 8));
+	if (rx.size() < Size)
+		return;
+
+	uint16_t Crc = DynamixelCrc(rx.data(), Size - 2);
+	if (rx[Size - 2] == (Crc & 0xFF) && rx[Size - 1] == (Crc >> 8))
+		Execute(rx.data());
+	rx.erase(rx.begin(), rx.begin() + Size);
+}
+
+int Simulator::ServoBus::Read()
+{
+	if (tx.empty())
+		return -1;
+	int c = tx[0];
+	tx.erase(tx.begin());
+	return c;
+}
+
+void Simulator::ServoBus::Execute(const uint8_t *_packet)
+{
+	int Id = _packet[4];
+	int ParamCount = (_packet[5] | (_packet[6] << 8)) - 3;
+	uint8_t Instruction = _packet[7];
+	const uint8_t *Params = &_packet[8];
+	if (ParamCount < 2)
+		return;
+	int Address = Params[0] | (Params[1] << 8);
+
+	for (Servo &s : servos)
+	{
+		if (Id != (int)ServoID::ALL && Id != s.table[(int)XL320::Address::ID])
+			continue;
+
+		if (Instruction == SIM_XL320_WRITE)
+		{
+			for (int i = 2; i < ParamCount; i++)
+				s.Set(Address + i - 2, Params[i], 1);
+			if (Id != (int)ServoID::ALL)
+				Reply(Id, nullptr, 0);
+		}
+		else if (Instruction == SIM_XL320_READ && ParamCount >= 4 && Id != (int)ServoID::ALL)
+		{
+			int Size = std::min(Params[2] | (Params[3] << 8), (int)sizeof(s.table) - Address);
+			if (Size > 0)
+				Reply(Id, &s.table[Address], Size);
+		}
+	}
+}
+
+void Simulator::ServoBus::Reply(int _id, const uint8_t *_params, int _count)
+{
+	// status packet: the error byte comes before the parameters
+	uint8_t Packet[7 + 4 + sizeof(Servo::table)];
+	int Length = _count + 4;
+	Packet[0] = 0xFF;
+	Packet[1] = 0xFF;
+	Packet[2] = 0xFD;
+	Packet[3] = 0x00;
+	Packet[4] = _id;
+	Packet[5] = Length & 0xFF;
+	Packet[6] = (Length >> 8) & 0xFF;
+	Packet[7] = SIM_XL320_STATUS;
+	Packet[8] = 0;
+	if (_count)
+		memcpy(&Packet[9], _params, _count);
+	uint16_t Crc = DynamixelCrc(Packet, Length + 5);
+	Packet[Length + 5] = Crc & 0xFF;
+	Packet[Length + 6] = Crc >> 8;
+	tx.insert(tx.end(), Packet, Packet + Length + 7);
+}
+
+void Simulator::ServoBus::Step(float _dt)
+{
+	for (Servo &s : servos)
+	{
+		int Goal = s.Get((int)XL320::Address::GOAL_POSITION, 2) & 0x3FF;
+		int Speed = s.Get((int)XL320::Address::GOAL_SPEED, 2) & 0x3FF;
+		if (Speed == 0)
+			Speed = SIM_SERVO_MAX_SPEED;
+		float Step = Speed * SIM_SERVO_DEG_S_PER_UNIT * SIM_SERVO_COUNTS_PER_DEG * _dt;
+		float d = Goal - s.position;
+		s.position += std::min(std::max(d, -Step), Step);
+		s.Set((int)XL320::Address::PRESENT_POSITION, (int)lroundf(s.position), 2);
+		s.Set((int)XL320::Address::MOVING, fabsf(d) > Step ? 1 : 0, 1);
+	}
+}
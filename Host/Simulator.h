@@ -0,0 +1,158 @@
+#ifndef SIMULATOR_H
+#define SIMULATOR_H
+
+// Differential drive robot simulator, plugged under the firmware through the
+// host HAL: it drives the encoders, GP2 inputs and XL320 bus from the motor
+// PWM and direction pins, at every scheduler tick.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <functional>
+#include <random>
+#include <vector>
+
+#include "HalHost.h"
+#include "Float2.h"
+
+// Starting cord sequence: pulled to place the robot, put back, then pulled for the start
+#define SIM_PLACE_PULL_S 1.
+#define SIM_PLACE_BACK_S 3.
+#define SIM_START_PULL_S 5.
+#define SIM_MATCH_S 95.
+#define SIM_MATCH_END_S (SIM_START_PULL_S + SIM_MATCH_S + 1.)
+
+struct SimBox
+{
+	Float2 min, max;
+};
+
+struct SimConfig
+{
+	// Drive, per wheel: left then right (as seen by PositionManager)
+	float maxWheelSpeed = 2000.f;		// mm/s at full PWM, above the deadband
+	float motorTimeConstant = 0.06f;	// s
+	int pwmDeadband = 12;				// PWM under which the motor does not turn
+	float slipAcc[2] = { 4000.f, 4000.f };// mm/s^2, ground acceleration before the wheel slips
+	float trackMm = 127.2f;				// between the encoder wheels
+	float ticksPerM[2] = { 21638.f, 21638.f };
+	float encoderNoise = 0.f;			// standard deviation of the encoder error, ticks per tick
+
+	// Robot footprint, around the axle center
+	float width = 235.f;
+	float front = 95.f;
+	float back = 55.f;
+
+	// Table and fixed obstacles
+	Float2 table = Float2(3000.f, 2000.f);
+	std::vector<SimBox> obstacles = { { Float2(900.f, 1750.f), Float2(2100.f, 2000.f) } };
+
+	// Opponent: a disc patrolling along its waypoints (none: no opponent)
+	std::vector<Float2> opponentPath;
+	float opponentSpeed = 300.f;		// mm/s
+	float opponentRadius = 150.f;
+
+	uint32_t seed = 1;
+};
+
+struct SimMatchResult
+{
+	int reachedState;		// last Strategy::State before the end of the match
+	float completionTime;	// s after the start when all the actions ended, < 0 if they did not
+	float poseError;		// mm, between the odometry and the true pose
+	float angleError;		// deg
+};
+
+// Run _job(0) to _job(_count - 1) on _threads parallel workers. Every job runs
+// in a thread of its own, with fresh firmware singletons (HAL_THREAD_LOCAL).
+void SimParallelFor(int _count, int _threads, const std::function<void(int)> &_job);
+
+class Simulator
+{
+public:
+	enum Wheel { LEFT, RIGHT };
+
+	static const int SERVO_COUNT = 3;
+
+	// Plug the simulator under the firmware, must be called before setup()
+	void Init(const SimConfig &_config);
+
+	// Starting cord: pulled out or put back
+	void SetStartPulled(bool _pulled);
+	// Side selection button, pressed for green
+	void SetGreenSide(bool _green);
+
+	// Robot pose as set by the firmware at the end of setup()
+	void PlaceRobotOnOdometry();
+
+	// Run the firmware from setup() until _duration (s), with the starting cord
+	// sequence of a match. The poses are written to _trace every 10 ms if not null.
+	SimMatchResult RunMatch(double _duration = SIM_MATCH_END_S, FILE *_trace = nullptr);
+	// Run the firmware from setup() until _duration (s), the starting cord in
+	// place, with _commands (one per line) sent to its command line interface.
+	// A "wait <seconds>" line delays the next ones.
+	void RunCommands(const char *_commands, double _duration, FILE *_trace = nullptr);
+
+	Float2 GetPos() const		{ return m_Pos; }
+	float GetAngle() const		{ return m_Angle; }
+	float GetWheelSpeed(Wheel _w) const { return m_GroundSpeed[_w]; }
+	// Motor wheel speed minus ground speed, not null when the wheel slips
+	float GetWheelSlip(Wheel _w) const	{ return m_MotorSpeed[_w] - m_GroundSpeed[_w]; }
+	Float2 GetOpponentPos() const { return m_OpponentPos; }
+	int GetServoPosition(int _id) const;
+	bool IsBlocked() const		{ return m_Blocked; }
+
+	// Called at every scheduler tick, before the firmware interrupt
+	void Step(float _dt);
+
+private:
+	struct Servo
+	{
+		uint8_t table[64];	// control table
+		float position;		// present position, 0 to 1023
+
+		void Reset(int _id);
+		int Get(int _address, int _size) const;
+		void Set(int _address, int _value, int _size);
+	};
+
+	// XL320 bus on the servo serial, protocol 2.0
+	struct ServoBus : Hal::Host::SerialDevice
+	{
+		Servo servos[SERVO_COUNT];
+		std::vector<uint8_t> rx, tx;
+
+		void Receive(uint8_t _c) override;
+		int Available() override	{ return (int)tx.size(); }
+		int Read() override;
+		int Peek() override			{ return tx.empty() ? -1 : tx[0]; }
+
+		void Execute(const uint8_t *_packet);
+		void Reply(int _id, const uint8_t *_params, int _count);
+		void Step(float _dt);
+	};
+
+	void WriteTraceHeader(FILE *_trace) const;
+	void WriteTrace(FILE *_trace, uint64_t &_nextUs) const;
+	float MotorTarget(uint8_t _pwmPin, uint8_t _dirPin, bool _forwardHigh) const;
+	bool IsFree(const Float2 &_pos, float _angle) const;
+	void StepOpponent(float _dt);
+	void UpdateGP2();
+	float GP2Distance(const Float2 &_origin, const Float2 &_dir) const;
+
+	SimConfig m_Config;
+	std::mt19937 m_Random;
+
+	Float2 m_Pos;
+	float m_Angle = 0.f;
+	float m_MotorSpeed[2] = { 0.f, 0.f };	// wheel surface speed
+	float m_GroundSpeed[2] = { 0.f, 0.f };
+	double m_EncoderTicks[2] = { 0., 0. };
+	bool m_Blocked = false;
+
+	Float2 m_OpponentPos = Float2(-1000.f, -1000.f);
+	unsigned m_OpponentTarget = 0;
+
+	ServoBus m_ServoBus;
+};
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef HOST_SOFTWARE_SERIAL_H
+#define HOST_SOFTWARE_SERIAL_H
+
+#include "Stream.h"
+
+// Serial port on any pins, the bytes are exchanged with the device plugged
+// by Hal::Host::SetSerialDevice (nothing plugged: writes are dropped)
+class SoftwareSerial : public Stream
+{
+public:
+	SoftwareSerial(uint8_t _rx, uint8_t _tx) : m_Rx(_rx), m_Tx(_tx) {}
+
+	void begin(long _baud) { m_Baud = _baud; }
+	long GetBaud() const { return m_Baud; }
+	uint8_t GetTxPin() const { return m_Tx; }
+
+	size_t write(uint8_t _c) override;
+	int available() override;
+	int read() override;
+	int peek() override;
+	using Stream::write;
+
+private:
+	uint8_t m_Rx, m_Tx;
+	long m_Baud = 0;
+};
+
+#endif
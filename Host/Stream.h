@@ -0,0 +1,51 @@
+#ifndef HOST_STREAM_H
+#define HOST_STREAM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+// Subset of the Arduino Print/Stream classes used by the firmware
+class Stream
+{
+public:
+	virtual ~Stream() {}
+
+	virtual size_t write(uint8_t _c) = 0;
+	virtual size_t write(const uint8_t *_buffer, size_t _size);
+	virtual int available() = 0;
+	virtual int read() = 0;
+	virtual int peek() { return -1; }
+	virtual void flush() {}
+
+	size_t write(const char *_str);
+
+	size_t print(const char *_str) { return write(_str); }
+	size_t print(char _c) { return write((uint8_t)_c); }
+	size_t print(int _n, int _base = DEC) { return print((long)_n, _base); }
+	size_t print(unsigned int _n, int _base = DEC) { return print((unsigned long)_n, _base); }
+	size_t print(long _n, int _base = DEC);
+	size_t print(unsigned long _n, int _base = DEC);
+	size_t print(double _n, int _digits = 2);
+
+	size_t println() { return write("\r\n"); }
+	template <typename T>
+	size_t println(T _value) { size_t n = print(_value); return n + println(); }
+	template <typename T>
+	size_t println(T _value, int _format) { size_t n = print(_value, _format); return n + println(); }
+
+	int printf(const char *_format, ...) __attribute__((format(printf, 2, 3)));
+
+	void setTimeout(unsigned long _ms) { m_Timeout = _ms; }
+	size_t readBytes(char *_buffer, size_t _length);
+	size_t readBytes(uint8_t *_buffer, size_t _length) { return readBytes((char *)_buffer, _length); }
+
+protected:
+	unsigned long m_Timeout = 1000;
+};
+
+#endif
@@ -0,0 +1,274 @@
+// Decoder of the binary telemetry of Main/Telemetry.h ("telemetry binary"):
+// converts a serial capture to CSV, or to a columnar file for analysis.
+// Text mixed with the frames (command echoes...) is ignored, and the decoding
+// restarts from the next key frame after a corrupted frame. The events are
+// printed to stderr.
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string>
+#include <vector>
+
+#include "Telemetry.h"
+#include "Encoding.h"
+
+static void Usage(const char *_name)
+{
+	printf("usage: %s [--output file.csv] [--columnar file.bin] [capture]\n", _name);
+	printf("  capture     serial output of the robot (stdin by default)\n");
+	printf("  --output    CSV file (stdout by default): time in s, then one column per channel\n");
+	printf("  --columnar  write instead \"CTLM\", channel count (uint32), channel names\n");
+	printf("              (0 terminated), row count (uint64), the time column (double)\n");
+	printf("              then one column per channel (float, NaN when missing)\n");
+}
+
+struct Channel
+{
+	std::string name;
+	float scale = 1.f;
+	int32_t value = 0;
+	bool valid = false;
+};
+
+struct Row
+{
+	double time;
+	std::vector<float> values;
+};
+
+class Decoder
+{
+public:
+	std::vector<Channel> m_Channels;
+	std::vector<Row> m_Rows;
+	uint64_t m_Frames = 0, m_BadFrames = 0, m_Text = 0, m_Dropped = 0, m_Events = 0;
+
+	void Decode(const uint8_t *_frame, size_t _size)
+	{
+		std::vector<uint8_t> Frame(_size);
+		size_t Size = Encoding::DecodeCobs(_frame, _size, Frame.data());
+		if (Size < 2 || Encoding::Crc8(Frame.data(), Size - 1) != Frame[Size - 1])
+		{
+			// a corrupted frame: the deltas are lost until the next key frame
+			if (IsText(_frame, _size))
+				m_Text++;
+			else
+			{
+				m_BadFrames++;
+				m_TimeValid = false;
+			}
+			return;
+		}
+		m_Frames++;
+		Size--;
+
+		const uint8_t *p = Frame.data() + 1, *End = Frame.data() + Size;
+		switch ((TelemetryFrame)Frame[0])
+		{
+		case TelemetryFrame::TABLE:
+			if (Size == 2)
+				m_Channels.resize(p[0]);
+			else if (Size >= 7 && p[0] < m_Channels.size())
+			{
+				Channel &c = m_Channels[p[0]];
+				memcpy(&c.scale, p + 1, sizeof(float));
+				c.name.assign((const char*)p + 5, strnlen((const char*)p + 5, End - p - 5));
+			}
+			break;
+		case TelemetryFrame::KEY:
+		case TelemetryFrame::DELTA:
+		{
+			int32_t Time;
+			unsigned n = Encoding::DecodeVarint(p, End - p, Time);
+			if (!n || m_Channels.empty())
+				return;
+			p += n;
+			if ((TelemetryFrame)Frame[0] == TelemetryFrame::KEY)
+			{
+				m_TimeUs = (uint32_t)Time;
+				m_TimeValid = true;
+				for (Channel &c : m_Channels)
+					c.valid = false;
+			}
+			else if (m_TimeValid)
+				m_TimeUs += (uint32_t)Time;
+			else
+				return;
+
+			bool NewRow = true;
+			while (p < End)
+			{
+				uint8_t Id = *p++;
+				int32_t Value;
+				n = Encoding::DecodeVarint(p, End - p, Value);
+				unsigned Index = Id & ~TELEMETRY_ABSOLUTE;
+				if (!n || Index >= m_Channels.size())
+					return;
+				p += n;
+
+				// same rule as the firmware: a channel not after the previous one starts a sample
+				if (NewRow && (m_Rows.empty() || (int)Index <= m_LastChannel))
+					StartRow();
+				NewRow = false;
+				m_LastChannel = Index;
+
+				Channel &c = m_Channels[Index];
+				if (Id & TELEMETRY_ABSOLUTE)
+				{
+					c.value = Value;
+					c.valid = true;
+				}
+				else
+					c.value += Value;
+				if (c.valid)
+					m_Rows.back().values[Index] = c.value / c.scale;
+			}
+			break;
+		}
+		case TelemetryFrame::DROPPED:
+		{
+			int32_t Count;
+			if (Encoding::DecodeVarint(p, End - p, Count))
+				m_Dropped += (uint32_t)Count;
+			break;
+		}
+		case TelemetryFrame::EVENT:
+		{
+			int32_t Time;
+			unsigned n = Encoding::DecodeVarint(p, End - p, Time);
+			if (!n || p + n >= End)
+				return;
+			p += n + 1;
+			std::string Message((const char*)p, strnlen((const char*)p, End - p));
+			fprintf(stderr, "%10.3f s  %s\n", (uint32_t)Time * 1e-6, Message.c_str());
+			m_Events++;
+			break;
+		}
+		}
+	}
+
+private:
+	// Lines printed between the frames (command echoes...): the frame types
+	// are control characters, so a frame is never only text
+	static bool IsText(const uint8_t *_data, size_t _size)
+	{
+		for (size_t i = 0; i < _size; i++)
+		{
+			if ((_data[i] < ' ' || _data[i] > '~') && _data[i] != '\r' && _data[i] != '\n' && _data[i] != '\t')
+				return false;
+		}
+		return true;
+	}
+
+	void StartRow()
+	{
+		Row r;
+		r.time = m_TimeUs * 1e-6;
+		r.values.assign(m_Channels.size(), NAN);
+		m_Rows.push_back(r);
+	}
+
+	uint32_t m_TimeUs = 0;
+	bool m_TimeValid = false;
+	int m_LastChannel = -1;
+};
+
+int main(int argc, char **argv)
+{
+	const char *CaptureFile = nullptr;
+	const char *OutputFile = nullptr;
+	const char *ColumnarFile = nullptr;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "--output") && i + 1 < argc)
+			OutputFile = argv[++i];
+		else if (!strcmp(argv[i], "--columnar") && i + 1 < argc)
+			ColumnarFile = argv[++i];
+		else if (argv[i][0] != '-' && !CaptureFile)
+			CaptureFile = argv[i];
+		else
+		{
+			Usage(argv[0]);
+			return 1;
+		}
+	}
+
+	FILE *In = CaptureFile ? fopen(CaptureFile, "rb") : stdin;
+	if (!In)
+	{
+		perror(CaptureFile);
+		return 1;
+	}
+	Decoder Dec;
+	std::vector<uint8_t> Frame;
+	int c;
+	while ((c = fgetc(In)) != EOF)
+	{
+		if (c)
+		{
+			Frame.push_back((uint8_t)c);
+			continue;
+		}
+		if (!Frame.empty())
+			Dec.Decode(Frame.data(), Frame.size());
+		Frame.clear();
+	}
+	if (In != stdin)
+		fclose(In);
+
+	if (ColumnarFile)
+	{
+		FILE *Out = fopen(ColumnarFile, "wb");
+		if (!Out)
+		{
+			perror(ColumnarFile);
+			return 1;
+		}
+		uint32_t Count = (uint32_t)Dec.m_Channels.size();
+		uint64_t Rows = Dec.m_Rows.size();
+		fwrite("CTLM", 1, 4, Out);
+		fwrite(&Count, sizeof(Count), 1, Out);
+		for (const Channel &ch : Dec.m_Channels)
+			fwrite(ch.name.c_str(), 1, ch.name.size() + 1, Out);
+		fwrite(&Rows, sizeof(Rows), 1, Out);
+		for (const Row &r : Dec.m_Rows)
+			fwrite(&r.time, sizeof(double), 1, Out);
+		for (uint32_t i = 0; i < Count; i++)
+			for (const Row &r : Dec.m_Rows)
+				fwrite(&r.values[i], sizeof(float), 1, Out);
+		fclose(Out);
+	}
+	else
+	{
+		FILE *Out = OutputFile ? fopen(OutputFile, "w") : stdout;
+		if (!Out)
+		{
+			perror(OutputFile);
+			return 1;
+		}
+		fprintf(Out, "time");
+		for (const Channel &ch : Dec.m_Channels)
+			fprintf(Out, ",\"%s\"", ch.name.c_str());
+		fprintf(Out, "\n");
+		for (const Row &r : Dec.m_Rows)
+		{
+			fprintf(Out, "%.6f", r.time);
+			for (float v : r.values)
+			{
+				if (isnan(v))
+					fprintf(Out, ",");
+				else
+					fprintf(Out, ",%g", v);
+			}
+			fprintf(Out, "\n");
+		}
+		if (Out != stdout)
+			fclose(Out);
+	}
+
+	fprintf(stderr, "%llu frames, %llu corrupted, %llu text lines, %zu samples of %zu channels, %llu events, %llu records dropped by the robot\n",
+		(unsigned long long)Dec.m_Frames, (unsigned long long)Dec.m_BadFrames, (unsigned long long)Dec.m_Text, Dec.m_Rows.size(), Dec.m_Channels.size(),
+		(unsigned long long)Dec.m_Events, (unsigned long long)Dec.m_Dropped);
+	return 0;
+}
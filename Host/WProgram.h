@@ -0,0 +1,63 @@
+#ifndef HOST_WPROGRAM_H
+#define HOST_WPROGRAM_H
+
+// POSIX backend of the Arduino/Teensy core functions used by the firmware,
+// see Main/Hal.h
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+#include <algorithm>
+
+#include "Stream.h"
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+using std::min;
+using std::max;
+
+#ifndef M_TWOPI
+#define M_TWOPI (M_PI * 2.0)
+#endif
+
+#define stricmp strcasecmp
+
+#define LOW 0
+#define HIGH 1
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+
+// stdin/stdout
+class HostSerial : public Stream
+{
+public:
+	void begin(long) {}
+	size_t write(uint8_t _c) override;
+	size_t write(const uint8_t *_buffer, size_t _size) override;
+	int available() override;
+	int read() override;
+	int peek() override;
+	void flush() override;
+	using Stream::write;
+};
+
+extern HostSerial Serial;
+
+void pinMode(uint8_t _pin, uint8_t _mode);
+void digitalWrite(uint8_t _pin, uint8_t _value);
+uint8_t digitalRead(uint8_t _pin);
+int analogRead(uint8_t _pin);
+void analogWrite(uint8_t _pin, int _value);
+void analogWriteFrequency(uint8_t _pin, float _frequency);
+
+uint32_t millis();
+uint32_t micros();
+void delay(uint32_t _ms);
+void delayMicroseconds(uint32_t _us);
+
+#endif
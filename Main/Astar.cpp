@@ -1,5 +1,5 @@
-#ifdef ENABLE_ASTAR
 #include "Astar.h"
+#ifdef ENABLE_ASTAR
 #include "TrajectoryManager.h"
 #include "PositionManager.h"
 #include <cmath>
@@ -68,8 +68,8 @@ void astar_test(AStarCoord _c)
 //		cout << "ERROR : __throw_length_error" << endl;
 //}
 
-Graph Graph::Instance;
-AStar AStar::Instance(Graph::Instance);
+HAL_THREAD_LOCAL Graph Graph::Instance;
+HAL_THREAD_LOCAL AStar AStar::Instance(Graph::Instance);
 
 void AStarCoord::ToWordPosition(Float2 & _pos) const
 {
@@ -77,10 +77,11 @@ void AStarCoord::ToWordPosition(Float2 & _pos) const
 	_pos.y = (y + 0.5f) * (TERRAIN_HEIGHT / Graph::HEIGHT);
 }
 
+// The odometry can drift past the borders: such positions are on the border cells
 void AStarCoord::FromWordPosition(const Float2 &_pos)
 {
-	x = _pos.x * (Graph::WIDTH / TERRAIN_WIDTH);
-	y = _pos.y * (Graph::HEIGHT / TERRAIN_HEIGHT);
+	x = Math::Clamp((int)(_pos.x * (Graph::WIDTH / TERRAIN_WIDTH)), 0, Graph::WIDTH - 1);
+	y = Math::Clamp((int)(_pos.y * (Graph::HEIGHT / TERRAIN_HEIGHT)), 0, Graph::HEIGHT - 1);
 }
 
 void AStar::Node::SetParent(const Node & parent)
@@ -108,12 +109,7 @@ Graph::Graph()
 
 void Graph::Init()
 {
-	for (int y = 0; y < HEIGHT; y++) {
-		for (int x = 0; x < WIDTH; x++) {
-			m_Data[x][y].v = Value::EMPTY;
-			m_Data[x][y].parent = AStarCoord();
-		}
-	}
+	Clear();
 	
 	float margin = OBSTACLE_MARGIN;
 	// Start zones
@@ -158,6 +154,16 @@ void Graph::Init()
 	}
 }
 
+void Graph::Clear()
+{
+	for (int y = 0; y < HEIGHT; y++) {
+		for (int x = 0; x < WIDTH; x++) {
+			m_Data[x][y].v = Value::EMPTY;
+			m_Data[x][y].parent = NO_PARENT;
+		}
+	}
+}
+
 Graph::InternalNode & Graph::operator[](const AStarCoord & c)
 {
 	if ((unsigned)c.x >= WIDTH || (unsigned)c.y >= HEIGHT) {
@@ -178,7 +184,7 @@ const Graph::InternalNode & Graph::operator[](const AStarCoord & c) const
 
 void Graph::Print(bool _debug) const
 {
-	Serial.printf("size %d\r\n", sizeof(m_Data));
+	Serial.printf("size %d\r\n", (int)sizeof(m_Data));
 	for (int y = 0; y < HEIGHT; y++) {
 		for (int x = 0; x < WIDTH; x++) {
 			auto v = m_Data[x][y].v;
@@ -230,9 +236,13 @@ void Graph::GetNeighbors(const AStar::Node & node, Vector<AStar::Node> &neightbo
 void Graph::GetParents(const AStar::Node & node, Vector<AStar::Node> &parents) const
 {
 	AStarCoord cur = node._pos;
-	while (cur != AStarCoord()) {
+	for (;;) {
 		parents.Push(AStar::Node(cur));
-		cur = (*this)[cur].parent;
+		uint8_t parent = (*this)[cur].parent;
+		if (parent == NO_PARENT)
+			break;
+		cur.x += parent / 3 - 1;
+		cur.y += parent % 3 - 1;
 	}
 }
 
@@ -275,7 +285,7 @@ struct ClosedList {
 
 	ClosedList(Graph& graph)
 		: m_Graph(graph) {
-
+		m_Data.Reserve(ASTAR_MAX_NODES);
 	}
 
 	void insert(AStar::Node e) {
@@ -304,7 +314,7 @@ struct ClosedList {
 	}
 
 	bool IsFull(void) const {
-		return false;
+		return m_Data.Size() >= ASTAR_MAX_NODES;
 	}
 
 	void Flush(void) {
@@ -320,6 +330,7 @@ struct OpenList {
 
 	OpenList(Graph& graph, AStar::Node dest)
 		: m_Graph(graph), _dest(dest) {
+		m_Data.Reserve(ASTAR_MAX_NODES);
 	}
 
 	void insert(AStar::Node e) {
@@ -373,7 +384,7 @@ struct OpenList {
 	}
 
 	bool IsFull(void) const {
-		return false;
+		return m_Data.Size() >= ASTAR_MAX_NODES;
 	}
 
 	void Flush(void) {
@@ -1,8 +1,13 @@
-#if !defined(_ASTAR_H_) && defined(ENABLE_ASTAR)
+#ifndef _ASTAR_H_
 #define _ASTAR_H_
 
+#include "Globals.h"
+#ifdef ENABLE_ASTAR
 #include "Vector.h"
-#include "Gloabls.h"
+
+// Of the open and of the closed lists of a search, 12 bytes each, then
+// FindPath gives up with ERROR_OUT_OF_MEMORY
+#define ASTAR_MAX_NODES 256
 
 struct AStarCoord
 {
@@ -70,7 +75,7 @@ public:
 		}
 	};
 
-	static AStar Instance;
+	static HAL_THREAD_LOCAL AStar Instance;
 
 	AStar(Graph& g)
 		: m_Graph(g) {
@@ -96,7 +101,7 @@ private:
 
 class Graph {
 public:
-	static Graph Instance;
+	static HAL_THREAD_LOCAL Graph Instance;
 	enum class Value : char {
 		EMPTY,
 		OBSTACLE,
@@ -105,20 +110,27 @@ public:
 		PATH
 	};
 
+	// 2 bytes, the whole table fits in the RAM of the Teensy:
+	// the parent is the direction of the neighbor cell, see SetParent
 	struct InternalNode {
-		AStarCoord parent;
+		uint8_t parent;
 		Value v;
 	};
 
-	static const int WIDTH = 60;
-	static const int HEIGHT = 40;
+	// 100 mm cells
+	static const int WIDTH = 30;
+	static const int HEIGHT = 20;
+	static const uint8_t NO_PARENT = 4;
 
 private:
 	InternalNode m_Data[WIDTH][HEIGHT];
 
 public:
 	Graph();
+	// The table and its elements
 	void Init();
+	// Nothing but the table
+	void Clear();
 
 	InternalNode & operator [](const AStarCoord &c);
 	const InternalNode & operator [](const AStarCoord &c) const;
@@ -139,7 +151,7 @@ public:
 
 	void SetParent(AStar::Node& child, const AStar::Node& parent) {
 		child.SetParent(parent);
-		(*this)[child._pos].parent = parent._pos;
+		(*this)[child._pos].parent = (parent._pos.x - child._pos.x + 1) * 3 + (parent._pos.y - child._pos.y + 1);
 	}
 
 	int GetCost(const AStar::Node& node) {
@@ -167,3 +179,4 @@ public:
 };
 
 #endif
+#endif
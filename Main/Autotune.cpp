@@ -0,0 +1,192 @@
+#include "Autotune.h"
+#include "ControlSystem.h"
+#include "MotorManager.h"
+
+HAL_THREAD_LOCAL Autotune Autotune::Instance;
+
+bool Autotune::Start(Loop _loop, Rule _rule, float _amplitude)
+{
+	if (m_Running)
+		return false;
+
+	m_Loop = _loop;
+	m_Rule = _rule;
+	for (Relay &r : m_Relays)
+		r = Relay();
+
+	switch (_loop)
+	{
+	case Loop::WHEELS:
+		// the wheels oscillate around a null speed, without the position loop
+		ControlSystem::Instance.m_Enable = false;
+		MotorManager::Instance.SetSpeed(MotorManager::LEFT, 0);
+		MotorManager::Instance.SetSpeed(MotorManager::RIGHT, 0);
+		StartRelay(LEFT_WHEEL, _amplitude > 0.f ? _amplitude : AUTOTUNE_WHEEL_AMPLITUDE, AUTOTUNE_WHEEL_HYSTERESIS, MOTOR_CONTROL_PERIOD_S);
+		StartRelay(RIGHT_WHEEL, _amplitude > 0.f ? _amplitude : AUTOTUNE_WHEEL_AMPLITUDE, AUTOTUNE_WHEEL_HYSTERESIS, MOTOR_CONTROL_PERIOD_S);
+		break;
+	case Loop::DISTANCE:
+		ControlSystem::Instance.Reset();
+		StartRelay(DISTANCE, _amplitude > 0.f ? _amplitude : AUTOTUNE_DISTANCE_AMPLITUDE, AUTOTUNE_DISTANCE_HYSTERESIS,
+			ControlSystem::Instance.GetPositionLoopPeriod());
+		break;
+	case Loop::ANGLE:
+		ControlSystem::Instance.Reset();
+		StartRelay(ANGLE, _amplitude > 0.f ? _amplitude : AUTOTUNE_ANGLE_AMPLITUDE, AUTOTUNE_ANGLE_HYSTERESIS,
+			ControlSystem::Instance.GetPositionLoopPeriod());
+		break;
+	}
+
+	m_Running = true;
+	return true;
+}
+
+void Autotune::Stop()
+{
+	if (!m_Running)
+		return;
+	m_Running = false;
+	RestoreControl();
+}
+
+void Autotune::StartRelay(Channel _channel, float _amplitude, float _hysteresis, float _period)
+{
+	Relay &r = m_Relays[_channel];
+	r.active = true;
+	r.amplitude = _amplitude;
+	r.hysteresis = _hysteresis;
+	r.period = _period;
+	r.output = _amplitude; // kick, the loop is at rest
+}
+
+bool Autotune::Evaluate(Channel _channel, float _error, float &_output)
+{
+	Relay &r = m_Relays[_channel];
+	if (!m_Running || !r.active)
+		return false;
+
+	r.samples++;
+	r.min = fminf(r.min, _error);
+	r.max = fmaxf(r.max, _error);
+
+	if (_error > r.hysteresis && r.output <= 0.f)
+	{
+		// rising switch: one full cycle since the previous one
+		r.output = r.amplitude;
+		if (r.cycles > AUTOTUNE_SETTLE_CYCLES)
+		{
+			r.amplitudeSum += 0.5f * (r.max - r.min);
+			r.periodSum += r.samples - r.lastRise;
+			r.measured++;
+		}
+		r.cycles++;
+		r.lastRise = r.samples;
+		r.min = r.max = _error;
+	}
+	else if (_error < -r.hysteresis && r.output >= 0.f)
+	{
+		r.output = -r.amplitude;
+	}
+	_output = r.output;
+
+	// the experiment ends with the slowest relay
+	bool Done = true;
+	for (const Relay &Other : m_Relays)
+	{
+		if (!Other.active)
+			continue;
+		if (Other.samples * Other.period > AUTOTUNE_TIMEOUT_S)
+		{
+			Finish(false);
+			return true;
+		}
+		Done &= (Other.measured >= AUTOTUNE_MEASURE_CYCLES);
+	}
+	if (Done)
+		Finish(true);
+	return true;
+}
+
+// Called from the control loop
+void Autotune::Finish(bool _success)
+{
+	Result Res;
+	Res.success = _success;
+	for (int i = 0; i < CHANNEL_COUNT; i++)
+	{
+		const Relay &r = m_Relays[i];
+		Res.ultimateGain[i] = Res.ultimatePeriod[i] = 0.f;
+		if (!r.active || !r.measured)
+			continue;
+
+		// describing function of a relay with hysteresis
+		float Amplitude = r.amplitudeSum / r.measured;
+		float Oscillation = sqrtf(fmaxf(Amplitude * Amplitude - r.hysteresis * r.hysteresis, 1e-12f));
+		Res.ultimateGain[i] = 4.f * r.amplitude / ((float)M_PI * Oscillation);
+		Res.ultimatePeriod[i] = r.periodSum * r.period / r.measured;
+	}
+	m_ResultMailbox.Publish(Res);
+	m_Running = false;
+}
+
+void Autotune::RestoreControl()
+{
+	ControlSystem::Instance.Reset();
+	ControlSystem::Instance.m_Enable = true;
+}
+
+PIDController& Autotune::GetPID(Channel _channel)
+{
+	switch (_channel)
+	{
+	case LEFT_WHEEL:	return MotorManager::Instance.GetLeftMotorPID();
+	case RIGHT_WHEEL:	return MotorManager::Instance.GetRightMotorPID();
+	case DISTANCE:		return ControlSystem::Instance.GetDistancePID();
+	default:			return ControlSystem::Instance.GetAnglePID();
+	}
+}
+
+void Autotune::Task()
+{
+	Result Res;
+	if (!m_ResultMailbox.Fetch(Res))
+		return;
+
+	RestoreControl();
+	if (!Res.success)
+	{
+		Serial.print("autotune: no stable oscillation, gains unchanged\r\n");
+		return;
+	}
+
+	static const char *Names[CHANNEL_COUNT] = { "left wheel", "right wheel", "distance", "angle" };
+	for (int i = 0; i < CHANNEL_COUNT; i++)
+	{
+		const Relay &r = m_Relays[i];
+		if (!r.active)
+			continue;
+
+		// Kp, integral time Ti and derivative time Td from Ku and Tu
+		float Ku = Res.ultimateGain[i], Tu = Res.ultimatePeriod[i];
+		float Kp, Ti, Td;
+		if (m_Rule == Rule::ZIEGLER_NICHOLS)
+		{
+			Kp = 0.6f * Ku;
+			Ti = 0.5f * Tu;
+			Td = 0.125f * Tu;
+		}
+		else
+		{
+			Kp = Ku / 2.2f;
+			Ti = 2.2f * Tu;
+			Td = Tu / 6.3f;
+		}
+
+		// the integral and derivative gains are per second, like the PID ones
+		PIDController &Pid = GetPID((Channel)i);
+		Pid.SetKP(Kp);
+		Pid.SetKI(Kp / Ti);
+		Pid.SetKD(Kp * Td);
+		Serial.printf("autotune %s: Ku %f, Tu %f s -> PID %f, %f, %f\r\n", Names[i], Ku, Tu,
+			Pid.GetKP(), Pid.GetKI(), Pid.GetKD());
+	}
+}
@@ -0,0 +1,83 @@
+#ifndef AUTOTUNE_H
+#define AUTOTUNE_H
+
+#include "Globals.h"
+#include "Mailbox.h"
+#include "PIDController.h"
+
+#define AUTOTUNE_SETTLE_CYCLES 2	// relay cycles ignored before the measure
+#define AUTOTUNE_MEASURE_CYCLES 4	// relay cycles the ultimate gain and period are averaged over
+#define AUTOTUNE_TIMEOUT_S 10.f
+
+// Default relay amplitudes, in the output unit of each loop, and hysteresis, in its error unit
+#define AUTOTUNE_WHEEL_AMPLITUDE 40.f		// motor command
+#define AUTOTUNE_WHEEL_HYSTERESIS 1.f		// ticks per MOTOR_SPEED_UNIT_S
+#define AUTOTUNE_DISTANCE_AMPLITUDE 2.f		// mm per MOTOR_SPEED_UNIT_S
+#define AUTOTUNE_DISTANCE_HYSTERESIS 0.2f	// mm
+#define AUTOTUNE_ANGLE_AMPLITUDE 0.03f		// rad per MOTOR_SPEED_UNIT_S
+#define AUTOTUNE_ANGLE_HYSTERESIS 0.002f	// rad
+
+// Relay feedback (Astrom-Hagglund) autotune of the control loops.
+// The PID of the tuned loop is replaced by a relay of amplitude h around the
+// current setpoint: the loop oscillates at its ultimate period Tu, with an
+// error amplitude a giving the ultimate gain Ku = 4 h / (pi a). The PID gains
+// are then computed from Ku and Tu and installed.
+// Tune the wheels first, the distance and angle loops run on top of them.
+class Autotune
+{
+public:
+	enum class Loop { WHEELS, DISTANCE, ANGLE };
+	enum class Rule { ZIEGLER_NICHOLS, TYREUS_LUYBEN };
+	// Relays, both wheels are tuned together
+	enum Channel { LEFT_WHEEL, RIGHT_WHEEL, DISTANCE, ANGLE, CHANNEL_COUNT };
+
+	static HAL_THREAD_LOCAL Autotune Instance;
+
+	// _amplitude: relay amplitude, 0 for the default of the loop
+	bool Start(Loop _loop, Rule _rule, float _amplitude = 0.f);
+	void Stop();
+	bool IsRunning() const { return m_Running; }
+
+	// Main loop: install the gains once the experiment has ended
+	void Task();
+
+	// Control loop: return true and set the relay output if the channel is being tuned
+	bool Evaluate(Channel _channel, float _error, float &_output);
+
+private:
+	struct Relay
+	{
+		bool active = false;
+		float amplitude = 0.f;
+		float hysteresis = 0.f;
+		float period = 0.f;			// s, evaluation period of the loop
+		float output = 0.f;
+		uint32_t samples = 0;
+		uint32_t lastRise = 0;
+		int cycles = 0;
+		int measured = 0;
+		float min = 0.f, max = 0.f;	// error extremes in the current cycle
+		float amplitudeSum = 0.f;
+		uint32_t periodSum = 0;		// samples
+	};
+
+	struct Result
+	{
+		bool success;
+		float ultimateGain[CHANNEL_COUNT];
+		float ultimatePeriod[CHANNEL_COUNT];	// s
+	};
+
+	void StartRelay(Channel _channel, float _amplitude, float _hysteresis, float _period);
+	void Finish(bool _success);
+	void RestoreControl();
+	PIDController& GetPID(Channel _channel);
+
+	Relay m_Relays[CHANNEL_COUNT];
+	Loop m_Loop = Loop::WHEELS;
+	Rule m_Rule = Rule::ZIEGLER_NICHOLS;
+	volatile bool m_Running = false;
+	Mailbox<Result> m_ResultMailbox;
+};
+
+#endif
@@ -5,14 +5,19 @@
 #include "Astar.h"
 #include "Strategy.h"
 #include "MotorManager.h"
+#include "Autotune.h"
+#include "Recorder.h"
+#include "Profiler.h"
+#include "Scope.h"
+#include "Telemetry.h"
 
-CommandLineInterface CommandLineInterface::Instance;
+HAL_THREAD_LOCAL CommandLineInterface CommandLineInterface::Instance;
 
 void CommandLineInterface::Init()
 {
 	auto REGISTER_COMMAND = [this](const char* cmd, const char* help, Command::FunctionDecl fct)
 	{
-		static int i = 0;
+		static HAL_THREAD_LOCAL int i = 0;
 		m_Command[i].cmd = cmd;
 		m_Command[i].help = help;
 		m_Command[i].function = fct;
@@ -43,7 +48,22 @@ void CommandLineInterface::Init()
 		Float2 center(atof(_argv[0]), atof(_argv[1]));
 		float angle = atof(_argv[2]);
 		TrajectoryManager::Instance.GotoCircular(center, DEG2RAD(angle));
-		Serial.printf("Goto circular, center: (%f, %f), radius: %f\r\n", center.x, center.y, angle);
+		Serial.printf("Goto circular, center: (%f, %f), angle: %f\r\n", center.x, center.y, angle);
+	});
+
+	REGISTER_COMMAND("bezier", "Goto bezier, arg: x, y, angle at the end, control distances at the start and at the end", [](const char _argv[CLI_MAX_ARG][CLI_ARG_LENGTH], int) {
+		Float2 p(atof(_argv[0]), atof(_argv[1]));
+		float angle = atof(_argv[2]);
+		TrajectoryManager::Instance.GotoBezier(p, DEG2RAD(angle), atof(_argv[3]), atof(_argv[4]));
+		Serial.printf("Goto bezier: %f  %f, angle: %f\r\n", p.x, p.y, angle);
+	});
+
+	REGISTER_COMMAND("clothoid", "Goto clothoid, arg: length (mm), curvatures at the start and at the end (1/m)", [](const char _argv[CLI_MAX_ARG][CLI_ARG_LENGTH], int) {
+		float length = atof(_argv[0]);
+		float start = atof(_argv[1]);
+		float end = atof(_argv[2]);
+		TrajectoryManager::Instance.GotoClothoid(length, start * 0.001f, end * 0.001f);
+		Serial.printf("Goto clothoid: %f mm, curvature: %f to %f\r\n", length, start, end);
 	});
 
 	REGISTER_COMMAND("test", "", [](const char _argv[CLI_MAX_ARG][CLI_ARG_LENGTH], int) {
@@ -90,7 +110,7 @@ void CommandLineInterface::Init()
 		Serial.printf("Distance I: %f\r\n", value);
 	});
 		
-	REGISTER_COMMAND("setPidDistD", "", [](const char _argv[CLI_MAX_ARG][CLI_ARG_LENGTH], int) {
+	REGISTER_COMMAND("setPidDistD", "arg: gain on the error change per second", [](const char _argv[CLI_MAX_ARG][CLI_ARG_LENGTH], int) {
 		float value = atof(_argv[0]);
 		ControlSystem::Instance.GetDistancePID().SetKD(value);
 		Serial.printf("Distance D: %f\r\n", value);
@@ -108,12 +128,26 @@ void CommandLineInterface::Init()
 		Serial.printf("Angle I: %f\r\n", value);
 	});
 		
-	REGISTER_COMMAND("setPidAngleD", "", [](const char _argv[CLI_MAX_ARG][CLI_ARG_LENGTH], int) {
+	REGISTER_COMMAND("setPidAngleD", "arg: gain on the error change per second", [](const char _argv[CLI_MAX_ARG][CLI_ARG_LENGTH], int) {
 		float value = atof(_argv[0]);
 		ControlSystem::Instance.GetAnglePID().SetKD(value);
 		Serial.printf("Angle D: %f\r\n", value);
 	});
 
+	REGISTER_COMMAND("setPidRange", "arg: dist|angle, max output", [](const char _argv[CLI_MAX_ARG][CLI_ARG_LENGTH], int) {
+		float value = atof(_argv[1]);
+		if (!strcmp(_argv[0], "dist"))
+			ControlSystem::Instance.GetDistancePID().SetOutputRange(value);
+		else if (!strcmp(_argv[0], "angle"))
+			ControlSystem::Instance.GetAnglePID().SetOutputRange(value);
+		else
+		{
+			Serial.print("incorrect PID, must be dist or angle\r\n");
+			return;
+		}
+		Serial.printf("%s PID max output: %f\r\n", _argv[0], value);
+	});
+
 	REGISTER_COMMAND("setPidMotorP", "", [](const char _argv[CLI_MAX_ARG][CLI_ARG_LENGTH], int) {
 		float value = atof(_argv[0]);
 		MotorManager::Instance.SetMotorPidP(value);
@@ -126,12 +160,78 @@ void CommandLineInterface::Init()
 		Serial.printf("Motor I: %f\r\n", value);
 	});
 
-	REGISTER_COMMAND("setPidMotorD", "", [](const char _argv[CLI_MAX_ARG][CLI_ARG_LENGTH], int) {
+	REGISTER_COMMAND("setPidMotorD", "arg: gain on the error change per second", [](const char _argv[CLI_MAX_ARG][CLI_ARG_LENGTH], int) {
 		float value = atof(_argv[0]);
 		MotorManager::Instance.SetMotorPidD(value);
 		Serial.printf("Motor D: %f\r\n", value);
 	});
 
+	REGISTER_COMMAND("autotune", "Relay autotune, arg: wheels|dist|angle|stop, [zn|tl], [relay amplitude]", [](const char _argv[CLI_MAX_ARG][CLI_ARG_LENGTH], int) {
+		if (!strcmp(_argv[0], "stop"))
+		{
+			Autotune::Instance.Stop();
+			Serial.print("autotune stopped\r\n");
+			return;
+		}
+
+		Autotune::Loop loop;
+		if (!strcmp(_argv[0], "wheels"))
+			loop = Autotune::Loop::WHEELS;
+		else if (!strcmp(_argv[0], "dist"))
+			loop = Autotune::Loop::DISTANCE;
+		else if (!strcmp(_argv[0], "angle"))
+			loop = Autotune::Loop::ANGLE;
+		else
+		{
+			Serial.print("incorrect loop, must be wheels, dist or angle\r\n");
+			return;
+		}
+		Autotune::Rule rule = !strcmp(_argv[1], "tl") ? Autotune::Rule::TYREUS_LUYBEN : Autotune::Rule::ZIEGLER_NICHOLS;
+		float amplitude = atof(_argv[2]); // 0 when missing: default amplitude
+
+		if (!TrajectoryManager::Instance.IsEnded() || !Autotune::Instance.Start(loop, rule, amplitude))
+		{
+			Serial.print("autotune: the robot must be idle\r\n");
+			return;
+		}
+		Serial.printf("autotune %s started\r\n", _argv[0]);
+	});
+
+	REGISTER_COMMAND("record", "Control stack recorder, arg: start|stop, see getRecord", [](const char _argv[CLI_MAX_ARG][CLI_ARG_LENGTH], int) {
+		if (!strcmp(_argv[0], "stop"))
+		{
+			Recorder::Instance.Stop();
+			Serial.printf("record stopped, %u bytes\r\n", (unsigned)Recorder::Instance.GetSize());
+		}
+		else if (!strcmp(_argv[0], "start"))
+		{
+			if (!TrajectoryManager::Instance.IsEnded())
+			{
+				Serial.print("record: the robot must be idle\r\n");
+				return;
+			}
+			Recorder::Instance.Start();
+			Serial.print("record started\r\n");
+		}
+		else
+			Serial.printf("record: %s, %u bytes\r\n", Recorder::Instance.IsRecording() ? "recording" : "stopped",
+				(unsigned)Recorder::Instance.GetSize());
+	});
+
+	REGISTER_COMMAND("getRecord", "Print the recording in hexadecimal, for Host/Replay.cpp", [](const char _argv[CLI_MAX_ARG][CLI_ARG_LENGTH], int) {
+		Recorder::Instance.Dump();
+	});
+
+	REGISTER_COMMAND("setFeedForward", "arg: kv, ka(s), [l|r] (both wheels by default)", [](const char _argv[CLI_MAX_ARG][CLI_ARG_LENGTH], int) {
+		float kv = atof(_argv[0]);
+		float ka = atof(_argv[1]);
+		if (_argv[2][0] != 'r')
+			ControlSystem::Instance.SetFeedForward(MotorManager::LEFT, kv, ka);
+		if (_argv[2][0] != 'l')
+			ControlSystem::Instance.SetFeedForward(MotorManager::RIGHT, kv, ka);
+		Serial.printf("Feed-forward kv: %f, ka: %f\r\n", kv, ka);
+	});
+
 	REGISTER_COMMAND("setAxleTrack", "", [](const char _argv[CLI_MAX_ARG][CLI_ARG_LENGTH], int) {
 		float value = atof(_argv[0]);
 		PositionManager::Instance.SetAxleTrackMm(value);
@@ -162,6 +262,76 @@ void CommandLineInterface::Init()
 		Serial.printf("angle max acceleration: %f\r\n", value);
 	});
 
+	REGISTER_COMMAND("setJerkDist", "S-curve only", [](const char _argv[CLI_MAX_ARG][CLI_ARG_LENGTH], int) {
+		float value = atof(_argv[0]);
+		ControlSystem::Instance.SetDistanceMaxJerk(value);
+		Serial.printf("distance max jerk: %f\r\n", value);
+	});
+
+	REGISTER_COMMAND("setJerkAngle", "S-curve only", [](const char _argv[CLI_MAX_ARG][CLI_ARG_LENGTH], int) {
+		float value = atof(_argv[0]);
+		ControlSystem::Instance.SetAngleMaxJerk(value);
+		Serial.printf("angle max jerk: %f\r\n", value);
+	});
+
+	REGISTER_COMMAND("setProfile", "arg: dist|angle, quadramp|scurve", [](const char _argv[CLI_MAX_ARG][CLI_ARG_LENGTH], int) {
+		ProfileType type;
+		if (!strcmp(_argv[1], "quadramp"))
+			type = ProfileType::QUADRAMP;
+		else if (!strcmp(_argv[1], "scurve"))
+			type = ProfileType::SCURVE;
+		else
+		{
+			Serial.print("incorrect profile, must be quadramp or scurve\r\n");
+			return;
+		}
+
+		if (!strcmp(_argv[0], "dist"))
+			ControlSystem::Instance.SetDistanceProfile(type);
+		else if (!strcmp(_argv[0], "angle"))
+			ControlSystem::Instance.SetAngleProfile(type);
+		else
+		{
+			Serial.print("incorrect axis, must be dist or angle\r\n");
+			return;
+		}
+		Serial.printf("%s profile: %s\r\n", _argv[0], _argv[1]);
+	});
+
+	REGISTER_COMMAND("setCornerTolerance", "Corner cut of consecutive goto xy (mm), 0 to stop at every waypoint", [](const char _argv[CLI_MAX_ARG][CLI_ARG_LENGTH], int) {
+		float value = atof(_argv[0]);
+		TrajectoryManager::Instance.SetCornerTolerance(value);
+		Serial.printf("corner tolerance: %f\r\n", value);
+	});
+
+	REGISTER_COMMAND("setTracking", "Path following of consecutive goto xy: waypoints or pursuit", [](const char _argv[CLI_MAX_ARG][CLI_ARG_LENGTH], int) {
+		if (!strcmp(_argv[0], "waypoints"))
+			TrajectoryManager::Instance.SetTrackingMode(TrajectoryManager::WAYPOINTS);
+		else if (!strcmp(_argv[0], "pursuit"))
+			TrajectoryManager::Instance.SetTrackingMode(TrajectoryManager::PURE_PURSUIT);
+		else if (_argv[0][0])
+			Serial.printf("unknown tracking mode %s\r\n", _argv[0]);
+		Serial.printf("tracking: %s\r\n", (TrajectoryManager::Instance.GetTrackingMode() == TrajectoryManager::PURE_PURSUIT) ? "pursuit" : "waypoints");
+	});
+
+	REGISTER_COMMAND("setBrakeAcc", "Deceleration of the pauses, arg: distance (mm/s^2), angle (deg/s^2)", [](const char _argv[CLI_MAX_ARG][CLI_ARG_LENGTH], int) {
+		float distance = atof(_argv[0]);
+		float angle = atof(_argv[1]);
+		if (!(distance > 0.f) || !(angle > 0.f))
+		{
+			Serial.print("incorrect deceleration, must be > 0\r\n");
+			return;
+		}
+		TrajectoryManager::Instance.SetBrakeDeceleration(distance, DEG2RAD(angle));
+		Serial.printf("brake deceleration: %f mm/s^2, %f deg/s^2\r\n", distance, angle);
+	});
+
+	REGISTER_COMMAND("setDetourDelay", "Stopped by an obstacle for so long, go around it, arg: ms (0: only wait)", [](const char _argv[CLI_MAX_ARG][CLI_ARG_LENGTH], int) {
+		int ms = atoi(_argv[0]);
+		Strategy::Instance.SetDetourDelay(ms);
+		Serial.printf("detour delay: %d ms\r\n", ms);
+	});
+
 	REGISTER_COMMAND("setServoBaudrate", "", [](const char _argv[CLI_MAX_ARG][CLI_ARG_LENGTH], int) {
 		Platform::ForceServoBaudRate();
 		Serial.print("Force servo baudrate\r\n");
@@ -220,9 +390,20 @@ void CommandLineInterface::Init()
 		Serial.printf("Angle PID:    %f, %f, %f\r\n", ControlSystem::Instance.GetAnglePID().GetKP(),
 			ControlSystem::Instance.GetAnglePID().GetKI(),
 			ControlSystem::Instance.GetAnglePID().GetKD());
+		Serial.printf("Max output: distance %f, angle %f\r\n", ControlSystem::Instance.GetDistancePID().GetOutputRange(),
+			ControlSystem::Instance.GetAnglePID().GetOutputRange());
 		Serial.printf("Motors PID:    %f, %f, %f\r\n", MotorManager::Instance.GetLeftMotorPID().GetKP(),
 			MotorManager::Instance.GetLeftMotorPID().GetKI(),
 			MotorManager::Instance.GetLeftMotorPID().GetKD());
+		Serial.printf("Feed-forward: left %f, %f  right %f, %f\r\n",
+			ControlSystem::Instance.GetFeedForwardKV(MotorManager::LEFT), ControlSystem::Instance.GetFeedForwardKA(MotorManager::LEFT),
+			ControlSystem::Instance.GetFeedForwardKV(MotorManager::RIGHT), ControlSystem::Instance.GetFeedForwardKA(MotorManager::RIGHT));
+	});
+
+	REGISTER_COMMAND("getProfile", "Control loop timings, arg: [reset]", [](const char _argv[CLI_MAX_ARG][CLI_ARG_LENGTH], int) {
+		Profiler::Instance.Print();
+		if (!strcmp(_argv[0], "reset"))
+			Profiler::Instance.Reset();
 	});
 
 	REGISTER_COMMAND("getQuadramp", "", [](const char _argv[CLI_MAX_ARG][CLI_ARG_LENGTH], int) {
@@ -230,6 +411,12 @@ void CommandLineInterface::Init()
 			ControlSystem::Instance.GetDistanceQuadramp().Get2ndOrderPos());
 		Serial.printf("Angle :    speed=%f, acc=%f\r\n", RAD2DEG(ControlSystem::Instance.GetAngleQuadramp().Get1stOrderPos()),
 			RAD2DEG(ControlSystem::Instance.GetAngleQuadramp().Get2ndOrderPos()));
+		Serial.printf("Distance : %s, jerk=%f\r\n",
+			(ControlSystem::Instance.GetDistanceProfile().GetType() == ProfileType::SCURVE) ? "scurve" : "quadramp",
+			ControlSystem::Instance.GetDistanceProfile().GetSCurve().Get3rdOrder());
+		Serial.printf("Angle :    %s, jerk=%f\r\n",
+			(ControlSystem::Instance.GetAngleProfile().GetType() == ProfileType::SCURVE) ? "scurve" : "quadramp",
+			RAD2DEG(ControlSystem::Instance.GetAngleProfile().GetSCurve().Get3rdOrder()));
 	});
 
 	#ifdef ENABLE_ASTAR
@@ -246,8 +433,44 @@ void CommandLineInterface::Init()
 		Strategy::Instance.Print();
 	});
 
-	REGISTER_COMMAND("getControlSystem", "Debug asserv, arg: interval(int) between each draw, -1 to disable", [](const char _argv[CLI_MAX_ARG][CLI_ARG_LENGTH], int) {
-		ControlSystem::Instance.m_DebugInterval = atoi(_argv[0]);
+	REGISTER_COMMAND("getControlSystem", "Debug asserv, arg: interval(int) between each draw, 0 every position loop, -1 to disable", [](const char _argv[CLI_MAX_ARG][CLI_ARG_LENGTH], int) {
+		// shortcut of the scope, with the distance/angle loop variables
+		static const char *Names[] = { "dist.target", "dist.measure", "dist.error", "dist.cmd", "angle.target", "angle.measure",
+			"angle.error", "angle.cmd", "x", "y", "left.speed", "right.speed", "left.cmd", "right.cmd" };
+		int Interval = atoi(_argv[0]);
+		Scope::Instance.Clear();
+		if (Interval < 0)
+			return;
+		Scope::Instance.SetDecimation(max(Interval, 1) * ControlSystem::Instance.GetPositionLoopDivider());
+		for (const char *Name : Names)
+			Scope::Instance.Subscribe(Name);
+	});
+
+	REGISTER_COMMAND("scope", "Stream variables, arg: list | clear | add name... | del name... | rate ticks (name* for a prefix)", [](const char _argv[CLI_MAX_ARG][CLI_ARG_LENGTH], int) {
+		bool Add = !strcmp(_argv[0], "add");
+		if (Add || !strcmp(_argv[0], "del"))
+		{
+			for (int i = 1; i < CLI_MAX_ARG && _argv[i][0]; i++)
+			{
+				if (!Scope::Instance.Subscribe(_argv[i], Add))
+					Serial.printf("scope: unknown variable %s\r\n", _argv[i]);
+			}
+		}
+		else if (!strcmp(_argv[0], "clear"))
+			Scope::Instance.Clear();
+		else if (!strcmp(_argv[0], "rate"))
+			Scope::Instance.SetDecimation(atoi(_argv[1]));
+		Scope::Instance.Print(!strcmp(_argv[0], "list"));
+	});
+
+	REGISTER_COMMAND("telemetry", "Format of the scope stream, arg: text|binary (COBS frames, see Telemetry.h)", [](const char _argv[CLI_MAX_ARG][CLI_ARG_LENGTH], int) {
+		if (!strcmp(_argv[0], "binary"))
+			Telemetry::Instance.SetBinary(true);
+		else if (!strcmp(_argv[0], "text"))
+			Telemetry::Instance.SetBinary(false);
+		else
+			Serial.printf("telemetry: %s, %lu records dropped\r\n", Telemetry::Instance.IsBinary() ? "binary" : "text",
+				(unsigned long)Telemetry::Instance.GetDropped());
 	});
 
 	REGISTER_COMMAND("getGP2", "", [](const char _argv[CLI_MAX_ARG][CLI_ARG_LENGTH], int) {
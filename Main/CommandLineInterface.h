@@ -33,7 +33,7 @@ private:
 class CommandLineInterface
 {
 public:
-	static CommandLineInterface Instance;
+	static HAL_THREAD_LOCAL CommandLineInterface Instance;
 	void Init();
 	void Task();
 	void PrintHelp();
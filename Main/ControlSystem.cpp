@@ -7,65 +7,131 @@
  *          Implementation file.
  */
 
-#include "Scheduler.h"
 #include "PIDController.h"
 #include "MotorManager.h"
 #include "ControlSystem.h"
 #include "PositionManager.h"
+#include "Autotune.h"
+#include "Recorder.h"
+#include "Scheduler.h"
+#include "Profiler.h"
+#include "Telemetry.h"
+#include "Scope.h"
 
 
-ControlSystem ControlSystem::Instance;
+HAL_THREAD_LOCAL ControlSystem ControlSystem::Instance;
 
 
-void ControlSystem::Start()
+void ControlSystem::Start(unsigned _positionLoopDivider)
 {
-	m_DistancePID.Init(0.075f, 0.037f, 0.037f);
-	m_AnglePID.Init(0.1f, 0.05f, 0.025f);
+	m_PositionLoopDivider = (_positionLoopDivider > 0) ? _positionLoopDivider : 1;
+	m_TickCounter = 0;
+	float PositionLoopPeriod = GetPositionLoopPeriod();
+
+	m_DistancePID.Init(0.075f, 0.037f, 0.00037f);
+	m_AnglePID.Init(0.1f, 0.05f, 0.00025f);
 
 	m_DistancePID.SetOutputRange(10.f);
 	m_AnglePID.SetOutputRange(0.25f);
 
-	// Quadramp setup
-	m_DistanceQuadramp.Init();
-	m_AngleQuadramp.Init();
-
-	// Setting QuadrampFilter eval period to the control system period
-	m_DistanceQuadramp.SetEvalPeriod(CONTROL_SYSTEM_PERIOD_S);
-	m_AngleQuadramp.SetEvalPeriod(CONTROL_SYSTEM_PERIOD_S);
+	m_DistancePID.SetEvalPeriod(PositionLoopPeriod);
+	m_AnglePID.SetEvalPeriod(PositionLoopPeriod);
+
+	SetFeedForward(MotorManager::LEFT, FEED_FORWARD_DEFAULT_KV, FEED_FORWARD_DEFAULT_KA);
+	SetFeedForward(MotorManager::RIGHT, FEED_FORWARD_DEFAULT_KV, FEED_FORWARD_DEFAULT_KA);
+
+	// Motion profiles setup, evaluated at the position loop period
+	m_DistanceProfile.Init(PositionLoopPeriod);
+	m_AngleProfile.Init(PositionLoopPeriod);
+
+	m_PendingSetpoint.distance = 0.f;
+	m_PendingSetpoint.angle = 0.f;
+	m_PendingSetpoint.angleQuadramp = true;
+	m_PendingSetpoint.distanceProfile = ProfileType::QUADRAMP;
+	m_PendingSetpoint.angleProfile = ProfileType::QUADRAMP;
+	m_PendingSetpoint.distanceResetId = 0;
+	m_PendingSetpoint.angleResetId = 0;
+	m_PendingSetpoint.velocityMode = false;
+	m_PendingSetpoint.distanceVelocity = 0.f;
+	m_PendingSetpoint.angleVelocity = 0.f;
+	m_PendingSetpoint.brakeId = 0;
+	m_PendingSetpoint.distanceBrake = false;
+	m_PendingSetpoint.angleBrake = false;
+	m_PendingSetpoint.distanceBrakeAcc = DISTANCE_MAX_ACC;
+	m_PendingSetpoint.angleBrakeAcc = DEG2RAD(ANGLE_MAX_ACC_DEG);
+	m_PendingSetpoint.distanceSpeedScale = 1.f;
+	m_Setpoint = m_PendingSetpoint;
 
 	SetSpeedHigh();// init quandramp
-
-	m_DistanceTarget = 0.f;
-	m_AngleTarget = 0.f;
 }
 
+// Called every MOTOR_CONTROL_PERIOD_S by the scheduler
 void ControlSystem::Task()
 {
-	PositionManager::Instance.Update();
+	PROFILE_SCOPE(TICK);
+
+	PositionManager::Instance.LatchEncoders();
+
+	// outer loop: odometry, quadramps and distance/angle PIDs
+	if (++m_TickCounter >= m_PositionLoopDivider)
+	{
+		m_TickCounter = 0;
+		PositionTask();
+	}
+
+	// inner loop: wheel velocity, every tick
+	{
+		PROFILE_SCOPE(MOTOR);
+		MotorManager::Instance.Task();
+	}
+
+	Scope::Instance.Sample();
+	Recorder::Instance.RecordTick();
+}
+
+void ControlSystem::PositionTask()
+{
+	{
+		PROFILE_SCOPE(ODOMETRY);
+		PositionManager::Instance.Update();
+	}
+
+	float DistanceTarget = 0.f, AngleTarget = 0.f;
+	{
+		PROFILE_SCOPE(PROFILE);
+		FetchSetpoint();
+		if (m_Enable && m_Setpoint.velocityMode)
+		{
+			DistanceTarget = m_DistanceProfile.EvaluateVelocity(m_Setpoint.distanceVelocity);
+			AngleTarget = m_AngleProfile.EvaluateVelocity(m_Setpoint.angleVelocity);
+		}
+		else if (m_Enable)
+		{
+			DistanceTarget = m_DistanceProfile.Evaluate(m_Setpoint.distance);
+			AngleTarget = m_AngleProfile.Evaluate(m_Setpoint.angle);
+		}
+	}
 
 	if (m_Enable)
 	{
+		PROFILE_SCOPE(PID);
 		//platform_led_toggle(PLATFORM_LED1);
 		float DistanceCmd, AngleCmd;
 		{
-			float Target = m_DistanceQuadramp.Evaluate(m_DistanceTarget);
-			Debug("Dist target", Target);
-			float Measure = PositionManager::Instance.GetDistanceMm();
-			Debug("Dist measure", Measure);
-			float Error = Target - Measure;
-			Debug("Dist error", Error);
-			DistanceCmd = m_DistancePID.EvaluatePID(Error);
-			Debug("Dist cmd", DistanceCmd);
+			m_DistanceTarget = DistanceTarget;
+			m_DistanceMeasure = PositionManager::Instance.GetDistanceMm();
+			float Error = m_DistanceTarget - m_DistanceMeasure;
+			if (!Autotune::Instance.Evaluate(Autotune::DISTANCE, Error, DistanceCmd))
+				DistanceCmd = m_DistancePID.EvaluatePID(Error);
+			m_DistanceCmd = DistanceCmd;
 		}
 		{
-			float Target = m_AngleQuadramp.Evaluate(m_AngleTarget);
-			Debug("Angle target", Target);
-			float Measure = PositionManager::Instance.GetAngleRad();
-			Debug("Angle measure", Measure);
-			float Error = Target - Measure;
-			Debug("Angle error", Error);
-			AngleCmd = m_AnglePID.EvaluatePID(Error);
-			Debug("Angle cmd", AngleCmd);
+			m_AngleTarget = AngleTarget;
+			m_AngleMeasure = PositionManager::Instance.GetAngleRad();
+			float Error = m_AngleTarget - m_AngleMeasure;
+			if (!Autotune::Instance.Evaluate(Autotune::ANGLE, Error, AngleCmd))
+				AngleCmd = m_AnglePID.EvaluatePID(Error);
+			m_AngleCmd = AngleCmd;
 		}
 #if 0
 		static float DistCmdMax = 0.f, AngleCmdMax = 0.f;
@@ -83,10 +149,60 @@ void ControlSystem::Task()
 
 		SetMotorCmd(DistanceCmd, AngleCmd);
 	}
+}
+
+void ControlSystem::PublishSetpoint()
+{
+	m_SetpointMailbox.Publish(m_PendingSetpoint);
+	Recorder::Instance.RecordSetpoint(m_PendingSetpoint);
+}
+
+void ControlSystem::SetSetpoint(const ControlSetpoint &_setpoint)
+{
+	m_PendingSetpoint = _setpoint;
+	PublishSetpoint();
+}
+
+void ControlSystem::ResetProfiles(float _distance, float _distanceVelocity, float _angle, float _angleVelocity)
+{
+	Scheduler::disable();
+	m_DistanceProfile.Reset(_distance, _distanceVelocity);
+	m_AngleProfile.Reset(_angle, _angleVelocity);
+	Scheduler::enable();
+}
 
-	m_DebugCounter++;
-	if (m_DebugCounter >= m_DebugInterval)
-		m_DebugCounter = 0;
+// Called from the control loop only: pick up the last published setpoint
+void ControlSystem::FetchSetpoint()
+{
+	uint8_t DistanceResetId = m_Setpoint.distanceResetId;
+	uint8_t AngleResetId = m_Setpoint.angleResetId;
+	uint8_t BrakeId = m_Setpoint.brakeId;
+	float HeldDistance = m_Setpoint.distance, HeldAngle = m_Setpoint.angle;
+
+	if (!m_SetpointMailbox.Fetch(m_Setpoint))
+		return;
+
+	// the profiles only slow down while braking
+	float DistanceAcc = m_Setpoint.distanceBrake ? m_Setpoint.distanceBrakeAcc : m_Setpoint.distanceMaxAcc;
+	float AngleAcc = m_Setpoint.angleBrake ? m_Setpoint.angleBrakeAcc : m_Setpoint.angleMaxAcc;
+	m_DistanceProfile.SetType(m_Setpoint.distanceProfile);
+	m_DistanceProfile.SetLimits(m_Setpoint.distanceMaxSpeed * m_Setpoint.distanceSpeedScale, DistanceAcc, m_Setpoint.distanceMaxJerk);
+	m_AngleProfile.SetType(m_Setpoint.angleProfile);
+	m_AngleProfile.SetLimits(m_Setpoint.angleMaxSpeed, AngleAcc, m_Setpoint.angleMaxJerk);
+	m_AngleProfile.SetEnable(m_Setpoint.angleQuadramp || m_Setpoint.angleBrake);
+
+	if (m_Setpoint.distanceResetId != DistanceResetId)
+		m_DistanceProfile.Reset(PositionManager::Instance.GetDistanceMm());
+	if (m_Setpoint.angleResetId != AngleResetId)
+		m_AngleProfile.Reset(PositionManager::Instance.GetAngleRad());
+
+	// the stop is planned once, from the state of the profiles when the brake starts,
+	// the braking axes hold it until their next target
+	bool NewBrake = m_Setpoint.brakeId != BrakeId;
+	if (m_Setpoint.distanceBrake)
+		m_Setpoint.distance = NewBrake ? m_DistanceProfile.GetStopPosition(DistanceAcc) : HeldDistance;
+	if (m_Setpoint.angleBrake)
+		m_Setpoint.angle = NewBrake ? m_AngleProfile.GetStopPosition(AngleAcc) : HeldAngle;
 }
 
 void ControlSystem::SetMotorCmd(float d_mm, float theta)
@@ -95,10 +211,27 @@ void ControlSystem::SetMotorCmd(float d_mm, float theta)
 
 	d_mm = -d_mm;
 
-	int32_t right_motor_ref = PositionManager::Instance.MmToTicks(d_mm + (1.0 * axle_track_mm * theta) / 2);
-	int32_t left_motor_ref = PositionManager::Instance.MmToTicks(d_mm - (1.0 * axle_track_mm * theta) / 2);
+	float right_mm = d_mm + (1.0 * axle_track_mm * theta) / 2;
+	float left_mm = d_mm - (1.0 * axle_track_mm * theta) / 2;
+
+	// Feed-forward of the planned profiles, so the PIDs only correct the residual error
+	{
+		float Speed = -m_DistanceProfile.GetVelocity();
+		float Acc = -m_DistanceProfile.GetAcceleration();
+		float AngleSpeed = 0.5f * axle_track_mm * m_AngleProfile.GetVelocity();
+		float AngleAcc = 0.5f * axle_track_mm * m_AngleProfile.GetAcceleration();
+
+		right_mm += MOTOR_SPEED_UNIT_S * (m_FeedForwardKV[MotorManager::RIGHT] * (Speed + AngleSpeed)
+			+ m_FeedForwardKA[MotorManager::RIGHT] * (Acc + AngleAcc));
+		left_mm += MOTOR_SPEED_UNIT_S * (m_FeedForwardKV[MotorManager::LEFT] * (Speed - AngleSpeed)
+			+ m_FeedForwardKA[MotorManager::LEFT] * (Acc - AngleAcc));
+	}
+
+	int32_t right_motor_ref = PositionManager::Instance.MmToTicks(right_mm);
+	int32_t left_motor_ref = PositionManager::Instance.MmToTicks(left_mm);
 
-	if (abs(right_motor_ref) > 50 || abs(left_motor_ref) > 50)
+	// the autotune relay oscillates in place on purpose
+	if ((abs(right_motor_ref) > 50 || abs(left_motor_ref) > 50) && !Autotune::Instance.IsRunning())
 		m_MotorCounter++;
 	else
 		m_MotorCounter = 0;
@@ -116,7 +249,8 @@ void ControlSystem::SetMotorCmd(float d_mm, float theta)
 	if (m_MotorCounter > 200)
 	{
 		MotorManager::Instance.Enabled = false;
-		Serial.print("Alert: the robot want to move and he can't, shutdown motors\r\n");
+		MotorManager::Instance.Stalled = true;
+		Telemetry::Instance.WriteEvent(TelemetryEvent::MOTORS_BLOCKED);
 		m_MotorCounter = 0;
 	}
 
@@ -125,63 +259,138 @@ void ControlSystem::SetMotorCmd(float d_mm, float theta)
 	MotorManager::Instance.SetSpeed(MotorManager::LEFT, left_motor_ref);
 }
 
-void ControlSystem::Debug(const char * msg, float value)
-{
-	if (m_DebugInterval >= 0 && m_DebugCounter == 0)
-	{
-		int MsgLen = Serial.print(msg);
-		for (int i = 0; i < 15 - MsgLen; i++)
-			Serial.print(' ');
-		Serial.print(value);
-		Serial.print("\r\n");
-	}
-}
-
 // User functions
+// They are called from the main loop only (single writer), every change is
+// published as a whole setpoint and picked up at the next control tick.
 void ControlSystem::SetDistanceTarget(float ref)
 {
-	Scheduler::disable();
-	m_DistanceTarget = ref;
-	Scheduler::enable();
+	m_PendingSetpoint.distance = ref;
+	m_PendingSetpoint.velocityMode = false;
+	m_PendingSetpoint.distanceBrake = false;
+	PublishSetpoint();
 }
 
 void ControlSystem::SetRadAngleTarget(float ref_rad, bool _useQuadramp)
 {
-	Scheduler::disable();
-	m_AngleTarget = ref_rad;
-	m_AngleQuadramp.SetEnable(_useQuadramp);
-	Scheduler::enable();
+	m_PendingSetpoint.angle = ref_rad;
+	m_PendingSetpoint.angleQuadramp = _useQuadramp;
+	m_PendingSetpoint.velocityMode = false;
+	m_PendingSetpoint.angleBrake = false;
+	PublishSetpoint();
+}
+
+void ControlSystem::SetTargets(float ref_mm, float ref_rad, bool _useAngleQuadramp)
+{
+	m_PendingSetpoint.distance = ref_mm;
+	m_PendingSetpoint.angle = ref_rad;
+	m_PendingSetpoint.angleQuadramp = _useAngleQuadramp;
+	m_PendingSetpoint.velocityMode = false;
+	m_PendingSetpoint.distanceBrake = false;
+	m_PendingSetpoint.angleBrake = false;
+	PublishSetpoint();
+}
+
+void ControlSystem::SetVelocities(float _distanceVelocity, float _angleVelocity)
+{
+	m_PendingSetpoint.distanceVelocity = _distanceVelocity;
+	m_PendingSetpoint.angleVelocity = _angleVelocity;
+	m_PendingSetpoint.velocityMode = true;
+	m_PendingSetpoint.distanceBrake = false;
+	m_PendingSetpoint.angleBrake = false;
+	PublishSetpoint();
+}
+
+// The profiles belong to the control loop: it plans the stop from their
+// state when it picks the setpoint up, see FetchSetpoint()
+void ControlSystem::Brake(float _distanceAcc, float _angleAcc)
+{
+	m_PendingSetpoint.distanceBrakeAcc = _distanceAcc;
+	m_PendingSetpoint.angleBrakeAcc = _angleAcc;
+	m_PendingSetpoint.velocityMode = false;
+	m_PendingSetpoint.brakeId++;
+	m_PendingSetpoint.distanceBrake = true;
+	m_PendingSetpoint.angleBrake = true;
+	PublishSetpoint();
 }
 
 void ControlSystem::SetDistanceMaxSpeed(float max_speed)
 {
-	m_DistanceQuadramp.Set1stOrderVars(max_speed, max_speed);
+	m_PendingSetpoint.distanceMaxSpeed = max_speed;
+	PublishSetpoint();
+}
+
+void ControlSystem::SetDistanceSpeedScale(float _scale)
+{
+	_scale = Math::Clamp(_scale, DISTANCE_MIN_SPEED_SCALE, 1.f);
+	if (_scale == m_PendingSetpoint.distanceSpeedScale)
+		return;
+	m_PendingSetpoint.distanceSpeedScale = _scale;
+	PublishSetpoint();
 }
 
 void ControlSystem::SetDistanceMaxAcc(float max_acc)
 {
-	m_DistanceQuadramp.Set2ndOrderVars(max_acc, max_acc);
+	m_PendingSetpoint.distanceMaxAcc = max_acc;
+	PublishSetpoint();
 }
 
 void ControlSystem::SetAngleMaxSpeed(float max_speed)
 {
-	m_AngleQuadramp.Set1stOrderVars(DEG2RAD(max_speed), DEG2RAD(max_speed));
+	m_PendingSetpoint.angleMaxSpeed = DEG2RAD(max_speed);
+	PublishSetpoint();
 }
 
 void ControlSystem::SetAngleMaxAcc(float max_acc)
 {
-	m_AngleQuadramp.Set2ndOrderVars(DEG2RAD(max_acc), DEG2RAD(max_acc));
+	m_PendingSetpoint.angleMaxAcc = DEG2RAD(max_acc);
+	PublishSetpoint();
+}
+
+void ControlSystem::SetDistanceMaxJerk(float max_jerk)
+{
+	m_PendingSetpoint.distanceMaxJerk = max_jerk;
+	PublishSetpoint();
+}
+
+void ControlSystem::SetAngleMaxJerk(float max_jerk)
+{
+	m_PendingSetpoint.angleMaxJerk = DEG2RAD(max_jerk);
+	PublishSetpoint();
+}
+
+// The new profile starts from the output and speed of the previous one
+void ControlSystem::SetDistanceProfile(ProfileType _type)
+{
+	m_PendingSetpoint.distanceProfile = _type;
+	PublishSetpoint();
+}
+
+void ControlSystem::SetAngleProfile(ProfileType _type)
+{
+	m_PendingSetpoint.angleProfile = _type;
+	PublishSetpoint();
+}
+
+void ControlSystem::SetFeedForward(MotorManager::MotorId _wheel, float _kV, float _kA)
+{
+	m_FeedForwardKV[_wheel] = _kV;
+	m_FeedForwardKA[_wheel] = _kA;
 }
 
 void ControlSystem::SetSpeedAccelerationRatio(float ratio)
 {
 	ratio = Math::Clamp(ratio, 0.f, 1.f);
 
-	SetDistanceMaxSpeed(ratio*DISTANCE_MAX_SPEED); // Translation speed (in mm/s)
-	SetAngleMaxSpeed(ratio*ANGLE_MAX_SPEED_DEG); // Rotation speed (in rad/s)
+	m_PendingSetpoint.distanceMaxSpeed = ratio * DISTANCE_MAX_SPEED; // Translation speed (in mm/s)
+	m_PendingSetpoint.angleMaxSpeed = DEG2RAD(ratio * ANGLE_MAX_SPEED_DEG); // Rotation speed (in rad/s)
+
+	m_PendingSetpoint.distanceMaxAcc = ratio * DISTANCE_MAX_ACC; // Translation acceleration (in mm/s^2)
+	m_PendingSetpoint.angleMaxAcc = DEG2RAD(ratio * ANGLE_MAX_ACC_DEG); // Rotation acceleration (in rad/s^2)
+
+	m_PendingSetpoint.distanceMaxJerk = ratio * DISTANCE_MAX_JERK; // Translation jerk (in mm/s^3)
+	m_PendingSetpoint.angleMaxJerk = DEG2RAD(ratio * ANGLE_MAX_JERK_DEG); // Rotation jerk (in rad/s^3)
 
-	SetDistanceMaxAcc(ratio * DISTANCE_MAX_ACC); // Translation acceleration (in mm/s^2)
-	SetAngleMaxAcc(ratio * ANGLE_MAX_ACC_DEG); // Rotation acceleration (in rad/s^2)
+	PublishSetpoint();
 }
 
 void ControlSystem::SetSpeedHigh()
@@ -199,15 +408,22 @@ void ControlSystem::SetSpeedLow()
 	SetSpeedAccelerationRatio(0.5);
 }
 
+// The quadramps are reset by the control loop itself, on its own measure
 void ControlSystem::Reset()
 {
-	SetDistanceTarget(PositionManager::Instance.GetDistanceMm());
-	SetRadAngleTarget(PositionManager::Instance.GetAngleRad());
-	m_DistanceQuadramp.Reset(PositionManager::Instance.GetDistanceMm());
-	m_AngleQuadramp.Reset(PositionManager::Instance.GetAngleRad());
+	m_PendingSetpoint.distance = PositionManager::Instance.GetDistanceMm();
+	m_PendingSetpoint.angle = PositionManager::Instance.GetAngleRad();
+	m_PendingSetpoint.angleQuadramp = true;
+	m_PendingSetpoint.velocityMode = false;
+	m_PendingSetpoint.distanceBrake = false;
+	m_PendingSetpoint.angleBrake = false;
+	m_PendingSetpoint.distanceResetId++;
+	m_PendingSetpoint.angleResetId++;
+	PublishSetpoint();
 }
 
 void ControlSystem::ResetAngle()
 {
-	m_AngleQuadramp.Reset(PositionManager::Instance.GetAngleRad());
+	m_PendingSetpoint.angleResetId++;
+	PublishSetpoint();
 }
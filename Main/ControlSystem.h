@@ -12,10 +12,14 @@
 
 #include "PIDController.h"
 #include "DiffFilter.h"
-#include "QuadrampFilter.h"
+#include "MotionProfile.h"
+#include "MotorManager.h"
+#include "Mailbox.h"
 #include "Globals.h"
 
-#define CONTROL_SYSTEM_PERIOD_S 0.01 // in s
+#define MOTOR_CONTROL_PERIOD_S 0.001 // in s, period of the scheduler and of the wheel velocity loop
+#define CONTROL_SYSTEM_DEFAULT_DIVIDER 10 // the distance/angle loop runs once every N velocity loops
+#define CONTROL_SYSTEM_PERIOD_S (MOTOR_CONTROL_PERIOD_S * CONTROL_SYSTEM_DEFAULT_DIVIDER) // in s
 
 #define DISTANCE_MAX_SPEED 250 // in mm/s
 #define DISTANCE_MAX_ACC   500 // in mm/s^2
@@ -23,21 +27,80 @@
 #define ANGLE_MAX_SPEED_DEG 180 // in deg/s
 #define ANGLE_MAX_ACC_DEG   250 // in deg/s^2
 
+#define DISTANCE_MIN_SPEED_SCALE 0.1f // a slowed down robot still moves, see SetDistanceSpeedScale
+
+#define DISTANCE_MAX_JERK   2500 // in mm/s^3, only used by the S-curve profile
+#define ANGLE_MAX_JERK_DEG  1250 // in deg/s^3, only used by the S-curve profile
+
+#define FEED_FORWARD_DEFAULT_KV 1.f // 1: the planned wheel speed is fully fed to the velocity loop, tuned on the simulator
+#define FEED_FORWARD_DEFAULT_KA 0.f // in s
+
+// Everything the control loop needs from the outside, published as a whole
+struct ControlSetpoint
+{
+	float distance;			// mm
+	float angle;			// rad
+	bool angleQuadramp;		// false to bypass the angle quadramp
+	float distanceMaxSpeed;	// mm/s
+	float distanceMaxAcc;	// mm/s^2
+	float angleMaxSpeed;	// rad/s
+	float angleMaxAcc;		// rad/s^2
+	float distanceMaxJerk;	// mm/s^3
+	float angleMaxJerk;		// rad/s^3
+	ProfileType distanceProfile;
+	ProfileType angleProfile;
+	uint8_t distanceResetId;// incremented to reset the distance quadramp on the measure
+	uint8_t angleResetId;	// incremented to reset the angle quadramp on the measure
+	bool velocityMode;		// the targets move at the velocities below instead
+	float distanceVelocity;	// mm/s
+	float angleVelocity;	// rad/s
+	uint8_t brakeId;		// incremented to plan a new stop, see ControlSystem::Brake
+	bool distanceBrake;		// the distance holds the planned stop instead of the target
+	bool angleBrake;		// the angle holds the planned stop instead of the target
+	float distanceBrakeAcc;	// mm/s^2
+	float angleBrakeAcc;	// rad/s^2
+	float distanceSpeedScale;// of distanceMaxSpeed, see ControlSystem::SetDistanceSpeedScale
+};
+
 class ControlSystem
 {
 public:
-	static ControlSystem Instance;
+	static HAL_THREAD_LOCAL ControlSystem Instance;
 
-	void Start();
+	void Start(unsigned _positionLoopDivider = CONTROL_SYSTEM_DEFAULT_DIVIDER);
 	void Task();
 
+	float GetPositionLoopPeriod() const { return m_PositionLoopDivider * MOTOR_CONTROL_PERIOD_S; }
+
 	void SetDistanceTarget(float ref_mm);
 	void SetRadAngleTarget(float ref_rad, bool _useQuadramp = true);
+	void SetTargets(float ref_mm, float ref_rad, bool _useAngleQuadramp = true);
+	// Velocity mode, until the next target: the profiles reach the velocities
+	// within their acceleration limits, their outputs are the targets
+	void SetVelocities(float _distanceVelocity, float _angleVelocity);
+	// Shortest stop at the _distanceAcc (mm/s^2) and _angleAcc (rad/s^2)
+	// decelerations, without reversing, then hold there: each target setter
+	// releases the axes it drives, the others keep holding the stop
+	void Brake(float _distanceAcc, float _angleAcc);
 
 	void SetDistanceMaxSpeed(float max_speed);
+	// The distance profile runs at _scale (DISTANCE_MIN_SPEED_SCALE to 1) of the max
+	// speed, on top of the speed settings: the strategy slows down near the obstacles
+	// with it, and stops with Brake()
+	void SetDistanceSpeedScale(float _scale);
 	void SetDistanceMaxAcc(float max_acc);
 	void SetAngleMaxSpeed(float max_speed);
 	void SetAngleMaxAcc(float max_acc);
+	void SetDistanceMaxJerk(float max_jerk);
+	void SetAngleMaxJerk(float max_jerk);
+
+	void SetDistanceProfile(ProfileType _type);
+	void SetAngleProfile(ProfileType _type);
+
+	// Wheel reference += kV * planned speed + kA * planned acceleration
+	void SetFeedForward(MotorManager::MotorId _wheel, float _kV, float _kA);
+	float GetFeedForwardKV(MotorManager::MotorId _wheel) const { return m_FeedForwardKV[_wheel]; }
+	float GetFeedForwardKA(MotorManager::MotorId _wheel) const { return m_FeedForwardKA[_wheel]; }
 
 	void SetSpeedAccelerationRatio(float ratio);
 	void SetSpeedHigh();
@@ -46,32 +109,65 @@ public:
 
 	PIDController& GetDistancePID() { return m_DistancePID; }
 	PIDController& GetAnglePID()	{ return m_AnglePID; }
-	const QuadrampFilter & GetDistanceQuadramp() const	{ return m_DistanceQuadramp; }
-	const QuadrampFilter & GetAngleQuadramp() const		{ return m_AngleQuadramp; }
+	const MotionProfile & GetDistanceProfile() const	{ return m_DistanceProfile; }
+	const MotionProfile & GetAngleProfile() const		{ return m_AngleProfile; }
+	const QuadrampFilter & GetDistanceQuadramp() const	{ return m_DistanceProfile.GetQuadramp(); }
+	const QuadrampFilter & GetAngleQuadramp() const		{ return m_AngleProfile.GetQuadramp(); }
 
 	void Reset();
 	void ResetAngle();
 
+	// Last setpoint given to the control loop, for the recorder
+	const ControlSetpoint& GetSetpoint() const { return m_PendingSetpoint; }
+	void SetSetpoint(const ControlSetpoint &_setpoint);
+	// Setpoint and profile state of the control loop, for the recorder
+	const ControlSetpoint& GetActiveSetpoint() const { return m_Setpoint; }
+	void ResetProfiles(float _distance, float _distanceVelocity, float _angle, float _angleVelocity);
+	// Ticks since the last position loop, for the recorder
+	unsigned GetTickCounter() const { return m_TickCounter; }
+	unsigned GetPositionLoopDivider() const { return m_PositionLoopDivider; }
+	void SetTickCounter(unsigned _counter) { m_TickCounter = _counter; }
+
+	// Last evaluation of the position loop, for the scope
+	float GetDistanceTarget() const		{ return m_DistanceTarget; }
+	float GetDistanceMeasure() const	{ return m_DistanceMeasure; }
+	float GetDistanceCmd() const		{ return m_DistanceCmd; }
+	float GetAngleTarget() const		{ return m_AngleTarget; }
+	float GetAngleMeasure() const		{ return m_AngleMeasure; }
+	float GetAngleCmd() const			{ return m_AngleCmd; }
+
 	bool m_Enable = true;
-	int m_DebugInterval = -1;
 
 private:
+	void PositionTask();
+	void PublishSetpoint();
+	void FetchSetpoint();
 	void SetMotorCmd(float d_mm, float theta);
-	void Debug(const char *msg, float value);
-	
-	float m_DistanceTarget;
-	float m_AngleTarget;
+
+	// written by the user functions, then published to the control loop
+	ControlSetpoint m_PendingSetpoint;
+	Mailbox<ControlSetpoint> m_SetpointMailbox;
+	// the setpoint currently used by the control loop
+	ControlSetpoint m_Setpoint;
 
 	PIDController m_DistancePID;
 	PIDController m_AnglePID;
 
-	QuadrampFilter m_DistanceQuadramp;
-	QuadrampFilter m_AngleQuadramp;
+	MotionProfile m_DistanceProfile;
+	MotionProfile m_AngleProfile;
+
+	float m_FeedForwardKV[2];
+	float m_FeedForwardKA[2];
+
+	unsigned m_PositionLoopDivider = CONTROL_SYSTEM_DEFAULT_DIVIDER;
+	unsigned m_TickCounter = 0;
 
 	uint32_t m_MotorCounter = 0;
 	Float2 m_LastPosition;
 	float m_LastAngle = 0.f;
-	int m_DebugCounter = 0;
+
+	float m_DistanceTarget = 0.f, m_DistanceMeasure = 0.f, m_DistanceCmd = 0.f;
+	float m_AngleTarget = 0.f, m_AngleMeasure = 0.f, m_AngleCmd = 0.f;
 };
 
 
@@ -0,0 +1,196 @@
+#include "CurveWalker.h"
+
+// Tangent vector of an angle
+static Float2 GetDirection(float _angle)
+{
+	return Float2(-sinf(_angle), cosf(_angle));
+}
+
+// Counter-clockwise rotation
+static Float2 Rotate(const Float2 &_v, float _angle)
+{
+	float c = cosf(_angle), s = sinf(_angle);
+	return Float2(_v.x * c - _v.y * s, _v.x * s + _v.y * c);
+}
+
+static float Cross(const Float2 &_a, const Float2 &_b)
+{
+	return _a.x * _b.y - _a.y * _b.x;
+}
+
+void CurveWalker::InitCircle(const Float2 &_start, const Float2 &_center, float _sweep)
+{
+	m_Type = CIRCLE;
+	m_Points[0] = _start;
+	m_Points[1] = _center;
+	m_Sweep = _sweep;
+	m_Length = (_start - _center).Length() * fabsf(_sweep);
+
+	m_S = 0.f;
+	m_Pos = _start;
+	m_Angle = Math::GetVectorAngle(_start - _center) + (_sweep >= 0.f ? 0.5f : -0.5f) * (float)M_PI;
+}
+
+void CurveWalker::InitBezier(const Float2 &_p0, const Float2 &_p1, const Float2 &_p2, const Float2 &_p3)
+{
+	m_Type = BEZIER;
+	m_Points[0] = _p0;
+	m_Points[1] = _p1;
+	m_Points[2] = _p2;
+	m_Points[3] = _p3;
+	m_Length = GetBezierLength();
+
+	m_S = 0.f;
+	SetBezierPoint(0.f);
+}
+
+void CurveWalker::InitClothoid(const Float2 &_start, float _startAngle, float _length, float _startCurvature, float _endCurvature)
+{
+	m_Type = CLOTHOID;
+	m_StartAngle = _startAngle;
+	m_StartCurvature = _startCurvature;
+	m_Length = max(_length, 0.f);
+	m_CurvatureRate = (m_Length > 0.f) ? (_endCurvature - _startCurvature) / m_Length : 0.f;
+
+	m_S = 0.f;
+	m_Pos = _start;
+	m_Angle = _startAngle;
+}
+
+void CurveWalker::Advance(float _ds)
+{
+	while (_ds > 0.f)
+	{
+		float ds = min(_ds, CURVE_STEP_MM);
+		if (m_S < m_Length)
+			ds = min(ds, m_Length - m_S);
+		Step(ds);
+		_ds -= ds;
+	}
+}
+
+void CurveWalker::Step(float _ds)
+{
+	// past the end: straight line
+	if (m_S >= m_Length)
+	{
+		m_Pos += GetDirection(m_Angle) * _ds;
+		m_S += _ds;
+		return;
+	}
+
+	float s = m_S + _ds;
+	switch (m_Type)
+	{
+	case CIRCLE:
+	{
+		float Radius = m_Length / fabsf(m_Sweep);
+		float Turn = (m_Sweep >= 0.f ? s : -s) / Radius;
+		Float2 Radial = Rotate(m_Points[0] - m_Points[1], Turn);
+		m_Pos = m_Points[1] + Radial;
+		m_Angle = Math::GetVectorAngle(Radial) + (m_Sweep >= 0.f ? 0.5f : -0.5f) * (float)M_PI;
+		break;
+	}
+	case BEZIER:
+		if (s >= m_Length)
+			SetBezierPoint(1.f);
+		else
+		{
+			// midpoint step of dt = ds / |B'(t)|
+			float Mid = m_T + 0.5f * _ds / max(GetBezierDerivative(m_T).Length(), 1e-3f);
+			SetBezierPoint(min(m_T + _ds / max(GetBezierDerivative(Mid).Length(), 1e-3f), 1.f));
+		}
+		break;
+	case CLOTHOID:
+	{
+		// midpoint integration of the tangent
+		float Mid = m_S + 0.5f * _ds;
+		m_Pos += GetDirection(m_StartAngle + (m_StartCurvature + 0.5f * m_CurvatureRate * Mid) * Mid) * _ds;
+		m_Angle = m_StartAngle + (m_StartCurvature + 0.5f * m_CurvatureRate * s) * s;
+		break;
+	}
+	}
+	m_S = s;
+}
+
+float CurveWalker::GetCurvature() const
+{
+	if (m_S >= m_Length || m_Length <= 0.f)
+		return 0.f;
+	switch (m_Type)
+	{
+	case CIRCLE:
+		return m_Sweep / m_Length;
+	case BEZIER:
+	{
+		Float2 d1 = GetBezierDerivative(m_T);
+		float Speed = d1.Length();
+		if (Speed < 1e-3f)
+			return 0.f;
+		return Cross(d1, GetBezierSecondDerivative(m_T)) / (Speed * Speed * Speed);
+	}
+	case CLOTHOID:
+		return m_StartCurvature + m_CurvatureRate * m_S;
+	}
+	return 0.f;
+}
+
+void CurveWalker::GetEnd(float _startAngle, Float2 &_pos, float &_angle) const
+{
+	CurveWalker End = *this;
+	End.Advance(m_Length - m_S);
+	_pos = End.m_Pos;
+
+	float Turn;
+	if (m_Type == CIRCLE)
+		Turn = m_Sweep;
+	else if (m_Type == CLOTHOID)
+		Turn = End.m_Angle - m_StartAngle;
+	else
+	{
+		CurveWalker Start = *this;
+		Start.SetBezierPoint(0.f);
+		Turn = Math::WrapAngle(End.m_Angle - Start.m_Angle);
+	}
+	_angle = _startAngle + Turn + Math::WrapAngle(End.m_Angle - _startAngle - Turn);
+}
+
+Float2 CurveWalker::GetBezierDerivative(float _t) const
+{
+	float u = 1.f - _t;
+	return ((m_Points[1] - m_Points[0]) * (u * u) + (m_Points[2] - m_Points[1]) * (2.f * u * _t)
+		+ (m_Points[3] - m_Points[2]) * (_t * _t)) * 3.f;
+}
+
+Float2 CurveWalker::GetBezierSecondDerivative(float _t) const
+{
+	return ((m_Points[2] - m_Points[1] * 2.f + m_Points[0]) * (1.f - _t)
+		+ (m_Points[3] - m_Points[2] * 2.f + m_Points[1]) * _t) * 6.f;
+}
+
+// Gauss-Legendre quadrature of |B'(t)|, 5 points on each half
+float CurveWalker::GetBezierLength() const
+{
+	static const float Abscissa[5] = { 0.f, -0.5384693101f, 0.5384693101f, -0.9061798459f, 0.9061798459f };
+	static const float Weight[5] = { 0.5688888889f, 0.4786286705f, 0.4786286705f, 0.2369268851f, 0.2369268851f };
+	float Length = 0.f;
+	for (int Half = 0; Half < 2; Half++)
+	{
+		for (int i = 0; i < 5; i++)
+			Length += Weight[i] * GetBezierDerivative(0.25f * (1.f + Abscissa[i]) + 0.5f * Half).Length();
+	}
+	return 0.25f * Length;
+}
+
+void CurveWalker::SetBezierPoint(float _t)
+{
+	float u = 1.f - _t;
+	m_T = _t;
+	m_Pos = m_Points[0] * (u * u * u) + m_Points[1] * (3.f * u * u * _t) + m_Points[2] * (3.f * u * _t * _t) + m_Points[3] * (_t * _t * _t);
+
+	// the tangent of a control point on an end is along the second derivative
+	Float2 Tangent = GetBezierDerivative(_t);
+	if (Tangent.Length() < 1e-3f)
+		Tangent = GetBezierSecondDerivative(_t) * ((_t < 0.5f) ? 1.f : -1.f);
+	m_Angle = Math::GetVectorAngle(Tangent);
+}
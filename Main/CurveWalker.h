@@ -0,0 +1,58 @@
+#ifndef CURVE_WALKER_H
+#define CURVE_WALKER_H
+
+#include "Globals.h"
+
+#define CURVE_STEP_MM 10.f	// longest integration step of Advance()
+
+// Point moving along a curved trajectory segment by arc length. The segment
+// starts at the end of the previous one; angles and curvatures follow
+// Math::GetVectorAngle, positive counter-clockwise.
+// Advance() is incremental: following the robot costs a step or two per
+// trajectory task, whatever the length of the curve. Past the end, the point
+// goes on along the tangent at the end.
+class CurveWalker
+{
+public:
+	// Arc of circle around _center, turning by _sweep rad
+	void InitCircle(const Float2 &_start, const Float2 &_center, float _sweep);
+	// Cubic Bezier curve
+	void InitBezier(const Float2 &_p0, const Float2 &_p1, const Float2 &_p2, const Float2 &_p3);
+	// Curvature changing linearly with the arc length, in 1/mm
+	void InitClothoid(const Float2 &_start, float _startAngle, float _length, float _startCurvature, float _endCurvature);
+
+	void Advance(float _ds);
+
+	float GetLength() const { return m_Length; }
+	float GetDistance() const { return m_S; }	// from the start
+	const Float2& GetPos() const { return m_Pos; }
+	float GetAngle() const { return m_Angle; }	// of the tangent
+	float GetCurvature() const;
+
+	// End of the curve; its angle is the closest one to _startAngle plus the turn of the curve
+	void GetEnd(float _startAngle, Float2 &_pos, float &_angle) const;
+
+private:
+	enum Type : uint8_t { CIRCLE, BEZIER, CLOTHOID };
+
+	void Step(float _ds);
+	Float2 GetBezierDerivative(float _t) const;
+	Float2 GetBezierSecondDerivative(float _t) const;
+	float GetBezierLength() const;
+	void SetBezierPoint(float _t);
+
+	Type m_Type;
+	Float2 m_Points[4];		// bezier control points; circle start and center
+	float m_Sweep;			// circle
+	float m_StartAngle;		// clothoid
+	float m_StartCurvature;
+	float m_CurvatureRate;	// clothoid, 1/mm^2
+	float m_Length;
+
+	float m_S;
+	float m_T;				// bezier parameter
+	Float2 m_Pos;
+	float m_Angle;
+};
+
+#endif
@@ -0,0 +1,98 @@
+#ifndef _ENCODING_H_
+#define _ENCODING_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Byte encodings of the recorder and of the binary telemetry, shared with the
+// host tools which decode them.
+namespace Encoding
+{
+	// Zigzag LEB128: small values of either sign take a single byte, 5 at most
+	#define VARINT_MAX_SIZE 5
+
+	inline unsigned EncodeVarint(int32_t _value, uint8_t *_out)
+	{
+		uint32_t v = ((uint32_t)_value << 1) ^ (uint32_t)(_value >> 31);
+		unsigned n = 0;
+		while (v >= 0x80)
+		{
+			_out[n++] = (uint8_t)(v | 0x80);
+			v >>= 7;
+		}
+		_out[n++] = (uint8_t)v;
+		return n;
+	}
+
+	// Return the number of bytes read, 0 if the varint is truncated
+	inline unsigned DecodeVarint(const uint8_t *_in, size_t _size, int32_t &_value)
+	{
+		uint32_t v = 0;
+		for (unsigned n = 0; n < _size && n < VARINT_MAX_SIZE; n++)
+		{
+			v |= (uint32_t)(_in[n] & 0x7F) << (7 * n);
+			if (!(_in[n] & 0x80))
+			{
+				_value = (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+				return n + 1;
+			}
+		}
+		return 0;
+	}
+
+	// Consistent overhead byte stuffing: the output has no 0, which is left to
+	// delimit the frames. _out needs _size + _size / 254 + 1 bytes.
+	inline size_t EncodeCobs(const uint8_t *_in, size_t _size, uint8_t *_out)
+	{
+		size_t Code = 0, n = 1;
+		uint8_t Run = 1;
+		for (size_t i = 0; i < _size; i++)
+		{
+			if (_in[i])
+			{
+				_out[n++] = _in[i];
+				Run++;
+			}
+			if (!_in[i] || Run == 0xFF)
+			{
+				_out[Code] = Run;
+				Code = n++;
+				Run = 1;
+			}
+		}
+		_out[Code] = Run;
+		return n;
+	}
+
+	// Return the decoded size, 0 if the frame is malformed
+	inline size_t DecodeCobs(const uint8_t *_in, size_t _size, uint8_t *_out)
+	{
+		size_t n = 0, i = 0;
+		while (i < _size)
+		{
+			uint8_t Run = _in[i++];
+			if (!Run || i + Run - 1 > _size)
+				return 0;
+			for (uint8_t j = 1; j < Run; j++)
+				_out[n++] = _in[i++];
+			if (Run < 0xFF && i < _size)
+				_out[n++] = 0;
+		}
+		return n;
+	}
+
+	// CRC-8, polynomial 0x07
+	inline uint8_t Crc8(const uint8_t *_data, size_t _size)
+	{
+		uint8_t Crc = 0;
+		for (size_t i = 0; i < _size; i++)
+		{
+			Crc ^= _data[i];
+			for (int b = 0; b < 8; b++)
+				Crc = (Crc & 0x80) ? (uint8_t)((Crc << 1) ^ 0x07) : (uint8_t)(Crc << 1);
+		}
+		return Crc;
+	}
+}
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef _EVENT_QUEUE_H_
+#define _EVENT_QUEUE_H_
+
+#include <stdint.h>
+
+// Last N events of the main loop (N a power of 2), read by several consumers.
+// Each consumer keeps its own cursor and reads every event pushed since its
+// last read: nothing is removed, a new event overwrites the oldest one. A
+// consumer lagging behind by more than N events skips the overwritten ones.
+// Not for the ISR, see SpscRing.
+template <typename T, unsigned N>
+class EventQueue
+{
+	static_assert((N & (N - 1)) == 0, "N must be a power of 2");
+
+public:
+	void Push(const T &_event)
+	{
+		m_Buffer[m_Head & (N - 1)] = _event;
+		m_Head++;
+	}
+
+	// Cursor of a consumer reading the events pushed from now
+	uint32_t GetHead() const { return m_Head; }
+
+	// False if the consumer of _cursor read every event
+	bool Pop(uint32_t &_cursor, T &_event) const
+	{
+		if (m_Head - _cursor > N)
+			_cursor = m_Head - N;
+		if (_cursor == m_Head)
+			return false;
+		_event = m_Buffer[_cursor & (N - 1)];
+		_cursor++;
+		return true;
+	}
+
+private:
+	T m_Buffer[N];
+	uint32_t m_Head = 0;
+};
+
+#endif
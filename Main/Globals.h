@@ -2,11 +2,13 @@
 #define _GLOBALS_H_
 
 #include <WProgram.h>
+#include "Hal.h"
 #include "Float2.h"
 
 #define Assert(c) if (!(c)) {Serial.printf("Assert!: %s, %d \r\n",  __FILE__, __LINE__); }
 #define DEG2RAD(a) ((a) * 0.01745329252f)//PI / 180.0)
 #define RAD2DEG(a) ((a) * 57.2957795130f)
+#define ENABLE_ASTAR // path finder of the detours, see Astar.h
 
 namespace Math
 {
@@ -25,6 +27,13 @@ namespace Math
 		return atan2f(-_v.x, _v.y);
 	}
 
+	// In [-PI, PI[
+	inline float WrapAngle(float a)
+	{
+		a += M_PI;
+		return a - floor(a / M_TWOPI) * M_TWOPI - M_PI;
+	}
+
 	template <typename T>
 	inline T Lerp(const T &_x, const T &_y, const T &_s)
 	{
@@ -0,0 +1,63 @@
+#ifndef HAL_H
+#define HAL_H
+
+// Hardware abstraction layer, resolved at compile/link time (no virtual call).
+//
+// The Arduino API (Serial, pinMode, digitalWrite, analogRead, analogWrite,
+// millis, delay...) and the Scheduler class are the portable part: on the
+// robot they come from the Teensy core and Scheduler.cpp, on Linux from the
+// POSIX backend in Host/ which provides the same functions.
+// Everything that touches the MCU registers directly goes through Hal::.
+//
+// HAL_THREAD_LOCAL marks the firmware state (singletons, static variables):
+// nothing on the robot, thread_local on Linux where each thread can run
+// its own robot, e.g. parallel simulations.
+
+#if defined(__arm__) && defined(TEENSYDUINO)
+
+#include <WProgram.h>
+#include "QuadDecode.h"
+
+#define HAL_THREAD_LOCAL
+
+namespace Hal
+{
+	// Quadrature decoder on FTM1 or FTM2
+	template <int N>
+	using Encoder = QuadDecode<N>;
+
+	// The servos share a single wire on UART1 (TX pin 10)
+	inline void InitServoUart()
+	{
+		UART1_C1 |= UART_C1_LOOPS | UART_C1_RSRC;
+		CORE_PIN10_CONFIG |= PORT_PCR_PE | PORT_PCR_PS; // pullup on output pin
+	}
+
+	// Direction of the servo half duplex line
+	inline void SetServoTx(bool _tx)
+	{
+		uint8_t c = UART1_C3;
+		if (_tx)
+			c |= UART_C3_TXDIR;
+		else
+			c &= ~UART_C3_TXDIR;
+		UART1_C3 = c;
+	}
+
+	// Cycle counter of the Cortex-M4 debug unit (DWT_CYCCNT), wraps every 45 s at 96 MHz
+	#define HAL_CYCLES_PER_US (F_CPU / 1000000)
+	inline void InitCycleCounter()
+	{
+		ARM_DEMCR |= ARM_DEMCR_TRCENA;
+		ARM_DWT_CTRL |= ARM_DWT_CTRL_CYCCNTENA;
+	}
+	inline uint32_t GetCycleCount() { return ARM_DWT_CYCCNT; }
+}
+
+#else
+
+#include "HalHost.h"
+
+#endif
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef _MAILBOX_H_
+#define _MAILBOX_H_
+
+#include <stdint.h>
+
+// Single writer / single reader mailbox (triple buffer).
+// The writer always owns one slot, the reader another, and the third one is
+// exchanged atomically between them, so a value is never seen half-written
+// and neither side ever has to mask interrupts.
+// Typical use: the main loop publishes, the control ISR fetches.
+template <typename T>
+class Mailbox
+{
+public:
+	// Writer side: publish a complete value, replacing any value not yet fetched
+	void Publish(const T &_value)
+	{
+		m_Buffer[m_WriteId] = _value;
+		m_WriteId = __atomic_exchange_n(&m_SpareId, (uint8_t)(m_WriteId | NEW_FLAG), __ATOMIC_ACQ_REL) & ID_MASK;
+	}
+
+	// Reader side: return true and copy the last published value if there is a new one
+	bool Fetch(T &_value)
+	{
+		if (!(__atomic_load_n(&m_SpareId, __ATOMIC_ACQUIRE) & NEW_FLAG))
+			return false;
+		m_ReadId = __atomic_exchange_n(&m_SpareId, m_ReadId, __ATOMIC_ACQ_REL) & ID_MASK;
+		_value = m_Buffer[m_ReadId];
+		return true;
+	}
+
+private:
+	static const uint8_t ID_MASK = 0x3;
+	static const uint8_t NEW_FLAG = 0x4;
+
+	T m_Buffer[3];
+	uint8_t m_WriteId = 0;
+	uint8_t m_SpareId = 1;
+	uint8_t m_ReadId = 2;
+};
+
+#endif
@@ -7,9 +7,15 @@
 #include "Platform.h"
 #include "Strategy.h"
 #include "Scheduler.h"
+#include "Autotune.h"
+#include "Profiler.h"
+#include "Telemetry.h"
+#include "Scope.h"
 
 #define SPEED 125
 
+void asservLoop();
+
 void setup() {
 	// put your setup code here, to run once:
 	delay(500);
@@ -28,28 +34,29 @@ void setup() {
 
 	delay(500);
 	Platform::DisplayNumber(0);
-	Scheduler::setPeriod(10000);//10ms == CONTROL_SYSTEM_PERIOD_S
+	Profiler::Instance.Init(MOTOR_CONTROL_PERIOD_S * 1000000);
+	Scheduler::setPeriod(MOTOR_CONTROL_PERIOD_S * 1000000);//1ms, the position loop runs every CONTROL_SYSTEM_DEFAULT_DIVIDER ticks
 	Scheduler::setOnOverflow(asservLoop);
 	Scheduler::enable();
 }
 
 void asservLoop()
 {
-	static int time = 0;
-	Platform::SetLed(1, ((++time) & 0x10) != 0);
+	static HAL_THREAD_LOCAL int time = 0;
+	Platform::SetLed(1, ((++time) & 0x100) != 0);
 
 	ControlSystem::Instance.Task();
 }
 
 void loop() {
 	// put your main code here, to run repeatedly:
-	static int time = 0;
-	static int clock = 0;
+	static HAL_THREAD_LOCAL int time = 0;
+	static HAL_THREAD_LOCAL int clock = 0;
 	
 	// Debug
 	if (clock >= 500)
 	{
-		static int led = 0;
+		static HAL_THREAD_LOCAL int led = 0;
 		clock = 0;
 		if (TrajectoryManager::Instance.IsPaused())
 			Platform::SetServoLED(ServoID::ALL, ServoLED::RED);
@@ -77,6 +84,11 @@ void loop() {
 
 	CommandLineInterface::Instance.Task();
 
+	Scope::Instance.Task();
+	Telemetry::Instance.Task();
+
+	Autotune::Instance.Task();
+
 	Strategy::Instance.Task();
 
 	TrajectoryManager::Instance.Task();
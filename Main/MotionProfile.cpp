@@ -0,0 +1,120 @@
+#include "MotionProfile.h"
+#include "Globals.h"
+
+#define PROFILE_MIN_BRAKE_ACC 1.f	// per s^2, a null deceleration never stops
+#define PROFILE_NO_JERK_LIMIT 1e15f	// a null jerk is no limit, as in the S-curve filter
+
+void MotionProfile::Init(float _evalPeriod)
+{
+	m_Type = ProfileType::QUADRAMP;
+	m_EvalPeriod = _evalPeriod;
+	m_VelocityMode = false;
+
+	m_Quadramp.Init();
+	m_SCurve.Init();
+	m_Quadramp.SetEvalPeriod(_evalPeriod);
+	m_SCurve.SetEvalPeriod(_evalPeriod);
+}
+
+void MotionProfile::SetType(ProfileType _type)
+{
+	if (_type == m_Type)
+		return;
+
+	// in velocity tracking, the next Evaluate() resets both filters
+	if (!m_VelocityMode)
+	{
+		if (_type == ProfileType::SCURVE)
+			m_SCurve.Reset(m_Quadramp.GetOutput(), m_Quadramp.GetVelocity());
+		else
+			m_Quadramp.Reset(m_SCurve.GetOutput(), m_SCurve.GetVelocity());
+	}
+	m_Type = _type;
+}
+
+void MotionProfile::SetEnable(bool _e)
+{
+	m_Quadramp.SetEnable(_e);
+	m_SCurve.SetEnable(_e);
+}
+
+void MotionProfile::SetLimits(float _speed, float _acc, float _jerk)
+{
+	m_MaxSpeed = _speed;
+	m_MaxAcc = _acc;
+	m_MaxJerk = _jerk;
+	m_Quadramp.Set1stOrderVars(_speed, _speed);
+	m_Quadramp.Set2ndOrderVars(_acc, _acc);
+	m_SCurve.Set1stOrderVars(_speed, _speed);
+	m_SCurve.Set2ndOrderVars(_acc, _acc);
+	m_SCurve.Set3rdOrderVar(_jerk);
+}
+
+void MotionProfile::Reset(float value, float velocity)
+{
+	m_VelocityMode = false;
+	m_Quadramp.Reset(value, velocity);
+	m_SCurve.Reset(value, velocity);
+}
+
+float MotionProfile::Evaluate(float in)
+{
+	if (m_VelocityMode)
+		Reset(m_Out, m_Vel);
+
+	if (m_Type == ProfileType::SCURVE)
+		return m_SCurve.Evaluate(in);
+	return m_Quadramp.Evaluate(in);
+}
+
+float MotionProfile::EvaluateVelocity(float velocity)
+{
+	if (!m_VelocityMode)
+	{
+		m_Out = GetOutput();
+		m_Vel = GetVelocity();
+		m_VelocityMode = true;
+	}
+
+	velocity = Math::Clamp(velocity, -m_MaxSpeed, m_MaxSpeed);
+	float MaxDelta = m_MaxAcc * m_EvalPeriod;
+	float Delta = Math::Clamp(velocity - m_Vel, -MaxDelta, MaxDelta);
+	m_Acc = Delta / m_EvalPeriod;
+	m_Out += (m_Vel + 0.5f * Delta) * m_EvalPeriod;
+	m_Vel += Delta;
+	return m_Out;
+}
+
+float MotionProfile::GetOutput() const
+{
+	if (m_VelocityMode)
+		return m_Out;
+	return (m_Type == ProfileType::SCURVE) ? m_SCurve.GetOutput() : m_Quadramp.GetOutput();
+}
+
+float MotionProfile::GetVelocity() const
+{
+	if (m_VelocityMode)
+		return m_Vel;
+	return (m_Type == ProfileType::SCURVE) ? m_SCurve.GetVelocity() : m_Quadramp.GetVelocity();
+}
+
+float MotionProfile::GetAcceleration() const
+{
+	if (m_VelocityMode)
+		return m_Acc;
+	return (m_Type == ProfileType::SCURVE) ? m_SCurve.GetAcceleration() : m_Quadramp.GetAcceleration();
+}
+
+// The velocity tracking continues from no acceleration, see Evaluate()
+float MotionProfile::GetStopPosition(float _dec) const
+{
+	float Vel = GetVelocity();
+	_dec = max(_dec, PROFILE_MIN_BRAKE_ACC);
+	if (m_Type == ProfileType::SCURVE)
+	{
+		float Jerk = (m_MaxJerk > 0.f) ? m_MaxJerk : PROFILE_NO_JERK_LIMIT;
+		return m_SCurve.StopPosition(GetOutput(), Vel, m_VelocityMode ? 0.f : GetAcceleration(), _dec, _dec, Jerk);
+	}
+	return GetOutput() + 0.5f * Vel * fabsf(Vel) / _dec;
+}
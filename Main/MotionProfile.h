@@ -0,0 +1,61 @@
+#ifndef MOTION_PROFILE_H
+#define MOTION_PROFILE_H
+
+#include <stdint.h>
+#include "QuadrampFilter.h"
+#include "SCurveFilter.h"
+
+enum class ProfileType : uint8_t
+{
+	QUADRAMP,	// trapezoidal speed, acceleration steps
+	SCURVE		// jerk limited
+};
+
+// Motion profile of one axis of the control system,
+// generated by a quadramp or by a S-curve filter
+class MotionProfile
+{
+public:
+	void Init(float _evalPeriod);
+
+	// Switching type during a move keeps the current output and velocity
+	void SetType(ProfileType _type);
+	ProfileType GetType() const { return m_Type; }
+
+	void SetEnable(bool _e);
+	void SetLimits(float _speed, float _acc, float _jerk);
+
+	void Reset(float value, float velocity = 0.f);
+	float Evaluate(float in);
+	// Velocity tracking instead of a position target: the velocity reaches
+	// the input within the acceleration limit, the output integrates it.
+	// The next Evaluate() continues from the output and the velocity.
+	float EvaluateVelocity(float velocity);
+
+	float GetOutput() const;
+	float GetVelocity() const;
+	float GetAcceleration() const;
+	// Where the shortest stop from the output and the velocity ends, braking at _dec
+	float GetStopPosition(float _dec) const;
+
+	const QuadrampFilter & GetQuadramp() const	{ return m_Quadramp; }
+	const SCurveFilter & GetSCurve() const		{ return m_SCurve; }
+
+private:
+	ProfileType m_Type;
+	QuadrampFilter m_Quadramp;
+	SCurveFilter m_SCurve;
+
+	float m_EvalPeriod;
+	float m_MaxSpeed = 0.f;
+	float m_MaxAcc = 0.f;
+	float m_MaxJerk = 0.f;
+
+	// Velocity tracking state
+	bool m_VelocityMode = false;
+	float m_Out = 0.f;
+	float m_Vel = 0.f;
+	float m_Acc = 0.f;
+};
+
+#endif
@@ -2,11 +2,12 @@
 #include "Platform.h"
 #include "PositionManager.h"
 #include "ControlSystem.h"
+#include "Autotune.h"
 
 const int motorPWMs[] = { 22, 23 };
 const int motorDirs[] = { 26, 31 };
 
-MotorManager MotorManager::Instance;
+HAL_THREAD_LOCAL MotorManager MotorManager::Instance;
 
 void MotorManager::Init()
 {
@@ -19,19 +20,34 @@ void MotorManager::Init()
 	}
 	m_RightMotorPID.Init(0.f, 0.f, 0.f);
 	m_LeftMotorPID.Init(0.f, 0.f, 0.f);
+	m_RightMotorPID.SetEvalPeriod(MOTOR_CONTROL_PERIOD_S);
+	m_LeftMotorPID.SetEvalPeriod(MOTOR_CONTROL_PERIOD_S);
+	m_RightMotorPID.SetOutputRange(MOTOR_MAX_COMMAND);
+	m_LeftMotorPID.SetOutputRange(MOTOR_MAX_COMMAND);
 	SetMotorPidP(1.f);
-	SetMotorPidD(0.25f);
+	SetMotorPidD(0.0025f);
+}
+
+void MotorManager::Task()
+{
+	int32_t LeftEnc, RightEnc;
+	PositionManager::Instance.ReadEncoders(LeftEnc, RightEnc);
+
+	// Yep it's not logic...
+	updateMotor(RIGHT, LeftEnc);
+	updateMotor(LEFT, RightEnc);
 }
 
 void MotorManager::SetSpeed(MotorId m, int32_t speed)
 {
-	updateMotor(m, speed);
+	m_SpeedRef[m] = speed;
 }
 
 void MotorManager::SendCommand(MotorId m, int32_t cmd)
 {
 	if (!Enabled)
 		cmd = 0;
+	m_Command[m] = cmd;
 
 	if (m == MotorManager::RIGHT)
 		cmd = -cmd;
@@ -47,8 +63,9 @@ void MotorManager::SendCommand(MotorId m, int32_t cmd)
 	digitalWrite(motorDirs[m], (cmd >= 0) ? HIGH : LOW);
 }
 
-void MotorManager::updateMotor(MotorId m, int speed)
+void MotorManager::updateMotor(MotorId m, int32_t curEnc)
 {
+	int32_t speed = m_SpeedRef[m];
 	//static double tt = -45;
 	//if (m == LEFT)
 	//	tt += 0.04;
@@ -57,21 +74,26 @@ void MotorManager::updateMotor(MotorId m, int speed)
 	//else
 	//	speed = 0;
 
-	int32_t curEnc = (m == RIGHT) ? PositionManager::Instance.GetLeftEncoder() : PositionManager::Instance.GetRightEncoder(); // Yep it's not logic...
 	auto & buffer = m_LastEncoder[m];
 	float actualSpeed = 0;
 	if (buffer.GetSize())
 	{
-		actualSpeed = (curEnc - m_LastEncoder[m].Back()) / (float)buffer.GetSize();
+		// ticks per velocity loop period, converted to ticks per MOTOR_SPEED_UNIT_S
+		actualSpeed = (curEnc - buffer.Back()) / (float)buffer.GetSize() * (float)(MOTOR_SPEED_UNIT_S / MOTOR_CONTROL_PERIOD_S);
 	}
 	if (buffer.IsFull())
 		buffer.PopBack();
 	buffer.PushFront(curEnc);
 	
-	float err = (speed - actualSpeed);// *(1.f / CONTROL_SYSTEM_PERIOD_S);
+	float err = (speed - actualSpeed);
 
 	int cmd;
-	if (m == RIGHT)
+	float relay;
+	if (Autotune::Instance.Evaluate((m == RIGHT) ? Autotune::RIGHT_WHEEL : Autotune::LEFT_WHEEL, err, relay))
+	{
+		cmd = (int)relay;
+	}
+	else if (m == RIGHT)
 	{
 		cmd = m_RightMotorPID.EvaluatePID(err);
 	}
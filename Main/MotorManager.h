@@ -5,6 +5,10 @@
 #include "PIDController.h"
 #include "CircularBuffer.h"
 
+#define MOTOR_SPEED_UNIT_S 0.01 // wheel speeds are given in ticks per 10 ms
+#define MOTOR_SPEED_WINDOW 10 // number of velocity loop periods the wheel speed is measured over
+#define MOTOR_MAX_COMMAND 243.f // PWM range left above the deadband compensation
+
 class MotorManager
 {
 public:
@@ -14,12 +18,21 @@ public:
 		RIGHT
 	};
 
-	static MotorManager Instance;
+	static HAL_THREAD_LOCAL MotorManager Instance;
 	void Init();
+	// Wheel velocity loop, called every MOTOR_CONTROL_PERIOD_S by the control system
+	void Task();
+	// Set the wheel speed reference, in ticks per MOTOR_SPEED_UNIT_S
 	void SetSpeed(MotorId m, int32_t cmd);
 	void SendCommand(MotorId m, int32_t cmd);
+	int32_t GetSpeed(MotorId m) const { return m_SpeedRef[m]; }
+	// Last command sent, 0 when disabled
+	int32_t GetCommand(MotorId m) const { return m_Command[m]; }
 
 	bool Enabled = true;
+	// Set with Enabled = false by the control system when the robot can't move,
+	// not when the motors are shut down on purpose
+	bool Stalled = false;
 
 	PIDController& GetRightMotorPID() { return m_RightMotorPID; }
 	PIDController& GetLeftMotorPID() { return m_LeftMotorPID; }
@@ -28,12 +41,14 @@ public:
 	void SetMotorPidD(float k) { m_RightMotorPID.SetKD(k); m_LeftMotorPID.SetKD(k); }
 
 private:
-	void updateMotor(MotorId m, int speed);
+	void updateMotor(MotorId m, int32_t curEnc);
 
 	PIDController m_RightMotorPID;
 	PIDController m_LeftMotorPID;
 
-	CircularBuffer<int32_t, 6> m_LastEncoder[2];
+	volatile int32_t m_SpeedRef[2] = { 0, 0 };
+	int32_t m_Command[2] = { 0, 0 };
+	CircularBuffer<int32_t, MOTOR_SPEED_WINDOW + 1> m_LastEncoder[2];
 };
 
 #endif
@@ -31,7 +31,6 @@
 #include "PIDController.h"
 
 #include "Globals.h"
-#include "ControlSystem.h"
 /**
 * @brief PIDController structure initialisation.
 *
@@ -51,6 +50,7 @@ void PIDController::Init(float Kp, float Ki, float Kd)
 	m_error_diff = 0;
 
 	m_max_output = 1e10f;
+	m_eval_period = 1.f;
 }
 
 /**
@@ -64,6 +64,17 @@ void PIDController::SetOutputRange(float max_output)
 	m_max_output = max_output;
 }
 
+/**
+ * @brief Define the period the controller is evaluated at
+ *
+ * @param period Evaluation period, in s.
+ *
+ */
+void PIDController::SetEvalPeriod(float period)
+{
+	m_eval_period = period;
+}
+
 void PIDController::SetKP(float Kp)
 {
 	m_Kp = Kp;
@@ -95,6 +106,11 @@ float PIDController::GetKD()
 	return m_Kd;
 }
 
+float PIDController::GetOutputRange()
+{
+	return m_max_output;
+}
+
 /**
   * @param error Current computed error value.
   *
@@ -105,8 +121,8 @@ float PIDController::EvaluatePID(float error)
 {
 	m_error_diff = error - m_last_error;
 
-	float output = m_Kp * error + m_Kd * m_error_diff;
-	float tempErrorI = m_Ki * CONTROL_SYSTEM_PERIOD_S *(m_error_sum + error);
+	float output = m_Kp * error + m_Kd * m_error_diff / m_eval_period;
+	float tempErrorI = m_Ki * m_eval_period * (m_error_sum + error);
 	float tempOutput = output + tempErrorI;
 
 	// anti windup
@@ -114,7 +130,7 @@ float PIDController::EvaluatePID(float error)
 	{
 		m_error_sum += error;
 	}
-	output += m_Ki * CONTROL_SYSTEM_PERIOD_S * m_error_sum;
+	output += m_Ki * m_eval_period * m_error_sum;
 
 	m_last_error = error;
 
@@ -157,3 +173,28 @@ float PIDController::GetErrorDiff()
 {
 	return m_error_diff;
 }
+
+/**
+  * @brief Terms of the last output, from the last error, error diff and error sum
+  *
+  */
+float PIDController::GetPTerm()
+{
+	return m_Kp * m_last_error;
+}
+
+float PIDController::GetITerm()
+{
+	return m_Ki * m_eval_period * m_error_sum;
+}
+
+float PIDController::GetDTerm()
+{
+	return m_Kd * m_error_diff / m_eval_period;
+}
+
+void PIDController::SetState(float error_sum, float last_error)
+{
+	m_error_sum = error_sum;
+	m_last_error = last_error;
+}
@@ -45,6 +45,8 @@ class PIDController
 public:
 	void Init(float Kp, float Ki, float Kd);
 	void SetOutputRange(float max_output);
+	/** Period EvaluatePID is called at, in s. Integral and derivative gains are given per second. */
+	void SetEvalPeriod(float period);
 
 	void SetKP(float Kp);
 	void SetKI(float Ki);
@@ -53,10 +55,17 @@ public:
 	float GetKP();
 	float GetKI();
 	float GetKD();
+	float GetOutputRange();
 
 	float GetError();
 	float GetErrorSum();
 	float GetErrorDiff();
+	/** Terms of the last output, before the saturation, for the scope. */
+	float GetPTerm();
+	float GetITerm();
+	float GetDTerm();
+	/** Restore the error sum and last error, for the recorder replay. */
+	void SetState(float error_sum, float last_error);
 
 	float EvaluatePID(float error);
 
@@ -70,6 +79,7 @@ private:
 	float m_error_diff; /*!< Diff with previous errors. */
 
 	float m_max_output; /*!< Maximum saturation output value. */
+	float m_eval_period; /*!< Evaluation period (s). */
 };
 
 #endif
@@ -1,5 +1,6 @@
 #include "Globals.h"
 #include "Platform.h"
+#include "Hal.h"
 #include <SoftwareSerial.h>
 
 namespace Platform
@@ -7,9 +8,9 @@ namespace Platform
 	static_assert(_countof(gp2Pins) == _countof(gp2IsFront), "gp2");
 
 	// Set the SoftwareSerial RX & TX pins
-	SoftwareSerial SerialUart2(9, 10); // (RX, TX)
+	HAL_THREAD_LOCAL SoftwareSerial SerialUart2(9, 10); // (RX, TX)
 
-	XL320 Servo;
+	HAL_THREAD_LOCAL XL320 Servo;
 
 	void Init()
 	{
@@ -31,9 +32,7 @@ namespace Platform
 		Servo.Begin(SerialUart2);
 
 		//configure Serial2 for servo
-		UART1_C1 |= UART_C1_LOOPS | UART_C1_RSRC;
-		CORE_PIN10_CONFIG |= PORT_PCR_PE | PORT_PCR_PS; // pullup on output pin
-		
+		Hal::InitServoUart();
 	}
 
 	void InitServo()
@@ -66,36 +65,48 @@ namespace Platform
 		return digitalRead(buttons[id]) == LOW;
 	}
 
-	bool IsGP2Occluded(bool isFront)
+	// Sharp GP2Y0A21 output against the distance, in counts of analogRead
+	// (10 bits, 3.3 V), from the datasheet
+	struct GP2Point
 	{
-		//static bool lastBlocked = false;
-		//int gp2Sum = 0, occluded = 0;
+		int counts;
+		float mm;
+	};
+	static const GP2Point gp2Curve[] = {
+		{ 961, 60.f }, { 713, 100.f }, { 512, 150.f }, { 403, 200.f }, { 285, 300.f },
+		{ 233, 400.f }, { 186, 500.f }, { 155, 600.f }, { 124, 800.f },
+	};
 
-		for (unsigned i = 0; i < _countof(gp2Pins); ++i)
+	float GetGP2Distance(unsigned _id)
+	{
+		int counts = analogRead(gp2Pins[_id]);
+		if (counts >= gp2Curve[0].counts)
+			return gp2Curve[0].mm;
+		for (unsigned i = 1; i < _countof(gp2Curve); ++i)
 		{
-			if (gp2IsFront[i] != isFront)
-				continue;
-			if (analogRead(gp2Pins[i]) > GP2_BLOCK_AT)
-				return true;
-			/*if (lastBlocked) {
-				if (analogRead(gp2Pins[i]) <= GP2_UNBLOCK_AT)
-					++occluded;
+			if (counts >= gp2Curve[i].counts)
+			{
+				const GP2Point &a = gp2Curve[i - 1], &b = gp2Curve[i];
+				return a.mm + (b.mm - a.mm) * (a.counts - counts) / (float)(a.counts - b.counts);
 			}
-			else {
-				if (analogRead(gp2Pins[i]) >= GP2_BLOCK_AT)
-					++occluded;
-			}*/
 		}
+		return GP2_MAX_DISTANCE_MM;
+	}
 
-		/*if (lastBlocked && occluded < gp2Sum)
-			return true;
-		else if (lastBlocked && occluded == gp2Sum)
-			lastBlocked = false;
-		else if (!lastBlocked && occluded > 0) {
-			lastBlocked = true;
-			return true;
-		}*/
-		return false;
+	float GetObstacleDistance(bool isFront)
+	{
+		float distance = GP2_MAX_DISTANCE_MM;
+		for (unsigned i = 0; i < _countof(gp2Pins); ++i)
+		{
+			if (gp2IsFront[i] == isFront)
+				distance = min(distance, GetGP2Distance(i));
+		}
+		return distance;
+	}
+
+	bool IsGP2Occluded(bool isFront)
+	{
+		return GetObstacleDistance(isFront) < GP2_BLOCK_DISTANCE_MM;
 	}
 
 	void DebugGP2()
@@ -104,7 +115,7 @@ namespace Platform
 		{
 			for (unsigned i = 0; i < _countof(gp2Pins); ++i)
 			{
-				Serial.printf("Gp2 %d : %d\r\n", i, analogRead(gp2Pins[i]));
+				Serial.printf("Gp2 %d : %d, %.0f mm\r\n", i, analogRead(gp2Pins[i]), GetGP2Distance(i));
 			}
 			Serial.printf("front occluded %d\r\n", (int)IsGP2Occluded(true));
 			Serial.printf("back occluded %d\r\n\r\n", (int)IsGP2Occluded(false));
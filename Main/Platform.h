@@ -5,8 +5,8 @@
 
 #define _countof(a) (sizeof(a)/sizeof(*(a)))
 
-#define GP2_BLOCK_AT   350 /*288*/
-//#define GP2_UNBLOCK_AT 324 /*216*/
+#define GP2_BLOCK_DISTANCE_MM 250.f // in mm, from the sensor
+#define GP2_MAX_DISTANCE_MM 800.f // range of the GP2, nothing seen further
 
 enum class ServoID
 {
@@ -43,6 +43,10 @@ namespace Platform
 	void SetLed(int ledId, bool state);
 	bool IsStartPulled();
 	bool IsButtonPressed(int id);
+	// Distance to the obstacle seen by the GP2 _id, in mm, GP2_MAX_DISTANCE_MM if none
+	float GetGP2Distance(unsigned _id);
+	// Closest obstacle seen by the front or the back GP2, in mm
+	float GetObstacleDistance(bool isFront);
 	bool IsGP2Occluded(bool isFront);
 	void DebugGP2();
 	void DebugButtons();
@@ -9,8 +9,9 @@
 #include "PositionManager.h"
 #include "ControlSystem.h"
 #include "Scheduler.h"
+#include "Recorder.h"
 
-PositionManager PositionManager::Instance;
+HAL_THREAD_LOCAL PositionManager PositionManager::Instance;
 
 // FTM Interrupt Service routines - on overflow and position compare
 void ftm1_isr(void)
@@ -49,8 +50,8 @@ void PositionManager::Init(uint32_t ticks_per_m, double axle_track_mm) {
 void PositionManager::Update()
 {
 	// Reading encoder value
-	int32_t new_left_enc = -m_Encoder1.calcPosn();
-	int32_t new_right_enc = m_Encoder2.calcPosn();
+	int32_t new_left_enc, new_right_enc;
+	ReadEncoders(new_left_enc, new_right_enc);
 
 	int32_t left_enc_diff = m_LeftEncoder - new_left_enc;
 	int32_t right_enc_diff = m_RightEncoder - new_right_enc;
@@ -131,6 +132,24 @@ int32_t PositionManager::GetRightEncoder(void) {
 	return m_RightEncoder;
 }
 
+void PositionManager::LatchEncoders()
+{
+	m_RawEncoder[0] = m_Encoder1.calcPosn();
+	m_RawEncoder[1] = m_Encoder2.calcPosn();
+}
+
+void PositionManager::ReadEncoders(int32_t &_left, int32_t &_right)
+{
+	_left = -m_RawEncoder[0];
+	_right = m_RawEncoder[1];
+}
+
+void PositionManager::GetRawEncoders(int32_t &_encoder1, int32_t &_encoder2) const
+{
+	_encoder1 = m_RawEncoder[0];
+	_encoder2 = m_RawEncoder[1];
+}
+
 float PositionManager::GetDistanceMm(void) {
 	Scheduler::disable();
 	float r = m_DistanceMm;
@@ -152,6 +171,7 @@ float PositionManager::GetAngleDeg(void) {
 void PositionManager::SetAngleDeg(float a) {
 	m_AngleRad = DEG2RAD(a);
 	m_TheoreticalAngleRad = m_AngleRad;
+	Recorder::Instance.RecordOdometry();
 	ControlSystem::Instance.SetRadAngleTarget(m_AngleRad);
 	ControlSystem::Instance.ResetAngle();
 }
@@ -194,6 +214,7 @@ void PositionManager::SetPosMm(const Float2 &_pos){
 	m_YMm = _pos.y;
 	m_TheoreticalPosMm = _pos;
 	Scheduler::enable();
+	Recorder::Instance.RecordOdometry();
 }
 
 Float2 PositionManager::GetTheoreticalPosMm()
@@ -209,3 +230,21 @@ void PositionManager::SetTheoreticalPosMm(const Float2 & _pos)
 int32_t PositionManager::MmToTicks(float value_mm) {
 	return value_mm * m_TicksPerM / 1000.f;
 }
+
+PositionManager::State PositionManager::GetState()
+{
+	State s = { m_LeftEncoder, m_RightEncoder, m_DistanceMm, m_AngleRad, m_XMm, m_YMm, m_TheoreticalPosMm, m_TheoreticalAngleRad };
+	return s;
+}
+
+void PositionManager::SetState(const State &_state)
+{
+	m_LeftEncoder = _state.leftEncoder;
+	m_RightEncoder = _state.rightEncoder;
+	m_DistanceMm = _state.distanceMm;
+	m_AngleRad = _state.angleRad;
+	m_XMm = _state.xMm;
+	m_YMm = _state.yMm;
+	m_TheoreticalPosMm = _state.theoreticalPosMm;
+	m_TheoreticalAngleRad = _state.theoreticalAngleRad;
+}
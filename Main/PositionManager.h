@@ -9,13 +9,13 @@
 #ifndef POSITION_MANAGER_H
 #define POSITION_MANAGER_H
 
-#include "QuadDecode.h"
+#include "Hal.h"
 #include "Globals.h"
 
 class PositionManager
 {
 public:
-	static PositionManager Instance;
+	static HAL_THREAD_LOCAL PositionManager Instance;
 
 	void Init(uint32_t ticks_per_m, double axle_track_mm);
 	void Update();
@@ -25,6 +25,12 @@ public:
 
 	int32_t GetLeftEncoder(void);
 	int32_t GetRightEncoder(void);
+	// Read the encoder counters, once at the start of every control loop tick
+	void LatchEncoders();
+	// Latched encoders, without updating the odometry (cheap, for the velocity loop)
+	void ReadEncoders(int32_t &_left, int32_t &_right);
+	// Latched counters, as given by the decoders
+	void GetRawEncoders(int32_t &_encoder1, int32_t &_encoder2) const;
 
 	float GetDistanceMm(void);
 	float GetAngleRad(void);
@@ -41,14 +47,26 @@ public:
 
 	int32_t MmToTicks(float value_mm);
 
-	QuadDecode<1> m_Encoder1;  // Template using FTM1
-	QuadDecode<2> m_Encoder2;  // Template using FTM2
+	// Odometry state, saved and restored by the recorder with the control loop masked
+	struct State
+	{
+		int32_t leftEncoder, rightEncoder;
+		double distanceMm, angleRad, xMm, yMm;
+		Float2 theoreticalPosMm;
+		float theoreticalAngleRad;
+	};
+	State GetState();
+	void SetState(const State &_state);
+
+	Hal::Encoder<1> m_Encoder1;  // Template using FTM1
+	Hal::Encoder<2> m_Encoder2;  // Template using FTM2
 
 private:
 	uint32_t m_TicksPerM;
 	double m_AxleTrackMm; // ecart en mm entre les deux encodeurs
 
 	int32_t m_LeftEncoder, m_RightEncoder;
+	int32_t m_RawEncoder[2] = { 0, 0 };
 
 	double m_DistanceMm;
 	double m_AngleRad;
@@ -0,0 +1,81 @@
+#include "Profiler.h"
+#include "Scheduler.h"
+
+HAL_THREAD_LOCAL Profiler Profiler::Instance;
+
+void Profiler::Init(unsigned long _periodUs)
+{
+	Hal::InitCycleCounter();
+	m_BudgetCycles = _periodUs * HAL_CYCLES_PER_US;
+	Reset();
+}
+
+void Profiler::Reset()
+{
+	Scheduler::disable();
+	for (Stats &s : m_Stats)
+	{
+		memset(&s, 0, sizeof(s));
+		s.min = UINT32_MAX;
+	}
+	m_Overruns = 0;
+	m_DroppedTicks = 0;
+	Scheduler::enable();
+}
+
+void Profiler::Add(ProfileStage _stage, uint32_t _cycles)
+{
+	Stats &s = m_Stats[(int)_stage];
+	s.count++;
+	s.sum += _cycles;
+	if (_cycles < s.min)
+		s.min = _cycles;
+	if (_cycles > s.max)
+		s.max = _cycles;
+
+	uint32_t Bucket = (uint32_t)((uint64_t)_cycles * (PROFILER_HISTOGRAM_SIZE - 1) / m_BudgetCycles);
+	if (Bucket >= PROFILER_HISTOGRAM_SIZE - 1)
+	{
+		Bucket = PROFILER_HISTOGRAM_SIZE - 1;
+		if (_stage == ProfileStage::TICK)
+		{
+			m_Overruns++;
+			// the timer interrupt stays pending once, a tick of N periods skips N - 1 of them
+			uint32_t Periods = _cycles / m_BudgetCycles;
+			if (Periods > 1)
+				m_DroppedTicks += Periods - 1;
+		}
+	}
+	s.histogram[Bucket]++;
+}
+
+void Profiler::Print()
+{
+	static const char *Names[(int)ProfileStage::COUNT] = { "tick", "odometry", "profile", "pid", "motor" };
+
+	// copy, the control loop keeps on measuring
+	Scheduler::disable();
+	Stats Copy[(int)ProfileStage::COUNT];
+	memcpy(Copy, m_Stats, sizeof(Copy));
+	uint32_t Overruns = m_Overruns, DroppedTicks = m_DroppedTicks;
+	Scheduler::enable();
+
+	float UsPerCycle = 1.f / HAL_CYCLES_PER_US;
+	Serial.printf("budget %lu us, overruns %lu, dropped ticks %lu\r\n", (unsigned long)(m_BudgetCycles / HAL_CYCLES_PER_US),
+		(unsigned long)Overruns, (unsigned long)DroppedTicks);
+	Serial.print("stage     count    min us   mean us    max us  histogram (tenths of the budget)\r\n");
+	for (int i = 0; i < (int)ProfileStage::COUNT; i++)
+	{
+		const Stats &s = Copy[i];
+		if (!s.count)
+		{
+			Serial.printf("%-8s       0\r\n", Names[i]);
+			continue;
+		}
+		Serial.printf("%-8s %6lu %9.2f %9.2f %9.2f ", Names[i], (unsigned long)s.count,
+			s.min * UsPerCycle, (float)s.sum / s.count * UsPerCycle, s.max * UsPerCycle);
+		for (uint32_t h : s.histogram)
+			Serial.printf(" %lu", (unsigned long)h);
+		Serial.print("\r\n");
+	}
+}
@@ -0,0 +1,68 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "Globals.h"
+
+#define ENABLE_PROFILER 1
+#define PROFILER_HISTOGRAM_SIZE 11	// tenths of the tick period, the last one for the overruns
+
+// Cycle budget of the control loop: every stage of the tick is timed with
+// Hal::GetCycleCount (DWT_CYCCNT on the robot, the wall clock on the host).
+// The stages are measured in the control loop only.
+enum class ProfileStage : uint8_t
+{
+	TICK,		// whole ControlSystem::Task
+	ODOMETRY,	// PositionManager::Update
+	PROFILE,	// setpoint and motion profiles (quadramps)
+	PID,		// distance and angle PIDs, wheel references
+	MOTOR,		// wheel velocity loops and motor commands
+	COUNT
+};
+
+class Profiler
+{
+public:
+	static HAL_THREAD_LOCAL Profiler Instance;
+
+	// _periodUs: period of the control loop, the tick budget
+	void Init(unsigned long _periodUs);
+	void Reset();
+	// Print the statistics of every stage
+	void Print();
+
+	// Control loop
+	void Add(ProfileStage _stage, uint32_t _cycles);
+
+	class Scope
+	{
+	public:
+		Scope(ProfileStage _stage) : m_Stage(_stage), m_Start(Hal::GetCycleCount()) {}
+		~Scope() { Profiler::Instance.Add(m_Stage, Hal::GetCycleCount() - m_Start); }
+	private:
+		ProfileStage m_Stage;
+		uint32_t m_Start;
+	};
+
+private:
+	struct Stats
+	{
+		uint32_t count;
+		uint32_t min, max;
+		uint64_t sum;
+		uint32_t histogram[PROFILER_HISTOGRAM_SIZE];
+	};
+
+	Stats m_Stats[(int)ProfileStage::COUNT];
+	uint32_t m_BudgetCycles = 1;
+	volatile uint32_t m_Overruns = 0;
+	volatile uint32_t m_DroppedTicks = 0;	// skipped because a tick lasted several periods
+};
+
+// Times the rest of the enclosing block
+#if ENABLE_PROFILER
+	#define PROFILE_SCOPE(stage) Profiler::Scope _profileScope(ProfileStage::stage)
+#else
+	#define PROFILE_SCOPE(stage)
+#endif
+
+#endif
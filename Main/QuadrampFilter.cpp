@@ -28,10 +28,12 @@
  */
 #include <string.h>
 #include <math.h>
+#include <float.h>
 
 #include "QuadrampFilter.h"
 
 #define SQUARE(x) ((x) * (x))
+#define QUADRAMP_MAX_REPLAN 4
 
 
 void QuadrampFilter::Init()
@@ -41,10 +43,10 @@ void QuadrampFilter::Init()
 	m_var_1st_ord_pos = 0;
 	m_var_1st_ord_neg = 0;
 
-	m_prev_var = 0;
-	m_prev_out = 0;
 	m_eval_period = 1;
 	m_Enable = true;
+
+	Reset(0);
 }
 
 void QuadrampFilter::SetEvalPeriod(float period)
@@ -54,124 +56,185 @@ void QuadrampFilter::SetEvalPeriod(float period)
 
 void QuadrampFilter::Set2ndOrderVars(float var_2nd_ord_pos, float var_2nd_ord_neg)
 {
+	if (var_2nd_ord_pos == m_var_2nd_ord_pos && var_2nd_ord_neg == m_var_2nd_ord_neg)
+		return;
 	m_var_2nd_ord_pos = var_2nd_ord_pos;
 	m_var_2nd_ord_neg = var_2nd_ord_neg;
+	m_replan = true;
 }
 
 void QuadrampFilter::Set1stOrderVars(float var_1st_ord_pos, float var_1st_ord_neg)
 {
+	if (var_1st_ord_pos == m_var_1st_ord_pos && var_1st_ord_neg == m_var_1st_ord_neg)
+		return;
 	m_var_1st_ord_pos = var_1st_ord_pos;
 	m_var_1st_ord_neg = var_1st_ord_neg;
+	m_replan = true;
 }
 
-void QuadrampFilter::Reset(float value)
+void QuadrampFilter::Reset(float value, float velocity)
 {
-	m_prev_out = value;
-	m_prev_var = 0;
+	m_out = value;
+	m_vel = velocity;
+	m_acc = 0;
+
+	m_in = value;
+	m_time = 0;
+	m_segment_count = 0;
+	m_plan_end = 0;
+	m_reaches_input = true;
+	m_replan = (velocity != 0);
 }
 
-/* TODO: handle float equality */
-//bool QuadrampFilter::ausbee_quadramp_is_finished()
-//{
-//	return (m_prev_out == m_prev_in && m_prev_var == 0);
-//}
-
-float QuadrampFilter::Evaluate(float in)
+void QuadrampFilter::AddSegment(float duration, float vel, float acc)
 {
-	if (!m_Enable)
+	Segment &s = m_segment[m_segment_count];
+	if (m_segment_count == 0)
 	{
-		Reset(in);
-		return in;
+		s.start = 0;
+		s.pos = m_out;
 	}
-
-	float var_1st_ord_pos = m_var_1st_ord_pos * m_eval_period;
-
-	float var_1st_ord_neg = -m_var_1st_ord_neg * m_eval_period;
-
-	float var_2nd_ord_pos = m_var_2nd_ord_pos * SQUARE(m_eval_period);
-
-	float var_2nd_ord_neg = -m_var_2nd_ord_neg * SQUARE(m_eval_period);
-
-	float prev_var = m_prev_var;
-	float prev_out = m_prev_out;
-
-	float d = in - prev_out;
-
-	/* Deceleration ramp */
-	if (d > 0 && var_2nd_ord_neg) {
-		/* var_2nd_ord_neg < 0 */
-		/* real EQ : sqrtf( var_2nd_ord_neg^2/4 - 2.d.var_2nd_ord_neg ) + var_2nd_ord_neg/2 */
-		float ramp_pos = sqrtf((var_2nd_ord_neg*var_2nd_ord_neg) / 4 - 2 * d*var_2nd_ord_neg) + var_2nd_ord_neg / 2;
-
-		if (ramp_pos < var_1st_ord_pos)
-			var_1st_ord_pos = ramp_pos;
+	else
+	{
+		const Segment &prev = m_segment[m_segment_count - 1];
+		s.start = prev.start + prev.duration;
+		s.pos = prev.pos + prev.vel * prev.duration + 0.5f * prev.acc * SQUARE(prev.duration);
 	}
+	s.duration = duration;
+	s.vel = vel;
+	s.acc = acc;
+	m_plan_end = s.start + duration;
+	m_segment_count++;
+}
 
-	else if (d < 0 && var_2nd_ord_pos) {
-
-		/* var_2nd_ord_pos > 0 */
-		/* real EQ : sqrtf( var_2nd_ord_pos^2/4 - 2.d.var_2nd_ord_pos ) - var_2nd_ord_pos/2 */
-		float ramp_neg = -sqrtf((var_2nd_ord_pos*var_2nd_ord_pos) / 4 - 2 * d*var_2nd_ord_pos) - var_2nd_ord_pos / 2;
+/**
+ * Plan the moves from the current output (m_out, m_vel) to the input.
+ * Computation is done in a frame where the input is ahead of the output:
+ * any increase of the speed is limited by acc_up, any decrease by acc_down.
+ *  - moving away from the input: brake, the input is planned again once stopped
+ *  - can't stop before the input: brake to 0, same thing
+ *  - otherwise: reach the peak speed, cruise, and stop on the input.
+ * A null acceleration limit is an infinite one, as in the per tick version.
+ */
+void QuadrampFilter::Plan()
+{
+	float d = m_in - m_out;
+	float dir = (d > 0 || (d == 0 && m_vel >= 0)) ? 1.f : -1.f;
+
+	float acc_up = (dir > 0) ? m_var_2nd_ord_pos : m_var_2nd_ord_neg;
+	float acc_down = (dir > 0) ? m_var_2nd_ord_neg : m_var_2nd_ord_pos;
+	float vel_max = (dir > 0) ? m_var_1st_ord_pos : m_var_1st_ord_neg;
+	float inv_up = acc_up ? 1.f / acc_up : 0.f;
+	float inv_down = acc_down ? 1.f / acc_down : 0.f;
+
+	d *= dir;
+	float v0 = dir * m_vel;
+	float stop_dist = 0.5f * SQUARE(v0) * inv_down;
+
+	m_time = 0;
+	m_segment_count = 0;
+	m_plan_end = 0;
+	m_reaches_input = (d == 0 && v0 == 0);
+	if (m_reaches_input)
+		return;
+
+	if (v0 < 0)
+	{
+		AddSegment(-v0 * inv_up, dir * v0, dir * acc_up);
+		return;
+	}
+	if (stop_dist > d)
+	{
+		AddSegment(v0 * inv_down, dir * v0, -dir * acc_down);
+		return;
+	}
 
-		/* ramp_neg < 0 */
-		if (ramp_neg > var_1st_ord_neg)
-			var_1st_ord_neg = ramp_neg;
+	float vel_peak;
+	if (v0 > vel_max)
+		vel_max = vel_peak = fmaxf(vel_max, 0.f);
+	else
+	{
+		float inv_sum = inv_up + inv_down;
+		vel_peak = inv_sum ? sqrtf((2.f * d + SQUARE(v0) * inv_up) / inv_sum) : vel_max;
+		if (vel_peak > vel_max)
+			vel_peak = vel_max;
 	}
 
-	/* try to set the speed : can we reach the speed with our acceleration ? */
-	/* si on va moins vite que la Vmax */
-	if (prev_var < var_1st_ord_pos) {
-		/* acceleration would be to high, we reduce the speed */
-		/* si rampe acceleration active ET qu'on ne peut pas atteindre Vmax,
-		 * on sature Vmax a Vcourante + acceleration */
-		if (var_2nd_ord_pos && (var_1st_ord_pos - prev_var > var_2nd_ord_pos))
-			var_1st_ord_pos = prev_var + var_2nd_ord_pos;
+	// speed change to the peak speed
+	float change_time, change_dist;
+	if (vel_peak >= v0)
+	{
+		change_time = (vel_peak - v0) * inv_up;
+		change_dist = 0.5f * (SQUARE(vel_peak) - SQUARE(v0)) * inv_up;
+		AddSegment(change_time, dir * v0, dir * acc_up);
 	}
-	/* si on va plus vite que Vmax */
-	else if (prev_var > var_1st_ord_pos) {
-		/* deceleration would be to high, we increase the speed */
-		/* si rampe deceleration active ET qu'on ne peut pas atteindre Vmax,
-		 * on sature Vmax a Vcourante + deceleration */
-		if (var_2nd_ord_neg && (var_1st_ord_pos - prev_var < var_2nd_ord_neg))
-			var_1st_ord_pos = prev_var + var_2nd_ord_neg;
+	else
+	{
+		change_time = (v0 - vel_peak) * inv_down;
+		change_dist = 0.5f * (SQUARE(v0) - SQUARE(vel_peak)) * inv_down;
+		AddSegment(change_time, dir * v0, -dir * acc_down);
 	}
 
-	/* same for the neg */
-	/* si on va plus vite que la Vmin (en negatif : en vrai la vitesse absolue est inferieure) */
-	if (prev_var > var_1st_ord_neg) {
-		/* acceleration would be to high, we reduce the speed */
-		/* si rampe deceleration active ET qu'on ne peut pas atteindre Vmin,
-		 * on sature Vmax a Vcourante + deceleration */
-		if (var_2nd_ord_neg && (var_1st_ord_neg - prev_var < var_2nd_ord_neg))
-			var_1st_ord_neg = prev_var + var_2nd_ord_neg;
+	// cruise, forever if the speed limit is null
+	if (vel_peak <= 0)
+	{
+		AddSegment(FLT_MAX, 0, 0);
+		return;
 	}
-	/* si on va moins vite que Vmin (mais vitesse absolue superieure) */
-	else if (prev_var < var_1st_ord_neg) {
-		/* deceleration would be to high, we increase the speed */
-		/* si rampe acceleration active ET qu'on ne peut pas atteindre Vmin,
-		 * on sature Vmax a Vcourante + deceleration */
-		if (var_2nd_ord_pos && (var_1st_ord_neg - prev_var > var_2nd_ord_pos))
-			var_1st_ord_neg = prev_var + var_2nd_ord_pos;
+	float cruise_dist = fmaxf(d - change_dist - 0.5f * SQUARE(vel_peak) * inv_down, 0.f);
+	AddSegment(cruise_dist / vel_peak, dir * vel_peak, 0);
+
+	// stop on the input
+	AddSegment(vel_peak * inv_down, dir * vel_peak, -dir * acc_down);
+	m_reaches_input = true;
+}
+
+float QuadrampFilter::Evaluate(float in)
+{
+	if (!m_Enable)
+	{
+		Reset(in);
+		return in;
 	}
 
-	// Position consign : can we reach the position with our speed ?
-	float pos_target;
-	if (d > var_1st_ord_pos) {
-		pos_target = prev_out + var_1st_ord_pos;
-		prev_var = var_1st_ord_pos;
+	if (in != m_in || m_replan)
+	{
+		m_in = in;
+		m_replan = false;
+		Plan();
 	}
-	else if (d < var_1st_ord_neg) {
-		pos_target = prev_out + var_1st_ord_neg;
-		prev_var = var_1st_ord_neg;
+
+	m_time += m_eval_period;
+
+	// end of a braking plan: plan again from where it stopped
+	for (int i = 0; i < QUADRAMP_MAX_REPLAN && m_time >= m_plan_end && !m_reaches_input; i++)
+	{
+		float remaining = m_time - m_plan_end;
+		const Segment &s = m_segment[m_segment_count - 1];
+		m_out = s.pos + s.vel * s.duration + 0.5f * s.acc * SQUARE(s.duration);
+		m_vel = 0;
+		m_acc = 0;
+		Plan();
+		m_time = remaining;
 	}
-	else {
-		pos_target = prev_out + d;
-		prev_var = d;
+
+	if (m_time >= m_plan_end && m_reaches_input)
+	{
+		m_out = m_in;
+		m_vel = 0;
+		m_acc = 0;
+		return m_out;
 	}
 
-	// update prev_out and prev_var
-	m_prev_var = prev_var;
-	m_prev_out = pos_target;
+	int i = 0;
+	while (i < m_segment_count - 1 && m_time >= m_segment[i + 1].start)
+		i++;
+
+	const Segment &s = m_segment[i];
+	float t = m_time - s.start;
+	m_out = s.pos + s.vel * t + 0.5f * s.acc * SQUARE(t);
+	m_vel = s.vel + s.acc * t;
+	m_acc = s.acc;
 
-	return pos_target;
+	return m_out;
 }
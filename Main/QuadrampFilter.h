@@ -6,6 +6,8 @@
  * @date    24-May-2014
  * @brief   Quadramp filter implementation file.
  *          This is actually a bang-bang control on second order.
+ *          The moves are planned once per input (or limit) change, then
+ *          each Evaluate() only samples the planned segments.
  *
  * @brief
  * @verbatim
@@ -73,6 +75,8 @@
 #ifndef QUADRAMP_H
 #define QUADRAMP_H
 
+#include <stdint.h>
+
 
 /**
  * @brief Quadramp filter structure
@@ -118,18 +122,49 @@ public:
 	float Get1stOrderPos() const { return m_var_1st_ord_pos; }
 	float Get2ndOrderPos() const { return m_var_2nd_ord_pos; }
 
-	void Reset(float value);
+	/** Planned 1st order variation (velocity) of the last output, in [V]/[T] */
+	float GetVelocity() const { return m_vel; }
+	/** Planned 2nd order variation (acceleration) of the last output, in [V]/([T]^2) */
+	float GetAcceleration() const { return m_acc; }
+
+	float GetOutput() const { return m_out; }
+
+	/** velocity in [V]/[T] */
+	void Reset(float value, float velocity = 0.f);
 
+	/** A new input is planned from the current output and velocity */
 	float Evaluate(float in);
 
 private:
+	/** Constant acceleration part of the plan, times in [T] from the plan start */
+	struct Segment
+	{
+		float start;
+		float duration;
+		float pos;
+		float vel;
+		float acc;
+	};
+
+	void Plan();
+	void AddSegment(float duration, float vel, float acc);
+
 	float m_var_2nd_ord_pos;
 	float m_var_2nd_ord_neg;
 	float m_var_1st_ord_pos;
 	float m_var_1st_ord_neg;
 
-	float m_prev_var; /*!< Previous variation. */
-	float m_prev_out; /*!< Previous ouput value. */
+	float m_out; /*!< Previous ouput value. */
+	float m_vel; /*!< Velocity of the output, in [V]/[T]. */
+	float m_acc; /*!< Acceleration of the output, in [V]/([T]^2). */
+
+	float m_in;						/*!< Input of the current plan. */
+	Segment m_segment[3];			/*!< Speed change, cruise, stop. */
+	uint8_t m_segment_count;
+	float m_time;					/*!< Time since the plan start. */
+	float m_plan_end;
+	bool m_reaches_input;			/*!< False for a braking plan, planned again at its end. */
+	bool m_replan;
 
 	float m_eval_period;
 	bool m_Enable;
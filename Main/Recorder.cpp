@@ -0,0 +1,351 @@
+#include "Recorder.h"
+#include "ControlSystem.h"
+#include "PositionManager.h"
+#include "TrajectoryManager.h"
+#include "MotorManager.h"
+#include "Platform.h"
+#include "Scheduler.h"
+#include "Encoding.h"
+
+HAL_THREAD_LOCAL Recorder Recorder::Instance;
+
+// Main loop, the robot idle: the control loop state is saved in the START
+// record, the replay restores it then runs the following records.
+void Recorder::Start()
+{
+	Scheduler::disable();
+	m_Recording = false;
+	m_IdleTicks = 0;
+	DrainMain();	// drop the records of a previous recording
+	m_Size = 0;
+	m_InTask = false;
+
+	PositionManager::Instance.GetRawEncoders(m_Encoder[0], m_Encoder[1]);
+	for (int i = 0; i < 2; i++)
+	{
+		m_EncoderSpeed[i] = 0;
+		m_Command[i] = MotorManager::Instance.GetCommand((MotorManager::MotorId)i);
+	}
+	for (int i = 0; i < RECORDER_GP2_COUNT; i++)
+		m_GP2[i] = analogRead(Platform::gp2Pins[i]);
+
+	BeginRecord(RecordType::START);
+	m_Record.Put(m_Encoder[0]);
+	m_Record.Put(m_Encoder[1]);
+
+	PutOdometry(m_Record);
+
+	PIDController *Pids[] = { &ControlSystem::Instance.GetDistancePID(), &ControlSystem::Instance.GetAnglePID(),
+		&MotorManager::Instance.GetLeftMotorPID(), &MotorManager::Instance.GetRightMotorPID() };
+	for (PIDController *Pid : Pids)
+	{
+		m_Record.Put(Pid->GetKP());
+		m_Record.Put(Pid->GetKI());
+		m_Record.Put(Pid->GetKD());
+		m_Record.Put(Pid->GetOutputRange());
+		m_Record.Put(Pid->GetErrorSum());
+		m_Record.Put(Pid->GetError());
+	}
+
+	for (int i = 0; i < 2; i++)
+	{
+		m_Record.Put(ControlSystem::Instance.GetFeedForwardKV((MotorManager::MotorId)i));
+		m_Record.Put(ControlSystem::Instance.GetFeedForwardKA((MotorManager::MotorId)i));
+	}
+
+	PutSetpoint(m_Record, ControlSystem::Instance.GetActiveSetpoint());
+	m_Record.Put(ControlSystem::Instance.GetDistanceProfile().GetOutput());
+	m_Record.Put(ControlSystem::Instance.GetDistanceProfile().GetVelocity());
+	m_Record.Put(ControlSystem::Instance.GetAngleProfile().GetOutput());
+	m_Record.Put(ControlSystem::Instance.GetAngleProfile().GetVelocity());
+	PutSetpoint(m_Record, ControlSystem::Instance.GetSetpoint());
+
+	for (int i = 0; i < 2; i++)
+		m_Record.Put(MotorManager::Instance.GetSpeed((MotorManager::MotorId)i));
+	m_Record.Put(m_Command[0]);
+	m_Record.Put(m_Command[1]);
+	m_Record.Put<uint8_t>(ControlSystem::Instance.GetTickCounter());
+
+	PutFlags(m_Record);
+	for (int i = 0; i < RECORDER_GP2_COUNT; i++)
+		m_Record.Put(m_GP2[i]);
+	m_Record.Put(TrajectoryManager::Instance.GetCornerTolerance());
+	m_Record.Put<uint8_t>(TrajectoryManager::Instance.GetTrackingMode());
+
+	m_Recording = true;
+	EndRecord();
+	Scheduler::enable();
+}
+
+void Recorder::Stop()
+{
+	Scheduler::disable();
+	if (m_Recording)
+	{
+		DrainMain();
+		FlushIdle();
+	}
+	m_Recording = false;
+	Scheduler::enable();
+}
+
+void Recorder::Dump()
+{
+	uint32_t Size = m_Size;
+	Serial.printf("record begin %u\r\n", (unsigned)Size);
+	for (uint32_t i = 0; i < Size; i += 32)
+	{
+		for (uint32_t j = i; j < Size && j < i + 32; j++)
+			Serial.printf("%02x", m_Buffer[j]);
+		Serial.print("\r\n");
+	}
+	Serial.print("record end\r\n");
+}
+
+void Recorder::RecordTick()
+{
+	if (!m_Recording)
+		return;
+
+	// the main loop records come before this tick
+	DrainMain();
+
+	int32_t Encoder[2];
+	PositionManager::Instance.GetRawEncoders(Encoder[0], Encoder[1]);
+
+	// the speeds barely change from a tick to the next
+	int32_t Change[4];
+	for (int i = 0; i < 2; i++)
+	{
+		int32_t Speed = Encoder[i] - m_Encoder[i];
+		Change[i] = Speed - m_EncoderSpeed[i];
+		m_Encoder[i] = Encoder[i];
+		m_EncoderSpeed[i] = Speed;
+
+		int32_t Command = MotorManager::Instance.GetCommand((MotorManager::MotorId)i);
+		Change[2 + i] = Command - m_Command[i];
+		m_Command[i] = Command;
+	}
+
+	bool Idle = true, Small = true;
+	for (int32_t c : Change)
+	{
+		Idle &= (c == 0);
+		Small &= (c >= -8 && c <= 7);
+	}
+	if (Idle)
+	{
+		m_IdleTicks++;
+		return;
+	}
+
+	if (Small)
+	{
+		BeginRecord(RecordType::TICK_SMALL);
+		m_Record.Put<uint8_t>((Change[0] & 0xF) | ((Change[1] & 0xF) << 4));
+		m_Record.Put<uint8_t>((Change[2] & 0xF) | ((Change[3] & 0xF) << 4));
+	}
+	else
+	{
+		BeginRecord(RecordType::TICK);
+		for (int32_t c : Change)
+			m_Record.PutVarint(c);
+	}
+	EndRecord();
+}
+
+void Recorder::RecordTaskBegin()
+{
+	m_InTask = true;
+	if (!m_Recording)
+		return;
+
+	BeginMainRecord(RecordType::TASK);
+	PutFlags(m_MainRecord);
+	for (int i = 0; i < RECORDER_GP2_COUNT; i++)
+	{
+		int16_t Value = analogRead(Platform::gp2Pins[i]);
+		m_MainRecord.PutVarint(Value - m_GP2[i]);
+		m_GP2[i] = Value;
+	}
+	EndMainRecord();
+}
+
+void Recorder::RecordPoint(const Float2 &_pos, float _angle, const float *_curve, uint8_t _movement, bool _now)
+{
+	if (!m_Recording)
+		return;
+
+	BeginMainRecord(RecordType::POINT);
+	m_MainRecord.Put(_pos.x);
+	m_MainRecord.Put(_pos.y);
+	m_MainRecord.Put(_angle);
+	for (int i = 0; i < SMOOTH_TRAJ_CURVE_PARAMS; i++)
+		m_MainRecord.Put(_curve[i]);
+	m_MainRecord.Put(_movement);
+	m_MainRecord.Put<uint8_t>(_now);
+	EndMainRecord();
+}
+
+void Recorder::RecordEvent(RecordType _type)
+{
+	if (!m_Recording)
+		return;
+
+	BeginMainRecord(_type);
+	EndMainRecord();
+}
+
+// The setpoints published by the trajectory task are computed again by the replay
+void Recorder::RecordSetpoint(const ControlSetpoint &_setpoint)
+{
+	if (!m_Recording || m_InTask)
+		return;
+
+	BeginMainRecord(RecordType::SETPOINT);
+	PutSetpoint(m_MainRecord, _setpoint);
+	EndMainRecord();
+}
+
+void Recorder::RecordOdometry()
+{
+	if (!m_Recording)
+		return;
+
+	BeginMainRecord(RecordType::ODOMETRY);
+	PutOdometry(m_MainRecord);
+	EndMainRecord();
+}
+
+template <typename Data>
+void Recorder::PutOdometry(Data &_data)
+{
+	PositionManager::State Odometry = PositionManager::Instance.GetState();
+	_data.Put(Odometry.leftEncoder);
+	_data.Put(Odometry.rightEncoder);
+	_data.Put(Odometry.distanceMm);
+	_data.Put(Odometry.angleRad);
+	_data.Put(Odometry.xMm);
+	_data.Put(Odometry.yMm);
+	_data.Put(Odometry.theoreticalPosMm.x);
+	_data.Put(Odometry.theoreticalPosMm.y);
+	_data.Put(Odometry.theoreticalAngleRad);
+}
+
+template <typename Data>
+void Recorder::PutSetpoint(Data &_data, const ControlSetpoint &_setpoint)
+{
+	_data.Put(_setpoint.distance);
+	_data.Put(_setpoint.angle);
+	_data.Put((uint8_t)_setpoint.angleQuadramp);
+	_data.Put(_setpoint.distanceMaxSpeed);
+	_data.Put(_setpoint.distanceMaxAcc);
+	_data.Put(_setpoint.angleMaxSpeed);
+	_data.Put(_setpoint.angleMaxAcc);
+	_data.Put(_setpoint.distanceMaxJerk);
+	_data.Put(_setpoint.angleMaxJerk);
+	_data.Put((uint8_t)_setpoint.distanceProfile);
+	_data.Put((uint8_t)_setpoint.angleProfile);
+	_data.Put(_setpoint.distanceResetId);
+	_data.Put(_setpoint.angleResetId);
+	_data.Put((uint8_t)_setpoint.velocityMode);
+	_data.Put(_setpoint.distanceVelocity);
+	_data.Put(_setpoint.angleVelocity);
+	_data.Put(_setpoint.brakeId);
+	_data.Put((uint8_t)_setpoint.distanceBrake);
+	_data.Put((uint8_t)_setpoint.angleBrake);
+	_data.Put(_setpoint.distanceBrakeAcc);
+	_data.Put(_setpoint.angleBrakeAcc);
+	_data.Put(_setpoint.distanceSpeedScale);
+}
+
+template <typename Data>
+void Recorder::PutFlags(Data &_data)
+{
+	uint8_t Flags = 0;
+	if (ControlSystem::Instance.m_Enable)
+		Flags |= RECORD_FLAG_CONTROL_ENABLED;
+	if (MotorManager::Instance.Enabled)
+		Flags |= RECORD_FLAG_MOTORS_ENABLED;
+	if (TrajectoryManager::Instance.IsPaused())
+		Flags |= RECORD_FLAG_PAUSED;
+	_data.Put(Flags);
+}
+
+void Recorder::BeginRecord(RecordType _type)
+{
+	m_Record.Clear();
+	m_Record.Put(_type);
+}
+
+// A record too large for its RecordData stops the recording, the replay
+// couldn't go on without it
+void Recorder::EndRecord()
+{
+	if (m_Record.overflow)
+	{
+		m_Recording = false;
+		return;
+	}
+	Append(m_Record.data, m_Record.size);
+}
+
+void Recorder::BeginMainRecord(RecordType _type)
+{
+	m_MainRecord.Clear();
+	m_MainRecord.Put(_type);
+}
+
+// The control loop only drains the ring once per tick: a full ring is copied
+// to the buffer with the control loop masked, before it takes the record.
+void Recorder::EndMainRecord()
+{
+	if (m_MainRecord.overflow)
+	{
+		m_Recording = false;
+		return;
+	}
+	if (m_Ring.Push(m_MainRecord))
+		return;
+	Scheduler::disable();
+	DrainMain();
+	m_Ring.Push(m_MainRecord);
+	Scheduler::enable();
+}
+
+void Recorder::DrainMain()
+{
+	MainRecordData Record;
+	while (m_Ring.Pop(Record))
+		Append(Record.data, Record.size);
+}
+
+void Recorder::Append(const uint8_t *_data, unsigned _size)
+{
+	FlushIdle();
+	if (!m_Recording || m_Size + _size > RECORDER_BUFFER_SIZE)
+	{
+		m_Recording = false;
+		return;
+	}
+	memcpy(m_Buffer + m_Size, _data, _size);
+	m_Size += _size;
+}
+
+void Recorder::FlushIdle()
+{
+	if (!m_IdleTicks)
+		return;
+
+	uint8_t Idle[1 + VARINT_MAX_SIZE];
+	Idle[0] = (uint8_t)RecordType::IDLE;
+	unsigned Size = 1 + Encoding::EncodeVarint(m_IdleTicks, Idle + 1);
+	m_IdleTicks = 0;
+	if (m_Size + Size > RECORDER_BUFFER_SIZE)
+	{
+		m_Recording = false;
+		return;
+	}
+	memcpy(m_Buffer + m_Size, Idle, Size);
+	m_Size += Size;
+}
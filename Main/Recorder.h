@@ -0,0 +1,143 @@
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include "Globals.h"
+#include "SpscRing.h"
+#include "Encoding.h"
+
+#define RECORDER_BUFFER_SIZE 16384	// bytes: about 5 s of moves, the idle ticks take almost nothing
+#define RECORDER_MAX_RECORD 384		// bytes, the largest record (START, 342 bytes)
+#define RECORDER_MAX_MAIN_RECORD 64	// bytes, the largest main loop record (SETPOINT, 62 bytes)
+#define RECORDER_RING_SIZE 8		// main loop records waiting for the next control loop tick
+#define RECORDER_GP2_COUNT 4
+
+struct ControlSetpoint;
+
+// Records of the buffer, a type byte followed by its data. Values are little
+// endian, "varint" are zigzag LEB128 integers.
+enum class RecordType : uint8_t
+{
+	START,		// snapshot of the control stack, see Recorder::Start
+	TICK,		// control loop tick, 4 varints: change of the 2 encoder speeds, change of the 2 motor commands
+	TICK_SMALL,	// same, 4 bits each, in 2 bytes
+	IDLE,		// varint: number of ticks without any change
+	TASK,		// trajectory task: flags (RECORD_FLAG_*), varint change of each GP2 reading
+	POINT,		// trajectory point: x, y, angle, curve parameters (float), movement, now (uint8)
+	TRAJ_RESET,
+	PAUSE,
+	RESUME,
+	SETPOINT,	// control setpoint published outside of the trajectory task
+	ODOMETRY,	// odometry set outside of the control loop, see PositionManager::State
+};
+
+#define RECORD_FLAG_CONTROL_ENABLED 0x01
+#define RECORD_FLAG_MOTORS_ENABLED 0x02
+#define RECORD_FLAG_PAUSED 0x04
+
+// A record being built, of N bytes at most: the values that don't fit are
+// dropped and set overflow, the record is then dropped too
+template <unsigned N>
+struct RecordData
+{
+	uint8_t data[N];
+	unsigned size = 0;
+	bool overflow = false;
+
+	void Clear()
+	{
+		size = 0;
+		overflow = false;
+	}
+	template <typename T>
+	void Put(const T &_value)
+	{
+		if (size + sizeof(T) > N)
+		{
+			overflow = true;
+			return;
+		}
+		memcpy(data + size, &_value, sizeof(T));
+		size += sizeof(T);
+	}
+	void PutVarint(int32_t _value)
+	{
+		if (size + VARINT_MAX_SIZE > N)
+		{
+			overflow = true;
+			return;
+		}
+		size += Encoding::EncodeVarint(_value, data + size);
+	}
+};
+typedef RecordData<RECORDER_MAX_MAIN_RECORD> MainRecordData;
+
+// Flight recorder of the control stack: the raw encoder values and the motor
+// commands of every control loop tick, the GP2 readings of every trajectory
+// task, and the inputs given to the trajectory manager and to the control
+// system by the strategy and the command line interface.
+// Host/Replay.cpp runs a recording through the control stack again and
+// compares the motor commands. Recording starts with the match or with the
+// "record" command, the robot idle, and stops when the buffer is full.
+// Only the control loop writes the buffer: the main loop pushes its records
+// into a lock-free ring, copied to the buffer at the next tick.
+class Recorder
+{
+public:
+	static HAL_THREAD_LOCAL Recorder Instance;
+
+	void Start();
+	void Stop();
+	bool IsRecording() const { return m_Recording; }
+	uint32_t GetSize() const { return m_Size; }
+	const uint8_t* GetData() const { return m_Buffer; }
+	// Print the buffer in hexadecimal, between "record begin" and "record end" lines
+	void Dump();
+
+	// Control loop, at the end of every tick
+	void RecordTick();
+
+	// Main loop
+	void RecordTaskBegin();
+	void RecordTaskEnd() { m_InTask = false; }
+	void RecordPoint(const Float2 &_pos, float _angle, const float *_curve, uint8_t _movement, bool _now);
+	void RecordEvent(RecordType _type);
+	void RecordSetpoint(const ControlSetpoint &_setpoint);
+	void RecordOdometry();
+
+private:
+	template <typename Data>
+	void PutOdometry(Data &_data);
+	template <typename Data>
+	void PutSetpoint(Data &_data, const ControlSetpoint &_setpoint);
+	template <typename Data>
+	void PutFlags(Data &_data);
+	// Control loop records
+	void BeginRecord(RecordType _type);
+	void EndRecord();
+	// Main loop records, pushed into the ring
+	void BeginMainRecord(RecordType _type);
+	void EndMainRecord();
+	// Control loop, or main loop with the control loop masked: copy the ring to the buffer
+	void DrainMain();
+	// Copy a record to the buffer, after the pending idle ticks
+	void Append(const uint8_t *_data, unsigned _size);
+	void FlushIdle();
+
+	uint8_t m_Buffer[RECORDER_BUFFER_SIZE];
+	volatile uint32_t m_Size = 0;
+	volatile bool m_Recording = false;
+	bool m_InTask = false;
+
+	RecordData<RECORDER_MAX_RECORD> m_Record;
+	MainRecordData m_MainRecord;
+	SpscRing<MainRecordData, RECORDER_RING_SIZE> m_Ring;
+
+	// last recorded values
+	int32_t m_Encoder[2];
+	int32_t m_EncoderSpeed[2];
+	int32_t m_Command[2];
+	int16_t m_GP2[RECORDER_GP2_COUNT];
+	uint32_t m_IdleTicks = 0;
+};
+
+#endif
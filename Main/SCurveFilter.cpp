@@ -0,0 +1,283 @@
+/**
+ ********************************************************************
+ * @file    SCurveFilter.cpp
+ * @brief   Jerk limited (S-curve) motion profile filter.
+ ********************************************************************
+ */
+#include <math.h>
+#include <float.h>
+
+#include "SCurveFilter.h"
+
+#define SQUARE(x) ((x) * (x))
+#define SCURVE_NO_LIMIT 1e15f
+#define SCURVE_SEARCH_ITERATIONS 32
+#define SCURVE_SEARCH_RESOLUTION 1e-3f	// of the peak speed, the cruise covers the rest
+
+// Constant jerk part of a speed change
+struct SpeedChangePart
+{
+	float duration;
+	float jerk;
+};
+
+/**
+ * Jerk limited speed change from (vel, acc) to (vel_end, 0): the acceleration
+ * ramps to a peak, holds it, and ramps back to 0.
+ * Increases of the speed are limited by acc_up, decreases by acc_down.
+ */
+static void SpeedChange(float vel, float acc, float vel_end, float acc_up, float acc_down, float jerk,
+	SpeedChangePart parts[3])
+{
+	// speed once the acceleration is brought back to 0
+	float free_vel = vel + acc * fabsf(acc) / (2.f * jerk);
+	float dir = (vel_end >= free_vel) ? 1.f : -1.f;
+	float acc0 = dir * acc;
+	float vel_change = dir * (vel_end - vel);
+	float acc_max = (dir > 0.f) ? acc_up : acc_down;
+
+	float peak = fminf(sqrtf(fmaxf(jerk * vel_change + 0.5f * SQUARE(acc0), 0.f)), acc_max);
+	float t1 = fabsf(peak - acc0) / jerk;
+	float t3 = peak / jerk;
+	float hold = 0.f;
+	if (peak > 0.f)
+		hold = fmaxf((vel_change - 0.5f * (acc0 + peak) * t1 - 0.5f * peak * t3) / peak, 0.f);
+
+	parts[0] = { t1, (peak >= acc0) ? dir * jerk : -dir * jerk };
+	parts[1] = { hold, 0.f };
+	parts[2] = { t3, -dir * jerk };
+}
+
+static void Integrate(float duration, float jerk, float &pos, float &vel, float &acc)
+{
+	pos += vel * duration + acc * SQUARE(duration) / 2.f + jerk * duration * SQUARE(duration) / 6.f;
+	vel += acc * duration + jerk * SQUARE(duration) / 2.f;
+	acc += jerk * duration;
+}
+
+static float SpeedChangeDistance(float vel, float acc, const SpeedChangePart parts[3])
+{
+	float pos = 0.f;
+	for (int i = 0; i < 3; i++)
+		Integrate(parts[i].duration, parts[i].jerk, pos, vel, acc);
+	return pos;
+}
+
+
+void SCurveFilter::Init()
+{
+	m_var_3rd_ord = 0;
+	m_var_2nd_ord_pos = 0;
+	m_var_2nd_ord_neg = 0;
+	m_var_1st_ord_pos = 0;
+	m_var_1st_ord_neg = 0;
+
+	m_eval_period = 1;
+	m_Enable = true;
+	Reset(0);
+}
+
+void SCurveFilter::SetEvalPeriod(float period)
+{
+	m_eval_period = period;
+}
+
+void SCurveFilter::Set3rdOrderVar(float var_3rd_ord)
+{
+	if (var_3rd_ord == m_var_3rd_ord)
+		return;
+	m_var_3rd_ord = var_3rd_ord;
+	m_replan = true;
+}
+
+void SCurveFilter::Set2ndOrderVars(float var_2nd_ord_pos, float var_2nd_ord_neg)
+{
+	if (var_2nd_ord_pos == m_var_2nd_ord_pos && var_2nd_ord_neg == m_var_2nd_ord_neg)
+		return;
+	m_var_2nd_ord_pos = var_2nd_ord_pos;
+	m_var_2nd_ord_neg = var_2nd_ord_neg;
+	m_replan = true;
+}
+
+void SCurveFilter::Set1stOrderVars(float var_1st_ord_pos, float var_1st_ord_neg)
+{
+	if (var_1st_ord_pos == m_var_1st_ord_pos && var_1st_ord_neg == m_var_1st_ord_neg)
+		return;
+	m_var_1st_ord_pos = var_1st_ord_pos;
+	m_var_1st_ord_neg = var_1st_ord_neg;
+	m_replan = true;
+}
+
+void SCurveFilter::Reset(float value, float velocity)
+{
+	m_out = value;
+	m_vel = velocity;
+	m_acc = 0;
+
+	m_in = value;
+	m_time = 0;
+	m_segment_count = 0;
+	m_plan_end = 0;
+	m_replan = (velocity != 0);
+}
+
+/**
+ * Position where a jerk limited stop ends, starting from (pos, vel, acc).
+ * The stop brings the acceleration down to -dec (or less), holds it, and
+ * releases it so that speed and acceleration reach 0 together.
+ * acc_up is the acceleration limit used to stop a backward movement.
+ */
+float SCurveFilter::StopPosition(float pos, float vel, float acc, float dec, float acc_up, float jerk) const
+{
+	SpeedChangePart parts[3];
+	SpeedChange(vel, acc, 0.f, acc_up, dec, jerk, parts);
+	return pos + SpeedChangeDistance(vel, acc, parts);
+}
+
+void SCurveFilter::AddSegment(float duration, float jerk)
+{
+	if (duration <= 0.f)
+		return;
+
+	Segment &s = m_segment[m_segment_count];
+	if (m_segment_count == 0)
+	{
+		s.start = 0;
+		s.pos = m_out;
+		s.vel = m_vel;
+		s.acc = m_acc;
+	}
+	else
+	{
+		const Segment &prev = m_segment[m_segment_count - 1];
+		s.start = prev.start + prev.duration;
+		s.pos = prev.pos;
+		s.vel = prev.vel;
+		s.acc = prev.acc;
+		Integrate(prev.duration, prev.jerk, s.pos, s.vel, s.acc);
+	}
+	s.duration = duration;
+	s.jerk = jerk;
+	m_plan_end = s.start + duration;
+	m_segment_count++;
+}
+
+/**
+ * Plan the move from the current output (m_out, m_vel, m_acc) to the input.
+ * Computation is done in a frame where the input is ahead of the position the
+ * output can stop at: any increase of the speed is limited by acc_up, any
+ * decrease by acc_down. A move that can't stop before the input reverses
+ * without stopping first. The speed changes to the highest peak speed from
+ * which the stop still ends on the input, cruises, and stops on the input.
+ * A null acceleration or jerk limit is an infinite one. A null speed limit
+ * stops the output and holds it, as the quadramp does.
+ */
+void SCurveFilter::Plan()
+{
+	float d = m_in - m_out;
+	float dir = (d > 0.f || (d == 0.f && m_vel >= 0.f)) ? 1.f : -1.f;
+	float jerk = (m_var_3rd_ord > 0.f) ? m_var_3rd_ord : SCURVE_NO_LIMIT;
+
+	SpeedChangePart change[3], stop[3];
+	float target, vel, acc, acc_up, acc_down, vel_max;
+	for (int i = 0; i < 2; i++)
+	{
+		acc_up = (dir > 0.f) ? m_var_2nd_ord_pos : m_var_2nd_ord_neg;
+		acc_down = (dir > 0.f) ? m_var_2nd_ord_neg : m_var_2nd_ord_pos;
+		vel_max = (dir > 0.f) ? m_var_1st_ord_pos : m_var_1st_ord_neg;
+		if (!acc_up) acc_up = SCURVE_NO_LIMIT;
+		if (!acc_down) acc_down = SCURVE_NO_LIMIT;
+
+		target = dir * d;
+		vel = dir * m_vel;
+		acc = dir * m_acc;
+
+		SpeedChange(vel, acc, 0.f, acc_up, acc_down, jerk, change);
+		if (SpeedChangeDistance(vel, acc, change) <= target)
+			break;
+		dir = -dir;
+	}
+
+	m_time = 0;
+	m_segment_count = 0;
+	m_plan_end = 0;
+
+	// stop, and stay there as long as the speed limit is null
+	if (vel_max <= 0.f)
+	{
+		SpeedChange(vel, acc, 0.f, acc_up, acc_down, jerk, change);
+		for (const SpeedChangePart &p : change)
+			AddSegment(p.duration, dir * p.jerk);
+		AddSegment(FLT_MAX, 0.f);
+		return;
+	}
+
+	auto MoveDistance = [&](float vel_peak) {
+		SpeedChange(vel, acc, vel_peak, acc_up, acc_down, jerk, change);
+		SpeedChange(vel_peak, 0.f, 0.f, acc_up, acc_down, jerk, stop);
+		return SpeedChangeDistance(vel, acc, change) + SpeedChangeDistance(vel_peak, 0.f, stop);
+	};
+	// The distance of the move grows with the peak speed from the speed the
+	// acceleration can be released at: the move then stops as soon as possible.
+	// Lower peak speeds brake twice, only to respect a lowered speed limit.
+	float free_vel = vel + acc * fabsf(acc) / (2.f * jerk);
+	float vel_peak = vel_max;
+	if (MoveDistance(vel_max) > target)
+	{
+		float lo = (free_vel > 0.f && free_vel < vel_max) ? free_vel : 0.f, hi = vel_max;
+		for (int i = 0; i < SCURVE_SEARCH_ITERATIONS && hi - lo > SCURVE_SEARCH_RESOLUTION * hi; i++)
+		{
+			float mid = 0.5f * (lo + hi);
+			if (MoveDistance(mid) <= target)
+				lo = mid;
+			else
+				hi = mid;
+		}
+		vel_peak = lo;
+	}
+
+	float cruise_dist = fmaxf(target - MoveDistance(vel_peak), 0.f);
+	for (const SpeedChangePart &p : change)
+		AddSegment(p.duration, dir * p.jerk);
+	if (vel_peak > 0.f)
+		AddSegment(cruise_dist / vel_peak, 0.f);
+	for (const SpeedChangePart &p : stop)
+		AddSegment(p.duration, dir * p.jerk);
+}
+
+float SCurveFilter::Evaluate(float in)
+{
+	if (!m_Enable)
+	{
+		Reset(in);
+		return in;
+	}
+
+	if (in != m_in || m_replan)
+	{
+		m_in = in;
+		m_replan = false;
+		Plan();
+	}
+
+	m_time += m_eval_period;
+	if (m_time >= m_plan_end)
+	{
+		m_out = m_in;
+		m_vel = 0;
+		m_acc = 0;
+		return m_out;
+	}
+
+	int i = 0;
+	while (i < m_segment_count - 1 && m_time >= m_segment[i + 1].start)
+		i++;
+
+	const Segment &s = m_segment[i];
+	m_out = s.pos;
+	m_vel = s.vel;
+	m_acc = s.acc;
+	Integrate(m_time - s.start, s.jerk, m_out, m_vel, m_acc);
+
+	return m_out;
+}
@@ -0,0 +1,106 @@
+/**
+ ********************************************************************
+ * @file    SCurveFilter.h
+ * @brief   Jerk limited (S-curve) motion profile filter.
+ *          Same interface as QuadrampFilter, plus a 3rd order limit.
+ *
+ * @verbatim
+ * Velocity:                          Acceleration:
+ *  ^                                  ^
+ *  |      ________                    |  __
+ *  |    _/        \_                  | /  \
+ *  |   /            \                 |/    \        ____
+ *  |  /              \                +------\------/---->
+ *  |_/                \_              |       \____/
+ *  +---------------------->           |
+ * @endverbatim
+ *
+ * Unlike the quadramp, the acceleration never steps: it ramps with
+ * at most var_3rd_ord, which keeps the wheels from slipping at the
+ * start and at the end of the acceleration phases.
+ *
+ * As the quadramp, the move is planned when the input or a limit changes:
+ * speed change to the highest peak speed from which a jerk limited stop
+ * still ends on the input, cruise, and stop on the input. Unlike the
+ * quadramp, a move going past the input reverses without stopping first.
+ ********************************************************************
+ */
+#ifndef SCURVE_H
+#define SCURVE_H
+
+#include <stdint.h>
+
+
+class SCurveFilter
+{
+public:
+	/** Initialization of the filter */
+	void Init();
+
+	/** When disable, Evaluate() return the input */
+	void SetEnable(bool _e) { m_Enable = _e; }
+
+	/** See QuadrampFilter::SetEvalPeriod, 3rd order unit is [V]/([T]^3) */
+	void SetEvalPeriod(float period);
+
+	void Set3rdOrderVar(float var_3rd_ord);
+	void Set2ndOrderVars(float var_2nd_ord_pos, float var_2nd_ord_neg);
+	void Set1stOrderVars(float var_1st_ord_pos, float var_1st_ord_neg);
+
+	float Get1stOrderPos() const { return m_var_1st_ord_pos; }
+	float Get2ndOrderPos() const { return m_var_2nd_ord_pos; }
+	float Get3rdOrder() const { return m_var_3rd_ord; }
+
+	float GetOutput() const { return m_out; }
+
+	/** Planned velocity of the last output, in [V]/[T] */
+	float GetVelocity() const { return m_vel; }
+	/** Planned acceleration of the last output, in [V]/([T]^2) */
+	float GetAcceleration() const { return m_acc; }
+
+	void Reset(float value, float velocity = 0.f);
+
+	/** A new input or new limits are planned from the current output, velocity and acceleration */
+	float Evaluate(float in);
+
+	// Where the output stops from pos, vel and acc, braking at dec
+	float StopPosition(float pos, float vel, float acc, float dec, float acc_up, float jerk) const;
+
+private:
+	/** Constant jerk part of the plan, times in [T] from the plan start */
+	struct Segment
+	{
+		float start;
+		float duration;
+		float pos;
+		float vel;
+		float acc;
+		float jerk;
+	};
+
+	void Plan();
+	void AddSegment(float duration, float jerk);
+
+	float m_var_3rd_ord;
+	float m_var_2nd_ord_pos;
+	float m_var_2nd_ord_neg;
+	float m_var_1st_ord_pos;
+	float m_var_1st_ord_neg;
+
+	float m_out; /*!< Previous output value. */
+	float m_vel; /*!< Velocity of the output, in [V]/[T]. */
+	float m_acc; /*!< Acceleration of the output, in [V]/([T]^2). */
+
+	float m_in;						/*!< Input of the current plan. */
+	Segment m_segment[7];			/*!< Speed change, cruise, stop, 3 for each speed change. */
+	uint8_t m_segment_count;
+	float m_time;					/*!< Time since the plan start. */
+	float m_plan_end;
+	bool m_replan;
+
+	float m_eval_period;
+	bool m_Enable;
+};
+
+
+#endif /* SCURVE_H */
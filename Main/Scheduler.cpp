@@ -30,8 +30,8 @@
 #include "Scheduler.h"
 
 
-void (*Scheduler::onOverflow)() = 0;
-bool Scheduler::enabled = 0;
+HAL_THREAD_LOCAL void (*Scheduler::onOverflow)() = 0;
+HAL_THREAD_LOCAL bool Scheduler::enabled = 0;
 
 
 #if defined(__arm__) && defined(TEENSYDUINO)
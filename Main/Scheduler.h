@@ -1,6 +1,8 @@
 #ifndef SCHEDULER_H
 #define SCHEDULER_H
 
+#include "Hal.h"
+
 
 class Scheduler
 {
@@ -12,10 +14,10 @@ public:
 	static void disable();
 
 
-	static void(*onOverflow)(); // not really public, but I can't work out the 'friend' for the SIGNAL
+	static HAL_THREAD_LOCAL void(*onOverflow)(); // not really public, but I can't work out the 'friend' for the SIGNAL
 
 private:
-	static bool enabled;
+	static HAL_THREAD_LOCAL bool enabled;
 };
 
 #endif
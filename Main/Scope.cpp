@@ -0,0 +1,136 @@
+#include "Scope.h"
+#include "ControlSystem.h"
+#include "PositionManager.h"
+#include "MotorManager.h"
+#include "Platform.h"
+#include "Scheduler.h"
+#include "Telemetry.h"
+
+HAL_THREAD_LOCAL Scope Scope::Instance;
+
+static_assert(_countof(Platform::gp2Pins) == SCOPE_GP2_COUNT, "one scope variable per GP2");
+
+// The first ones are the getControlSystem stream, in its historical order
+static const ScopeVariable s_Variables[] = {
+	{ "dist.target", 100.f, []() { return ControlSystem::Instance.GetDistanceTarget(); } },	// mm
+	{ "dist.measure", 100.f, []() { return ControlSystem::Instance.GetDistanceMeasure(); } },
+	{ "dist.error", 100.f, []() { return ControlSystem::Instance.GetDistanceTarget() - ControlSystem::Instance.GetDistanceMeasure(); } },
+	{ "dist.cmd", 100.f, []() { return ControlSystem::Instance.GetDistanceCmd(); } },
+	{ "angle.target", 100000.f, []() { return ControlSystem::Instance.GetAngleTarget(); } },	// rad
+	{ "angle.measure", 100000.f, []() { return ControlSystem::Instance.GetAngleMeasure(); } },
+	{ "angle.error", 100000.f, []() { return ControlSystem::Instance.GetAngleTarget() - ControlSystem::Instance.GetAngleMeasure(); } },
+	{ "angle.cmd", 100000.f, []() { return ControlSystem::Instance.GetAngleCmd(); } },
+	{ "x", 100.f, []() { return PositionManager::Instance.GetXMm(); } },	// mm
+	{ "y", 100.f, []() { return PositionManager::Instance.GetYMm(); } },
+	{ "left.speed", 1.f, []() { return (float)MotorManager::Instance.GetSpeed(MotorManager::LEFT); } },	// ticks per MOTOR_SPEED_UNIT_S
+	{ "right.speed", 1.f, []() { return (float)MotorManager::Instance.GetSpeed(MotorManager::RIGHT); } },
+	{ "left.cmd", 1.f, []() { return (float)MotorManager::Instance.GetCommand(MotorManager::LEFT); } },	// PWM
+	{ "right.cmd", 1.f, []() { return (float)MotorManager::Instance.GetCommand(MotorManager::RIGHT); } },
+	{ "dist.p", 100.f, []() { return ControlSystem::Instance.GetDistancePID().GetPTerm(); } },	// terms of dist.cmd
+	{ "dist.i", 100.f, []() { return ControlSystem::Instance.GetDistancePID().GetITerm(); } },
+	{ "dist.d", 100.f, []() { return ControlSystem::Instance.GetDistancePID().GetDTerm(); } },
+	{ "angle.p", 100000.f, []() { return ControlSystem::Instance.GetAnglePID().GetPTerm(); } },	// terms of angle.cmd
+	{ "angle.i", 100000.f, []() { return ControlSystem::Instance.GetAnglePID().GetITerm(); } },
+	{ "angle.d", 100000.f, []() { return ControlSystem::Instance.GetAnglePID().GetDTerm(); } },
+	{ "theta", 100000.f, []() { return PositionManager::Instance.GetAngleRad(); } },	// rad
+	{ "left.enc", 1.f, []() { return (float)Scope::Instance.GetEncoderDelta(0); } },	// ticks per tick
+	{ "right.enc", 1.f, []() { return (float)Scope::Instance.GetEncoderDelta(1); } },
+	{ "gp2.0", 1.f, []() { return (float)Scope::Instance.GetGP2(0); } },	// ADC
+	{ "gp2.1", 1.f, []() { return (float)Scope::Instance.GetGP2(1); } },
+	{ "gp2.2", 1.f, []() { return (float)Scope::Instance.GetGP2(2); } },
+	{ "gp2.3", 1.f, []() { return (float)Scope::Instance.GetGP2(3); } },
+	{ "motors.on", 1.f, []() { return MotorManager::Instance.Enabled ? 1.f : 0.f; } },
+};
+
+static_assert(_countof(s_Variables) <= SCOPE_MAX_VARIABLES, "too many scope variables");
+
+void Scope::Sample()
+{
+	int32_t Encoder[2];
+	PositionManager::Instance.ReadEncoders(Encoder[0], Encoder[1]);
+	for (int i = 0; i < 2; i++)
+	{
+		m_EncoderDelta[i] = Encoder[i] - m_LastEncoder[i];
+		m_LastEncoder[i] = Encoder[i];
+	}
+
+	uint64_t Subscribed = m_Subscribed;
+	if (!Subscribed || ++m_Counter < m_Decimation)
+		return;
+	m_Counter = 0;
+
+	for (unsigned i = 0; Subscribed; i++, Subscribed >>= 1)
+	{
+		if (Subscribed & 1)
+			Telemetry::Instance.Write(i, s_Variables[i].read());
+	}
+}
+
+void Scope::Task()
+{
+	if (!m_Subscribed)
+		return;
+	for (int i = 0; i < SCOPE_GP2_COUNT; i++)
+		m_GP2[i] = analogRead(Platform::gp2Pins[i]);
+}
+
+bool Scope::Subscribe(const char *_name, bool _subscribe)
+{
+	size_t Length = strlen(_name);
+	bool Prefix = (Length > 0 && _name[Length - 1] == '*');
+	if (Prefix)
+		Length--;
+
+	uint64_t Mask = 0;
+	for (unsigned i = 0; i < _countof(s_Variables); i++)
+	{
+		if (Prefix ? !strncmp(s_Variables[i].name, _name, Length) : !strcmp(s_Variables[i].name, _name))
+			Mask |= 1ull << i;
+	}
+	if (!Mask)
+		return false;
+
+	SetSubscribed(_subscribe ? (m_Subscribed | Mask) : (m_Subscribed & ~Mask));
+	return true;
+}
+
+void Scope::Clear()
+{
+	SetSubscribed(0);
+}
+
+void Scope::SetDecimation(unsigned _ticks)
+{
+	Scheduler::disable();
+	m_Decimation = (_ticks > 0) ? _ticks : 1;
+	m_Counter = 0;
+	Scheduler::enable();
+}
+
+// 64 bit: the control loop must not see half of the change
+void Scope::SetSubscribed(uint64_t _mask)
+{
+	Scheduler::disable();
+	m_Subscribed = _mask;
+	Scheduler::enable();
+}
+
+void Scope::Print(bool _all)
+{
+	Serial.printf("scope: every %u ticks (%.1f ms)\r\n", m_Decimation, m_Decimation * MOTOR_CONTROL_PERIOD_S * 1000.);
+	for (unsigned i = 0; i < _countof(s_Variables); i++)
+	{
+		if (_all || IsSubscribed(i))
+			Serial.printf("%c %s\r\n", IsSubscribed(i) ? '*' : ' ', s_Variables[i].name);
+	}
+}
+
+unsigned Scope::GetVariableCount()
+{
+	return _countof(s_Variables);
+}
+
+const ScopeVariable& Scope::GetVariable(unsigned _id)
+{
+	return s_Variables[_id];
+}
@@ -0,0 +1,62 @@
+#ifndef SCOPE_H
+#define SCOPE_H
+
+#include "Globals.h"
+
+#define SCOPE_MAX_VARIABLES 64	// the subscriptions and the binary telemetry use 64 bit masks
+#define SCOPE_GP2_COUNT 4
+
+// A variable of the control stack the scope can stream
+struct ScopeVariable
+{
+	const char *name;	// no spaces, the CLI takes it as an argument
+	float scale;		// binary telemetry resolution: 1 / scale
+	float (*read)();	// called in the control loop
+};
+
+// Live variable streaming: the control loop samples the subscribed variables
+// every decimation ticks into the telemetry ring, which the main loop writes
+// to Serial (Telemetry.h). The variable id is its index in the registry, the
+// values of a sample are written in the id order.
+class Scope
+{
+public:
+	static HAL_THREAD_LOCAL Scope Instance;
+
+	// Control loop, every tick
+	void Sample();
+	// Main loop: the values which can't be read in the control loop (GP2)
+	void Task();
+
+	// Subscribe to a variable, or to every variable starting with the name
+	// before a final '*'. False if nothing matches.
+	bool Subscribe(const char *_name, bool _subscribe = true);
+	void Clear();
+	// In ticks of the control loop (MOTOR_CONTROL_PERIOD_S)
+	void SetDecimation(unsigned _ticks);
+	unsigned GetDecimation() const { return m_Decimation; }
+	bool IsSubscribed(unsigned _id) const { return (m_Subscribed >> _id) & 1; }
+
+	// Subscriptions and rate; every variable with _all
+	void Print(bool _all);
+
+	static unsigned GetVariableCount();
+	static const ScopeVariable& GetVariable(unsigned _id);
+
+	// Encoder change of the last tick
+	int32_t GetEncoderDelta(int _wheel) const { return m_EncoderDelta[_wheel]; }
+	int16_t GetGP2(int _id) const { return m_GP2[_id]; }
+
+private:
+	void SetSubscribed(uint64_t _mask);
+
+	volatile uint64_t m_Subscribed = 0;
+	volatile unsigned m_Decimation = 1;
+	unsigned m_Counter = 0;
+
+	int32_t m_LastEncoder[2] = { 0, 0 };
+	int32_t m_EncoderDelta[2] = { 0, 0 };
+	volatile int16_t m_GP2[SCOPE_GP2_COUNT] = { 0, 0, 0, 0 };
+};
+
+#endif
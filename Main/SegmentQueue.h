@@ -0,0 +1,133 @@
+#ifndef _SEGMENT_QUEUE_H_
+#define _SEGMENT_QUEUE_H_
+
+#include "Globals.h"
+
+// Doubly linked list of elements in a fixed pool. Pushing, popping, inserting
+// and removing anywhere cost constant time and never move the elements: an
+// element is referenced by its id in the pool until it is removed.
+// Insertions return NONE when the pool is full, nothing is ever dropped.
+template <typename T, unsigned CAPACITY>
+class SegmentQueue
+{
+public:
+	static const unsigned NONE = CAPACITY;
+
+	unsigned GetCapacity() const { return CAPACITY; }
+	unsigned GetSize() const { return m_Size; }
+	unsigned GetFreeSize() const { return CAPACITY - m_Size; }
+	bool IsEmpty() const { return m_Size == 0; }
+	bool IsFull() const { return m_Size == CAPACITY; }
+
+	unsigned GetFront() const { return m_Front; }
+	unsigned GetBack() const { return m_Back; }
+	unsigned GetNext(unsigned _id) const { return m_Nodes[_id].next; }
+	unsigned GetPrev(unsigned _id) const { return m_Nodes[_id].prev; }
+
+	// Insert _element before the _next one, at the back if NONE: its id, NONE if the pool is full
+	unsigned Insert(unsigned _next, const T &_element)
+	{
+		unsigned id;
+		if (m_Free != NONE)
+		{
+			id = m_Free;
+			m_Free = m_Nodes[id].next;
+		}
+		else if (m_Used < CAPACITY)
+			id = m_Used++;
+		else
+			return NONE;
+
+		Node &node = m_Nodes[id];
+		node.element = _element;
+		node.next = _next;
+		node.prev = (_next != NONE) ? m_Nodes[_next].prev : m_Back;
+		if (node.prev != NONE)
+			m_Nodes[node.prev].next = id;
+		else
+			m_Front = id;
+		if (_next != NONE)
+			m_Nodes[_next].prev = id;
+		else
+			m_Back = id;
+		m_Size++;
+		return id;
+	}
+
+	unsigned PushBack(const T &_element) { return Insert(NONE, _element); }
+	unsigned PushFront(const T &_element) { return Insert(m_Front, _element); }
+
+	void Remove(unsigned _id)
+	{
+		Assert(_id < m_Used && m_Size > 0);
+		Node &node = m_Nodes[_id];
+		if (node.prev != NONE)
+			m_Nodes[node.prev].next = node.next;
+		else
+			m_Front = node.next;
+		if (node.next != NONE)
+			m_Nodes[node.next].prev = node.prev;
+		else
+			m_Back = node.prev;
+		node.next = m_Free;
+		m_Free = _id;
+		m_Size--;
+	}
+
+	void PopFront() { Remove(m_Front); }
+	void PopBack() { Remove(m_Back); }
+
+	void Clear()
+	{
+		m_Front = m_Back = m_Free = NONE;
+		m_Used = 0;
+		m_Size = 0;
+	}
+
+	T& operator[](unsigned _id) { return m_Nodes[_id].element; }
+	const T& operator[](unsigned _id) const { return m_Nodes[_id].element; }
+
+	T& Front()
+	{
+		Assert(m_Size > 0);
+		return m_Nodes[m_Front].element;
+	}
+	const T& Front() const
+	{
+		Assert(m_Size > 0);
+		return m_Nodes[m_Front].element;
+	}
+
+	T& Back()
+	{
+		Assert(m_Size > 0);
+		return m_Nodes[m_Back].element;
+	}
+	const T& Back() const
+	{
+		Assert(m_Size > 0);
+		return m_Nodes[m_Back].element;
+	}
+
+	template <typename Function>
+	void Apply(Function fct)
+	{
+		for (unsigned i = m_Front; i != NONE; i = m_Nodes[i].next)
+			fct(m_Nodes[i].element);
+	}
+
+private:
+	struct Node
+	{
+		T element;
+		unsigned prev, next;
+	};
+
+	Node m_Nodes[CAPACITY];
+	unsigned m_Front = NONE, m_Back = NONE;
+	unsigned m_Free = NONE;	// list of the removed nodes
+	unsigned m_Used = 0;	// nodes of the pool used once, the next ones were never used
+	unsigned m_Size = 0;
+};
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef _SPSC_RING_H_
+#define _SPSC_RING_H_
+
+#include <stdint.h>
+
+// Single producer / single consumer ring of N values (N a power of 2).
+// The producer only writes the head and the consumer only writes the tail,
+// so neither side has to mask interrupts. A full ring refuses new values.
+// Typical use: the control ISR pushes, the main loop pops.
+template <typename T, unsigned N>
+class SpscRing
+{
+	static_assert((N & (N - 1)) == 0, "N must be a power of 2");
+
+public:
+	// Producer side: false if the ring is full
+	bool Push(const T &_value)
+	{
+		uint32_t Head = m_Head;
+		if (Head - __atomic_load_n(&m_Tail, __ATOMIC_ACQUIRE) >= N)
+			return false;
+		m_Buffer[Head & (N - 1)] = _value;
+		__atomic_store_n(&m_Head, Head + 1, __ATOMIC_RELEASE);
+		return true;
+	}
+
+	// Consumer side: false if the ring is empty
+	bool Pop(T &_value)
+	{
+		uint32_t Tail = m_Tail;
+		if (__atomic_load_n(&m_Head, __ATOMIC_ACQUIRE) == Tail)
+			return false;
+		_value = m_Buffer[Tail & (N - 1)];
+		__atomic_store_n(&m_Tail, Tail + 1, __ATOMIC_RELEASE);
+		return true;
+	}
+
+	unsigned GetSize() const
+	{
+		return __atomic_load_n(&m_Head, __ATOMIC_ACQUIRE) - __atomic_load_n(&m_Tail, __ATOMIC_ACQUIRE);
+	}
+
+private:
+	T m_Buffer[N];
+	uint32_t m_Head = 0;	// written by the producer
+	uint32_t m_Tail = 0;	// written by the consumer
+};
+
+#endif
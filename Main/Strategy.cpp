@@ -5,8 +5,15 @@
 #include "TrajectoryManager.h"
 #include "PositionManager.h"
 #include "MotorManager.h"
+#include "Recorder.h"
+#include "Astar.h"
 
-Strategy Strategy::Instance;
+HAL_THREAD_LOCAL Strategy Strategy::Instance;
+
+static void OnTrajectoryEvent(const TrajectoryEvent &_event)
+{
+	Strategy::Instance.OnTrajectoryEvent(_event);
+}
 
 const Float2 Strategy::POSITIONING_OFFSET = Float2(55, 100);
 
@@ -28,6 +35,7 @@ void Strategy::Init()
 		m_Side = Side::GREEN;
 	else
 		m_Side = Side::ORANGE;
+	TrajectoryManager::Instance.SetListener(::OnTrajectoryEvent);
 }
 
 void Strategy::Task()
@@ -78,33 +86,190 @@ void Strategy::Task()
 	}
 #endif
 
-	// HACK: open the door even if the robot is blocked
+	// HACK: open the door even if the robot is blocked, as soon as the queued
+	// moves can't end before 70 s
+	uint32_t EndMs = millis() + (uint32_t)(1000.f * TrajectoryManager::Instance.GetTrajectoryEta());
 	if (((m_State == State::WATER_PLANT2) || (m_State == State::WATER_PLANT3))
-		&& millis() > m_StartTime + 70000)
+		&& EndMs > m_StartTime + 70000)
 	{
 		m_State = State::WATER_PLANT4;
 	}
 
 	//Serial.printf(" %d,", (int)m_EnableAvoidance);// TrajectoryManager::Instance.IsForwardMovement());
 #if ENABLE_AVOIDANCE
+	// the closer the obstacle in the direction of travel, the slower the robot, down to a stop
+	float ObstacleDist = GP2_MAX_DISTANCE_MM;
 	if ((int)m_State > ((int)State::WAITING_START + 1)
-		&& m_EnableAvoidance 
-		&& Platform::IsGP2Occluded(TrajectoryManager::Instance.IsForwardMovement())
+		&& m_EnableAvoidance
 		&& !TrajectoryManager::Instance.IsOnlyRotation())
+	{
+		ObstacleDist = Platform::GetObstacleDistance(TrajectoryManager::Instance.IsForwardMovement());
+	}
+	float Scale = (ObstacleDist - GP2_BLOCK_DISTANCE_MM) / (AVOIDANCE_SLOW_DISTANCE_MM - GP2_BLOCK_DISTANCE_MM);
+	Scale = AVOIDANCE_MIN_SPEED_SCALE + (1.f - AVOIDANCE_MIN_SPEED_SCALE) * Math::Clamp(Scale, 0.f, 1.f);
+	// by steps, past the noise of the sensors: each new scale is a setpoint to record
+	float Step = roundf(Scale / AVOIDANCE_SPEED_SCALE_STEP) * AVOIDANCE_SPEED_SCALE_STEP;
+	float Current = ControlSystem::Instance.GetSetpoint().distanceSpeedScale;
+	if (fabsf(Scale - Current) > 0.75f * AVOIDANCE_SPEED_SCALE_STEP)
+		ControlSystem::Instance.SetDistanceSpeedScale(Step);
+	if (ObstacleDist < GP2_BLOCK_DISTANCE_MM)
 	{
 		//ControlSystem::Instance.Reset();
 		TrajectoryManager::Instance.Pause();
+		if (!m_Avoiding)
+		{
+			m_Avoiding = true;
+			m_AvoidanceStartMs = millis();
+		}
+		// still there: go around it, or wait again if there's no way
+		else if (m_DetourDelayMs && millis() - m_AvoidanceStartMs >= m_DetourDelayMs)
+		{
+			if (Detour(ObstacleDist))
+			{
+				m_Avoiding = false;
+				TrajectoryManager::Instance.Resume();
+			}
+			else
+				m_AvoidanceStartMs = millis();
+		}
 		return;
 	}
 	else
 	{
+		m_Avoiding = false;
 		TrajectoryManager::Instance.Resume();
 	}
 #endif
 
-	if (!TrajectoryManager::Instance.IsEnded())
+	if (m_Retrying)
+	{
+		RetryAction();
 		return;
+	}
+	if (m_Blocked || !TrajectoryManager::Instance.IsEnded())
+		return;
+
+	// the first action, and the ones after an action without any move
+	NextAction();
+	m_Retries = 0;
+	m_LastPointId = TrajectoryManager::Instance.GetLastId();
+}
 
+// The last point of the action completed: the next action starts in the same
+// trajectory task, its points with the speed the robot has
+void Strategy::OnTrajectoryEvent(const TrajectoryEvent &_event)
+{
+	if (_event.status == TrajectoryStatus::BLOCKED)
+	{
+		// the points are being cleared, the action starts again from the task,
+		// unless the motors were shut down on purpose
+		if (MotorManager::Instance.Stalled
+			&& m_State > State::WATER_TOWER0 && m_State <= State::WAITING_END
+			&& m_Retries < BLOCKED_MAX_RETRIES && !isTimeOut())
+		{
+			Serial.printf("point %d blocked, trying again\r\n", (int)_event.id);
+			m_Retrying = true;
+			m_BlockedForward = _event.forward;
+			return;
+		}
+		Serial.printf("point %d blocked, strategy stopped\r\n", (int)_event.id);
+		m_Blocked = true;
+		return;
+	}
+	if (m_Blocked || m_Retrying || _event.id != m_LastPointId || !TrajectoryManager::Instance.IsEnded())
+		return;
+	if (m_State <= State::WAITING_START || m_State >= State::WAITING_END || isTimeOut())
+		return;
+	NextAction();
+	m_Retries = 0;
+	m_LastPointId = TrajectoryManager::Instance.GetLastId();
+}
+
+// The motors were shut down against something the sensors don't see, like
+// the water plant: they restart from the measured pose, the robot backs off
+// and the last action starts again, from the move it was blocked in
+void Strategy::RetryAction()
+{
+	m_Retrying = false;
+	m_Retries++;
+	ControlSystem::Instance.Reset();
+	PositionManager::Instance.SetTheoreticalPosMm(PositionManager::Instance.GetPosMm());
+	PositionManager::Instance.SetTheoreticalAngleRad(PositionManager::Instance.GetAngleRad());
+	MotorManager::Instance.Stalled = false;
+	MotorManager::Instance.Enabled = true;
+	TrajectoryManager::Instance.GotoDistance(m_BlockedForward ? -BLOCKED_BACKOFF_MM : BLOCKED_BACKOFF_MM);
+	m_State = (State)((int)m_State - 1);
+	NextAction();
+	m_LastPointId = TrajectoryManager::Instance.GetLastId();
+}
+
+// Waypoints around the obstacle seen _obstacleDist mm away in the direction
+// of travel, to the current point: false if it isn't a GotoXY point or if the
+// planner finds no way around
+bool Strategy::Detour(float _obstacleDist)
+{
+#ifdef ENABLE_ASTAR
+	Float2 Target;
+	if (!TrajectoryManager::Instance.GetCurrentTarget(Target))
+		return false;
+
+	bool IsFront = TrajectoryManager::Instance.IsForwardMovement();
+	float Angle = PositionManager::Instance.GetAngleRad();
+	Float2 Dir = Float2(-sinf(Angle), cosf(Angle)) * (IsFront ? 1.f : -1.f);
+	float Offset = (IsFront ? ROBOT_CENTER_FRONT : ROBOT_CENTER_BACK) + _obstacleDist + AVOIDANCE_OPPONENT_RADIUS_MM;
+	Float2 Pos = PositionManager::Instance.GetPosMm();
+	// the elements Graph::Init puts on the table aren't the ones of this game:
+	// the water plant, and the obstacle in front of the sensors that see it
+	Graph::Instance.Clear();
+	Graph::Instance.PutObstacleBox(Float2(WATER_PLANT_LEFT - 0.5f * ROBOT_WIDTH, WATER_PLANT_FRONT - 0.5f * ROBOT_WIDTH),
+		Float2(WATER_PLANT_RIGHT + 0.5f * ROBOT_WIDTH, TABLE_HEIGHT));
+	Graph::Instance.PutObstacleCircle(Pos + Dir * Offset, AVOIDANCE_OPPONENT_RADIUS_MM + 0.5f * ROBOT_WIDTH);
+
+	// the detour joins the way to the target before it: the robot arrives
+	// from the same side, where the strategy expects it
+	Float2 ToTarget = Target - Pos;
+	float TargetDist = ToTarget.Length();
+	Float2 Rejoin = Target - ToTarget * (min(AVOIDANCE_DETOUR_REJOIN_MM, 0.5f * TargetDist) / max(TargetDist, 1.f));
+
+	AStarCoord Start, End;
+	Start.FromWordPosition(Pos);
+	End.FromWordPosition(Rejoin);
+	AStar::Path Path;
+	if (AStar::Instance.FindPath(AStar::Node(Start), AStar::Node(End), Path) != AStar::SUCCESS)
+	{
+		Serial.printf("no detour to %.0f, %.0f\r\n", Target.x, Target.y);
+		return false;
+	}
+
+	// the corners of the path, without the cells of the robot and of the end
+	Float2 Points[AVOIDANCE_MAX_DETOUR_POINTS];
+	unsigned Count = 0;
+	AStarCoord Prev, Cur;
+	unsigned i = 0;
+	for (const AStar::Node &Cell : Path)
+	{
+		if (i >= 2 && (Cur.x - Prev.x != Cell._pos.x - Cur.x || Cur.y - Prev.y != Cell._pos.y - Cur.y))
+		{
+			if (Count == AVOIDANCE_MAX_DETOUR_POINTS)
+				return false;
+			Cur.ToWordPosition(Points[Count++]);
+		}
+		Prev = Cur;
+		Cur = Cell._pos;
+		i++;
+	}
+	if (Count == AVOIDANCE_MAX_DETOUR_POINTS)
+		return false;
+	Points[Count++] = Rejoin;
+	Serial.printf("detour of %u points to %.0f, %.0f\r\n", Count, Target.x, Target.y);
+	return TrajectoryManager::Instance.InsertXY(Points, Count);
+#else
+	return false;
+#endif
+}
+
+void Strategy::NextAction()
+{
 	switch (m_State)
 	{
 #if ENABLE_LAZY_MODE
@@ -233,6 +398,7 @@ void Strategy::Start()
 	{
 		m_State++;
 		m_StartTime = millis();
+		Recorder::Instance.Start();
 		Platform::InitServo();
 		SetArmState(ArmState::NORMAL, false);
 		SetDoorState(DoorState::CLOSE, false);
@@ -299,7 +465,7 @@ void Strategy::ShakeRobot(uint32_t durationMs)
 void Strategy::RePosAgainstBackWall()
 {
 	PositionManager::Instance.SetAngleDeg(GetCorrectAngle(0.f));
-	PositionManager::Instance.SetPosMm(Float2(PositionManager::Instance.GetPosMm().x, 2000.f - ROBOT_CENTER_FRONT));
+	PositionManager::Instance.SetPosMm(Float2(PositionManager::Instance.GetPosMm().x, TABLE_HEIGHT - ROBOT_CENTER_FRONT));
 }
 
 void Strategy::RePosAgainstWaterPlantSide()
@@ -307,16 +473,16 @@ void Strategy::RePosAgainstWaterPlantSide()
 	PositionManager::Instance.SetAngleDeg(m_Side == Side::GREEN ? (-90.f+360.f) : (-90.f));
 	float x;
 	if (m_Side == Side::GREEN)
-		x = 2100.f + ROBOT_CENTER_BACK;
+		x = WATER_PLANT_RIGHT + ROBOT_CENTER_BACK;
 	else
-		x = 900.f - ROBOT_CENTER_FRONT;
+		x = WATER_PLANT_LEFT - ROBOT_CENTER_FRONT;
 	PositionManager::Instance.SetPosMm(Float2(x, PositionManager::Instance.GetPosMm().y));
 }
 
 void Strategy::RePosAgainstWaterPlantFront()
 {
 	PositionManager::Instance.SetAngleDeg(GetCorrectAngle(0.f));
-	PositionManager::Instance.SetPosMm(Float2(PositionManager::Instance.GetPosMm().x, 1750.f - ROBOT_CENTER_FRONT));
+	PositionManager::Instance.SetPosMm(Float2(PositionManager::Instance.GetPosMm().x, WATER_PLANT_FRONT - ROBOT_CENTER_FRONT));
 }
 
 void Strategy::Print()
@@ -341,6 +507,7 @@ void Strategy::Print()
 	Serial.printf("Time since start: %ds\r\n", (millis() - m_StartTime) / 1000);
 	Serial.printf("Is trajectory paused: %d\r\n", (int)TrajectoryManager::Instance.IsPaused());
 	Serial.printf("is avoidance enabled:  %d\r\n", (int)m_EnableAvoidance);
+	Serial.printf("detour delay: %lu ms\r\n", (unsigned long)m_DetourDelayMs);
 }
 
 void Strategy::SetSide(Side _side)
@@ -2,16 +2,33 @@
 #define _STRATEGY_H_
 
 #include "Globals.h"
+#include "TrajectoryManager.h"
 
 #define ENABLE_POSITIONNING 1
 #define ENABLE_TIMER 1
 #define ENABLE_AVOIDANCE 1
 #define ENABLE_LAZY_MODE 0 // for approval
 
+#define AVOIDANCE_SLOW_DISTANCE_MM 500.f // closer obstacles slow the robot down, see GP2_BLOCK_DISTANCE_MM
+#define AVOIDANCE_MIN_SPEED_SCALE 0.3f // of the max speed, just before stopping
+#define AVOIDANCE_SPEED_SCALE_STEP 0.05f // the scale changes by steps, once it moved by 3/4 of one
+#define AVOIDANCE_DETOUR_DELAY_MS 1000 // stopped by an obstacle for so long, the robot goes around it
+#define AVOIDANCE_OPPONENT_RADIUS_MM 200.f // obstacle put in the map of the detours, with a margin
+#define AVOIDANCE_DETOUR_REJOIN_MM 200.f // the detours end on the way to the target, so far before it
+#define AVOIDANCE_MAX_DETOUR_POINTS 8
+#define BLOCKED_BACKOFF_MM 100.f // the robot backs off what it is stuck on, then tries the action again
+#define BLOCKED_MAX_RETRIES 2 // of the same action, then the strategy stops
+
 #define ROBOT_WIDTH 235.f
 #define ROBOT_CENTER_BACK 55.f // distance between axle and back
 #define ROBOT_CENTER_FRONT (150.f-ROBOT_CENTER_BACK) // distance between axle and front
 
+// The water plant, from its front to the back wall
+#define WATER_PLANT_LEFT 900.f
+#define WATER_PLANT_RIGHT 2100.f
+#define WATER_PLANT_FRONT 1750.f
+#define TABLE_HEIGHT 2000.f
+
 enum class Side
 {
 	GREEN,
@@ -60,11 +77,12 @@ public:
 		END
 	};
 	
-	static Strategy Instance;
+	static HAL_THREAD_LOCAL Strategy Instance;
 	Strategy();
 	void Init();
 	void Task();
 	void Start();
+	void OnTrajectoryEvent(const TrajectoryEvent &_event);
 	
 	void SetInitialPosition();
 	void PushRobotAgainstWall(uint32_t durationMs = 1500, bool goForward = true);
@@ -74,6 +92,7 @@ public:
 	void RePosAgainstWaterPlantFront();
 
 	Side GetSide() { return m_Side; }
+	State GetState() const { return m_State; }
 	void SetSide(Side _side);
 	bool isTimeOut();
 	void Print();
@@ -84,12 +103,27 @@ public:
 	void SetArmState(ArmState _state, bool _waitUntilFinish = true);
 	void SetDoorState(DoorState _state, bool _waitUntilFinish = true);
 
+	// Stopped by an obstacle for _ms, the robot goes around it when it can. 0: it only waits
+	void SetDetourDelay(uint32_t _ms) { m_DetourDelayMs = _ms; }
+
 private:
+	void NextAction();
+	void RetryAction();
+	bool Detour(float _obstacleDist);
+
 	static const Float2 POSITIONING_OFFSET;
 
 	Side		m_Side = Side::GREEN;
 	State		m_State = (State)0;
 	uint32_t	m_StartTime = 0;
+	bool		m_Blocked = false;	// the motors were shut down during a move
+	bool		m_Retrying = false;	// blocked, the action starts again at the next task
+	bool		m_BlockedForward = true;
+	uint8_t		m_Retries = 0;		// of the current action
+	uint16_t	m_LastPointId = 0;	// of the action, the detours are inserted before it
+	bool		m_Avoiding = false;	// stopped by an obstacle
+	uint32_t	m_AvoidanceStartMs = 0;
+	uint32_t	m_DetourDelayMs = AVOIDANCE_DETOUR_DELAY_MS;
 public:
 	bool		m_EnableAvoidance = true;
 };
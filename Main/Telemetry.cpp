@@ -0,0 +1,257 @@
+#include "Telemetry.h"
+#include "Encoding.h"
+#include "TrajectoryManager.h"
+
+HAL_THREAD_LOCAL Telemetry Telemetry::Instance;
+
+static const char *s_Events[(int)TelemetryEvent::COUNT] = {
+	"Alert: the robot want to move and he can't, shutdown motors",
+	"trajectory",
+};
+
+static const char *s_TrajectoryStatus[] = { "reached", "timeout", "blocked", "cancelled" };
+
+void Telemetry::Write(uint8_t _channel, float _value)
+{
+	TelemetryRecord Record;
+	Record.timeUs = micros();
+	Record.value = _value;
+	Record.channel = _channel;
+	if (!m_Ring.Push(Record))
+		m_Dropped++;
+}
+
+void Telemetry::WriteEvent(TelemetryEvent _event)
+{
+	Write(TELEMETRY_EVENT_CHANNEL, (float)_event);
+}
+
+void Telemetry::Task()
+{
+	DrainTrajectory();
+	if (m_Binary)
+		DrainBinary();
+	else
+		DrainText();
+	Flush();
+}
+
+void Telemetry::SetBinary(bool _binary)
+{
+	m_Binary = _binary;
+	if (!_binary)
+		return;
+
+	// a 0 ends whatever text the decoder received before
+	uint8_t Delimiter = 0;
+	Output(&Delimiter, 1);
+	SendTable();
+	m_FramesSinceKey = TELEMETRY_KEY_INTERVAL;
+	Flush();
+}
+
+void Telemetry::DrainText()
+{
+	char Line[96];
+	TelemetryRecord Record;
+	while (m_Ring.Pop(Record))
+	{
+		int Size;
+		if (Record.channel == TELEMETRY_EVENT_CHANNEL)
+		{
+			unsigned Event = (unsigned)Record.value;
+			if (Event >= (unsigned)TelemetryEvent::COUNT)
+				continue;
+			Size = snprintf(Line, sizeof(Line), "%10.1f %s\r\n", Record.timeUs * 1e-3f, s_Events[Event]);
+		}
+		else if (Record.channel < Scope::GetVariableCount())
+			Size = snprintf(Line, sizeof(Line), "%10.1f %-15s%.2f\r\n", Record.timeUs * 1e-3f, Scope::GetVariable(Record.channel).name, Record.value);
+		else
+			continue;
+		Output(Line, Size < (int)sizeof(Line) ? Size : sizeof(Line) - 1);
+	}
+
+	uint32_t Dropped = m_Dropped;
+	if (Dropped != m_ReportedDropped)
+	{
+		int Size = snprintf(Line, sizeof(Line), "telemetry: %lu records dropped\r\n", (unsigned long)(Dropped - m_ReportedDropped));
+		Output(Line, Size);
+		m_ReportedDropped = Dropped;
+	}
+}
+
+// The values of a tick are written in the channel order: a channel which is
+// not after the previous one starts a new sample, and a new frame.
+void Telemetry::DrainBinary()
+{
+	// a 0 ends the text the main loop printed since the last frames (CLI echo...)
+	if (m_Ring.GetSize())
+	{
+		uint8_t Delimiter = 0;
+		Output(&Delimiter, 1);
+	}
+
+	TelemetryRecord Record;
+	while (m_Ring.Pop(Record))
+	{
+		if (Record.channel == TELEMETRY_EVENT_CHANNEL)
+		{
+			unsigned Event = (unsigned)Record.value;
+			if (Event < (unsigned)TelemetryEvent::COUNT)
+				SendEvent(Record.timeUs, (TelemetryEvent)Event, s_Events[Event]);
+			continue;
+		}
+		if (Record.channel >= Scope::GetVariableCount())
+			continue;
+
+		if (m_FrameSize && ((int)Record.channel <= m_LastChannel || m_FrameSize > TELEMETRY_MAX_FRAME - 1 - 2 * VARINT_MAX_SIZE))
+			EndFrame();
+		if (!m_FrameSize)
+		{
+			bool Key = (m_FramesSinceKey >= TELEMETRY_KEY_INTERVAL);
+			BeginFrame(Key ? TelemetryFrame::KEY : TelemetryFrame::DELTA);
+			PutVarint(Key ? (int32_t)Record.timeUs : (int32_t)(Record.timeUs - m_LastTimeUs));
+			m_LastTimeUs = Record.timeUs;
+			m_FramesSinceKey = Key ? 0 : m_FramesSinceKey + 1;
+			if (Key)
+				m_SentChannels = 0;
+			m_LastChannel = -1;
+		}
+		AddValue(Record.channel, Record.value);
+	}
+	// the rest of the sample goes in the next frame, with the same time
+	if (m_FrameSize)
+		EndFrame();
+
+	uint32_t Dropped = m_Dropped;
+	if (Dropped != m_ReportedDropped)
+	{
+		BeginFrame(TelemetryFrame::DROPPED);
+		PutVarint(Dropped - m_ReportedDropped);
+		EndFrame();
+		m_ReportedDropped = Dropped;
+	}
+}
+
+void Telemetry::SendTable()
+{
+	BeginFrame(TelemetryFrame::TABLE);
+	m_Frame[m_FrameSize++] = (uint8_t)Scope::GetVariableCount();
+	EndFrame();
+
+	// one frame per channel, the names are too long for a single one
+	for (unsigned i = 0; i < Scope::GetVariableCount(); i++)
+	{
+		const ScopeVariable &Variable = Scope::GetVariable(i);
+		BeginFrame(TelemetryFrame::TABLE);
+		m_Frame[m_FrameSize++] = (uint8_t)i;
+		memcpy(m_Frame + m_FrameSize, &Variable.scale, sizeof(float));
+		m_FrameSize += sizeof(float);
+		PutString(Variable.name);
+		EndFrame();
+	}
+}
+
+// The completion events of the trajectory points, as text lines or event frames
+void Telemetry::DrainTrajectory()
+{
+	TrajectoryEvent Event;
+	while (TrajectoryManager::Instance.PopEvent(m_TrajectoryCursor, Event))
+	{
+		char Message[80];
+		snprintf(Message, sizeof(Message), "point %u %s: %.1f mm, %.1f deg, %lu ms", (unsigned)Event.id,
+			s_TrajectoryStatus[(int)Event.status], Event.distanceError, RAD2DEG(Event.angleError), (unsigned long)Event.durationMs);
+		if (m_Binary)
+		{
+			// a 0 ends the text the main loop printed since the last frames
+			uint8_t Delimiter = 0;
+			Output(&Delimiter, 1);
+			SendEvent(Event.timeUs, TelemetryEvent::TRAJECTORY, Message);
+		}
+		else
+		{
+			char Line[96];
+			int Size = snprintf(Line, sizeof(Line), "%10.1f %s\r\n", Event.timeUs * 1e-3f, Message);
+			Output(Line, Size < (int)sizeof(Line) ? Size : sizeof(Line) - 1);
+		}
+	}
+}
+
+// Out of the samples: the event has its own frame, with an absolute time
+void Telemetry::SendEvent(uint32_t _timeUs, TelemetryEvent _event, const char *_message)
+{
+	if (m_FrameSize)
+		EndFrame();
+	BeginFrame(TelemetryFrame::EVENT);
+	PutVarint((int32_t)_timeUs);
+	m_Frame[m_FrameSize++] = (uint8_t)_event;
+	PutString(_message);
+	EndFrame();
+}
+
+void Telemetry::AddValue(unsigned _channel, float _value)
+{
+	int32_t Value = (int32_t)lroundf(_value * Scope::GetVariable(_channel).scale);
+	if (m_SentChannels & (1ull << _channel))
+	{
+		m_Frame[m_FrameSize++] = (uint8_t)_channel;
+		PutVarint(Value - m_LastValue[_channel]);
+	}
+	else
+	{
+		m_Frame[m_FrameSize++] = (uint8_t)_channel | TELEMETRY_ABSOLUTE;
+		PutVarint(Value);
+		m_SentChannels |= 1ull << _channel;
+	}
+	m_LastValue[_channel] = Value;
+	m_LastChannel = _channel;
+}
+
+void Telemetry::BeginFrame(TelemetryFrame _type)
+{
+	m_FrameSize = 0;
+	m_Frame[m_FrameSize++] = (uint8_t)_type;
+}
+
+void Telemetry::PutVarint(int32_t _value)
+{
+	m_FrameSize += Encoding::EncodeVarint(_value, m_Frame + m_FrameSize);
+}
+
+// Truncated to the frame, 0 terminated
+void Telemetry::PutString(const char *_string)
+{
+	size_t Length = strlen(_string);
+	if (Length > TELEMETRY_MAX_FRAME - m_FrameSize - 2)
+		Length = TELEMETRY_MAX_FRAME - m_FrameSize - 2;
+	memcpy(m_Frame + m_FrameSize, _string, Length);
+	m_FrameSize += Length;
+	m_Frame[m_FrameSize++] = 0;
+}
+
+void Telemetry::EndFrame()
+{
+	m_Frame[m_FrameSize] = Encoding::Crc8(m_Frame, m_FrameSize);
+	m_FrameSize++;
+
+	uint8_t Encoded[TELEMETRY_MAX_FRAME + TELEMETRY_MAX_FRAME / 254 + 2];
+	size_t Size = Encoding::EncodeCobs(m_Frame, m_FrameSize, Encoded);
+	Encoded[Size++] = 0;
+	Output(Encoded, Size);
+	m_FrameSize = 0;
+}
+
+void Telemetry::Output(const void *_data, unsigned _size)
+{
+	if (m_OutputSize + _size > sizeof(m_Output))
+		Flush();
+	memcpy(m_Output + m_OutputSize, _data, _size);
+	m_OutputSize += _size;
+}
+
+void Telemetry::Flush()
+{
+	if (m_OutputSize)
+		Serial.write(m_Output, m_OutputSize);
+	m_OutputSize = 0;
+}
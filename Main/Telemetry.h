@@ -0,0 +1,101 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include "Globals.h"
+#include "SpscRing.h"
+#include "Scope.h"
+
+#define TELEMETRY_RING_SIZE 512		// records: 360 ms of the getControlSystem stream (14 values per position loop)
+#define TELEMETRY_DRAIN_BUFFER 512	// bytes written to Serial at once
+#define TELEMETRY_MAX_FRAME 128		// bytes of a binary frame before the COBS encoding
+#define TELEMETRY_KEY_INTERVAL 50	// binary frames between two key frames
+#define TELEMETRY_EVENT_CHANNEL 0xFF	// channel of the event records, the value is the event
+
+// Events of the control loop, sent as they happen, whatever the scope subscriptions
+enum class TelemetryEvent : uint8_t
+{
+	MOTORS_BLOCKED,	// the motors are shut down, the robot can't move
+	TRAJECTORY,		// a trajectory point completed, from the main loop, see TrajectoryEvent
+	COUNT
+};
+
+// channel: id of a scope variable (Scope.h), or TELEMETRY_EVENT_CHANNEL
+struct TelemetryRecord
+{
+	uint32_t timeUs;
+	float value;
+	uint8_t channel;
+};
+
+// Binary frames: COBS encoded, delimited by 0, the last byte is a CRC-8 of
+// the frame. Values are sent as varints of value * scale of their channel,
+// as changes since the previous value of the channel, or as absolute values
+// when TELEMETRY_ABSOLUTE is set in the channel byte: the first value of each
+// channel after a key frame, so a decoder can resynchronise on any key frame.
+enum class TelemetryFrame : uint8_t
+{
+	TABLE,		// channel count; or channel, scale (float), name (0 terminated)
+	KEY,		// varint time (us), then per value: channel, varint value, all absolute
+	DELTA,		// varint time change since the previous sample, then the values
+	DROPPED,	// varint number of records the ring dropped
+	EVENT,		// varint time (us), event, message (0 terminated)
+};
+#define TELEMETRY_ABSOLUTE 0x80
+
+// Debug output of the control loop: the ISR pushes fixed size binary records
+// into a lock-free ring, the main loop writes them to Serial in bulk, as text
+// or as binary frames (Host/TelemetryDecoder.cpp converts them to CSV).
+// The completion events of the trajectory are read from TrajectoryManager.
+// The channels are the scope variables, the table of the binary stream lists
+// all of them, whatever is subscribed.
+class Telemetry
+{
+public:
+	static HAL_THREAD_LOCAL Telemetry Instance;
+
+	// Control loop
+	void Write(uint8_t _channel, float _value);
+	void WriteEvent(TelemetryEvent _event);
+
+	// Main loop: drain the ring to Serial
+	void Task();
+
+	// The channel table is sent first, and the deltas restart from a key frame
+	void SetBinary(bool _binary);
+	bool IsBinary() const { return m_Binary; }
+
+	uint32_t GetDropped() const { return m_Dropped; }
+
+private:
+	void DrainText();
+	void DrainBinary();
+	void SendTable();
+	void DrainTrajectory();
+	void SendEvent(uint32_t _timeUs, TelemetryEvent _event, const char *_message);
+	void AddValue(unsigned _channel, float _value);
+	void BeginFrame(TelemetryFrame _type);
+	void PutVarint(int32_t _value);
+	void PutString(const char *_string);
+	void EndFrame();
+	void Output(const void *_data, unsigned _size);
+	void Flush();
+
+	SpscRing<TelemetryRecord, TELEMETRY_RING_SIZE> m_Ring;
+	volatile uint32_t m_Dropped = 0;
+	uint32_t m_ReportedDropped = 0;
+	uint32_t m_TrajectoryCursor = 0;	// of the trajectory events
+
+	bool m_Binary = false;
+	uint8_t m_Frame[TELEMETRY_MAX_FRAME];
+	unsigned m_FrameSize = 0;
+	int m_LastChannel = -1;
+	uint32_t m_LastTimeUs = 0;
+	int32_t m_LastValue[SCOPE_MAX_VARIABLES];
+	uint64_t m_SentChannels = 0;	// mask of the channels sent since the last key frame
+	unsigned m_FramesSinceKey = TELEMETRY_KEY_INTERVAL;
+
+	uint8_t m_Output[TELEMETRY_DRAIN_BUFFER];
+	unsigned m_OutputSize = 0;
+};
+
+#endif
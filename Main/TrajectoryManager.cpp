@@ -1,5 +1,7 @@
 #include "PositionManager.h"
 #include "TrajectoryManager.h"
+#include "MotorManager.h"
+#include "Recorder.h"
 
 #if 0
 	#define TRAJ_DEBUG(msg) Serial.println(msg)
@@ -7,17 +9,24 @@
 	#define TRAJ_DEBUG(msg) ((void)0)
 #endif
 
-TrajectoryManager TrajectoryManager::Instance;
+HAL_THREAD_LOCAL TrajectoryManager TrajectoryManager::Instance;
 
 #define ABS(x) (((x) < 0)? -(x): (x))
 #define SQUARE(x) ((x)*(x))
 #define UNDEFINED_ANGLE (1000.f)
 #define IS_UNDEFINED_ANGLE(x) (x==UNDEFINED_ANGLE)
+#define TRAJ_NO_ACC_LIMIT 1e9f // taken for a null acceleration, unlimited in the profiles
 
-float WrapAngle(float a)
+// Acceleration limit of a setpoint, a null one is unlimited as in the profiles
+static float GetAccLimit(float _acc)
 {
-	a += M_PI;
-	return a - floor(a / M_TWOPI) * M_TWOPI - M_PI;
+	return (_acc > 0.f) ? _acc : TRAJ_NO_ACC_LIMIT;
+}
+
+// Speed limit of the distance, as the profile gets it, see ControlSystem::SetDistanceSpeedScale
+static float GetDistanceSpeed(const ControlSetpoint &_setpoint)
+{
+	return _setpoint.distanceMaxSpeed * _setpoint.distanceSpeedScale;
 }
 
 float GetAngleRef(const Float2 &_target, float *_diff = nullptr)
@@ -56,19 +65,39 @@ void TrajectoryManager::Init()
 
 void TrajectoryManager::Reset()
 {
-	ControlSystem::Instance.SetDistanceTarget(PositionManager::Instance.GetDistanceMm());
-	ControlSystem::Instance.SetRadAngleTarget(PositionManager::Instance.GetAngleRad());
+	Recorder::Instance.RecordEvent(RecordType::TRAJ_RESET);
+	ControlSystem::Instance.SetTargets(PositionManager::Instance.GetDistanceMm(), PositionManager::Instance.GetAngleRad());
+	Clear(TrajectoryStatus::CANCELLED);
+}
+
+// Drop every point: the current one completes with _status, the next ones are cancelled
+void TrajectoryManager::Clear(TrajectoryStatus _status)
+{
+	for (unsigned Id = m_Points.GetFront(); Id != TrajQueue::NONE; Id = m_Points.GetNext(Id))
+	{
+		Complete(m_Points[Id], _status);
+		_status = TrajectoryStatus::CANCELLED;
+	}
 	m_Points.Clear();
+	m_LeavingTangentDist = 0.f;
+	m_CurveStarted = false;
+	m_EntrySpeed = 0.f;
 }
 
-void TrajectoryManager::NextPoint()
+void TrajectoryManager::NextPoint(TrajectoryStatus _status)
 {
 	TRAJ_DEBUG("NextPoint");
 	if (!m_Points.IsEmpty()) {
 		const TrajDest& current = m_Points.Front();
+		Complete(current, _status);
 
+		if (IsCurve(current))
+		{
+			PositionManager::Instance.SetTheoreticalPosMm(current.pos);
+			PositionManager::Instance.SetTheoreticalAngleRad(current.angle);
+		}
 		// it's a rotation
-		if (!IS_UNDEFINED_ANGLE(current.angle))
+		else if (!IS_UNDEFINED_ANGLE(current.angle))
 		{
 			PositionManager::Instance.SetTheoreticalAngleRad(current.angle);
 		}
@@ -76,16 +105,45 @@ void TrajectoryManager::NextPoint()
 		{
 			PositionManager::Instance.SetTheoreticalPosMm(current.pos);
 		}
+		m_EntrySpeed = current.plan.endSpeed;
 		m_Points.PopFront();
 	}
+	m_CurveStarted = false;
+	m_FrontStartMs = GetMotionMs();
+}
+
+// Completion event of _point, the points after the front one never started
+void TrajectoryManager::Complete(const TrajDest &_point, TrajectoryStatus _status)
+{
+	TrajectoryEvent Event;
+	Event.id = _point.id;
+	Event.status = _status;
+	Event.distanceError = (_point.plan.endPos - PositionManager::Instance.GetPosMm()).Length();
+	Event.angleError = 0.f;
+	if (IsCurve(_point) || !IS_UNDEFINED_ANGLE(_point.angle))
+		Event.angleError = Math::WrapAngle(_point.plan.endAngle - PositionManager::Instance.GetAngleRad());
+	Event.durationMs = (&_point == &m_Points.Front()) ? GetMotionMs() - m_FrontStartMs : 0;
+	Event.timeUs = micros();
+	Event.forward = _point.movement != BACKWARD;
+	m_Events.Push(Event);
+}
+
+// Time out of the pauses
+uint32_t TrajectoryManager::GetMotionMs()
+{
+	return (m_Pause ? m_PauseStartMs : millis()) - m_PausedMs;
 }
 
 void TrajectoryManager::Print()
 {
 	Serial.printf("Number of points: %d", m_Points.GetSize());
-	m_Points.Apply([](const TrajDest &t){
-		Serial.printf("Dest: mvt:%d, target:(%f, %f), angle:%f", (int)t.movement, t.pos.x, t.pos.y, t.angle);
-	});
+	float Eta = 0.f;
+	for (unsigned Id = m_Points.GetFront(); Id != TrajQueue::NONE; Id = m_Points.GetNext(Id))
+	{
+		const TrajDest &t = m_Points[Id];
+		Eta += (Id == m_Points.GetFront()) ? GetFrontDuration() : GetDuration(Id);
+		Serial.printf("Dest %d: mvt:%d, target:(%f, %f), angle:%f, eta: %.2f s\r\n", (int)t.id, (int)t.movement, t.pos.x, t.pos.y, t.angle, Eta);
+	}
 	Serial.printf("is paused: %d\r\n", (int)m_Pause);
 }
 
@@ -103,7 +161,7 @@ bool TrajectoryManager::IsOnlyRotation()
 	if (!m_Points.IsEmpty())
 	{
 		const TrajDest& next1 = m_Points.Front();
-		if (next1.movement == BACKWARD)
+		if (next1.movement == BACKWARD || IsCurve(next1))
 			return false;
 		// it's a rotation
 		if (!IS_UNDEFINED_ANGLE(next1.angle))
@@ -115,7 +173,7 @@ bool TrajectoryManager::IsOnlyRotation()
 			//TODO duplicate with gototarget
 			Float2 _target = next1.pos;
 			float AngleRef = Math::GetVectorAngle(_target - PositionManager::Instance.GetPosMm());
-			float DiffAngle = WrapAngle(AngleRef - PositionManager::Instance.GetAngleRad());
+			float DiffAngle = Math::WrapAngle(AngleRef - PositionManager::Instance.GetAngleRad());
 			AngleRef = DiffAngle + PositionManager::Instance.GetAngleRad();
 
 			// only apply a rotation if the difference of angle is too important
@@ -137,17 +195,27 @@ bool TrajectoryManager::IsPaused()
 
 void TrajectoryManager::Pause()
 {
+	Recorder::Instance.RecordEvent(RecordType::PAUSE);
+	if (!m_Pause)
+	{
+		m_PauseStartMs = millis();
+		// the quadramps would have to reverse to stop on the current position
+		ControlSystem::Instance.Brake(m_BrakeDistanceAcc, m_BrakeAngleAcc);
+	}
 	m_Pause = true;
-	m_PauseDist = PositionManager::Instance.GetDistanceMm();
-	m_pauseAngle = PositionManager::Instance.GetAngleRad();
 }
 
 void TrajectoryManager::Resume()
 {
+	if (m_Pause)
+	{
+		Recorder::Instance.RecordEvent(RecordType::RESUME);
+		m_PausedMs += millis() - m_PauseStartMs;
+	}
 	m_Pause = false;
 }
 
-void TrajectoryManager::GotoXY(const Float2 &_pos_mm)
+bool TrajectoryManager::GotoXY(const Float2 &_pos_mm)
 {
 	// if it's the first point, we turn the robot face to the next point
 	if (TrajectoryManager::IsEnded()) {
@@ -161,31 +229,48 @@ void TrajectoryManager::GotoXY(const Float2 &_pos_mm)
 	dest.angle = UNDEFINED_ANGLE;
 	dest.movement = COMMON;
 
-	AddPoint(dest, END);
+	return AddPoint(dest, END);
+}
+
+bool TrajectoryManager::GetCurrentTarget(Float2 &_pos_mm)
+{
+	if (m_Points.IsEmpty() || !IsPathPoint(m_Points.Front()))
+		return false;
+	_pos_mm = m_Points.Front().pos;
+	return true;
+}
+
+bool TrajectoryManager::InsertXY(const Float2 *_pos_mm, unsigned _count)
+{
+	if (m_Points.GetFreeSize() < _count)
+	{
+		Serial.printf("[TrajectoryManager] Warning: List of points is full. Detour not inserted.\n");
+		return false;
+	}
+
+	// each point is inserted before the previous one
+	for (unsigned i = _count; i-- > 0; )
+	{
+		TrajDest dest;
+		dest.pos = _pos_mm[i];
+		dest.angle = UNDEFINED_ANGLE;
+		dest.movement = COMMON;
+		AddPoint(dest, NOW);
+	}
+	return true;
 }
 
-void TrajectoryManager::GotoDistance(float _dist) {
+bool TrajectoryManager::GotoDistance(float _dist) {
 
-	float finalAngle = PositionManager::Instance.GetTheoreticalAngleRad();
-	Float2 finalPos = PositionManager::Instance.GetTheoreticalPosMm();
+	float finalAngle;
+	Float2 finalPos;
 
 	Serial.print("goto d\r\n");
 	Serial.printf("Robot pos mm:    %f, %f\r\n", PositionManager::Instance.GetXMm(), PositionManager::Instance.GetYMm());
 	Serial.printf("theoretical pos: %f, %f\r\n", PositionManager::Instance.GetTheoreticalPosMm().x, PositionManager::Instance.GetTheoreticalPosMm().y);
 
-	auto fct = [&](const TrajDest &t) {
-		// it's a rotation
-		if (!IS_UNDEFINED_ANGLE(t.angle))
-		{
-			finalAngle = t.angle;
-		}
-		else
-		{
-			finalPos = t.pos;
-		}
-	};
 	// find the position & angle at the end
-	m_Points.Apply(fct);
+	GetEndPose(finalPos, finalAngle);
 
 	//Float2 v (d * cos(angle), -d * sin(angle));
 	Float2 v(-_dist * sin(finalAngle), _dist * cos(finalAngle));
@@ -200,17 +285,17 @@ void TrajectoryManager::GotoDistance(float _dist) {
 	else
 		dest.movement = BACKWARD;
 
-	AddPoint(dest, END);
+	return AddPoint(dest, END);
 }
 
-void TrajectoryManager::GotoDegreeAngle(float a) {
+bool TrajectoryManager::GotoDegreeAngle(float a) {
 	// convert to radian
 	a = DEG2RAD(a);
 
-	GotoRadianAngle(a);
+	return GotoRadianAngle(a);
 }
 
-void TrajectoryManager::GotoRadianAngle(float a)
+bool TrajectoryManager::GotoRadianAngle(float a)
 {
 	TrajDest dest;
 	Serial.printf("GotoRadianAngle: %f", a);
@@ -218,19 +303,49 @@ void TrajectoryManager::GotoRadianAngle(float a)
 	dest.angle = a;
 	dest.movement = COMMON;
 
-	AddPoint(dest, END);
+	return AddPoint(dest, END);
 }
 
-void TrajectoryManager::GotoCircular(const Float2 &_center, float _angle)
+bool TrajectoryManager::GotoCircular(const Float2 &_center, float _angle)
 {
-	Float2 finalPos = PositionManager::Instance.GetTheoreticalPosMm();//TODO get final position like gotoDistance
-
 	TrajDest dest;
-	dest.pos = _center;
-	dest.angle = Math::GetVectorAngle(finalPos -_center) + _angle;
-	dest.radius = (finalPos - _center).Length();
+	dest.curve[0] = _center.x;
+	dest.curve[1] = _center.y;
+	dest.curve[2] = _angle;
 	dest.movement = CIRCULAR;
-	AddPoint(dest, END);
+	return AddCurve(dest);
+}
+
+bool TrajectoryManager::GotoBezier(const Float2 &_control1, const Float2 &_control2, const Float2 &_pos_mm)
+{
+	TrajDest dest;
+	dest.pos = _pos_mm;
+	dest.curve[0] = _control1.x;
+	dest.curve[1] = _control1.y;
+	dest.curve[2] = _control2.x;
+	dest.curve[3] = _control2.y;
+	dest.movement = BEZIER;
+	return AddCurve(dest);
+}
+
+bool TrajectoryManager::GotoBezier(const Float2 &_pos_mm, float _angle, float _startDist, float _endDist)
+{
+	Float2 StartPos;
+	float StartAngle;
+	GetEndPose(StartPos, StartAngle);
+	Float2 StartDir(-sinf(StartAngle), cosf(StartAngle));
+	Float2 EndDir(-sinf(_angle), cosf(_angle));
+	return GotoBezier(StartPos + StartDir * _startDist, _pos_mm - EndDir * _endDist, _pos_mm);
+}
+
+bool TrajectoryManager::GotoClothoid(float _length, float _startCurvature, float _endCurvature)
+{
+	TrajDest dest;
+	dest.curve[0] = _length;
+	dest.curve[1] = _startCurvature;
+	dest.curve[2] = _endCurvature;
+	dest.movement = CLOTHOID;
+	return AddCurve(dest);
 }
 
 
@@ -238,30 +353,109 @@ void TrajectoryManager::GotoCircular(const Float2 &_center, float _angle)
 
 void TrajectoryManager::Task()
 {
+	Recorder::Instance.RecordTaskBegin();
 	Update();
+	Recorder::Instance.RecordTaskEnd();
+
+	// the points the listener queues start right away, in a task of their own for the replay
+	if (NotifyListener())
+	{
+		Recorder::Instance.RecordTaskBegin();
+		Update();
+		Recorder::Instance.RecordTaskEnd();
+	}
 }
 
-void TrajectoryManager::AddPoint(TrajDest point, TrajWhen when)
+// Events since the last notification: true if the listener queued points
+bool TrajectoryManager::NotifyListener()
 {
+	if (!m_Listener)
+		return false;
+	uint16_t NextId = m_NextId;
+	TrajectoryEvent Event;
+	while (m_Events.Pop(m_ListenerCursor, Event))
+		m_Listener(Event);
+	return m_NextId != NextId;
+}
 
-	if (when == END) {
-		if (TrajIsFull()) {
-			Serial.printf("[TrajectoryManager] Warning: List of points is full. Last point not added.\n");
-			return;
-		}
+void TrajectoryManager::ReplayPoint(const Float2 &_pos, float _angle, const float *_curve, uint8_t _movement, bool _now)
+{
+	TrajDest dest;
+	dest.pos = _pos;
+	dest.angle = _angle;
+	memcpy(dest.curve, _curve, sizeof(dest.curve));
+	dest.movement = (OrderType)_movement;
+	AddPoint(dest, _now ? NOW : END);
+}
 
-		/* New points are added at the end of the list */
-		m_Points.PushBack(point);
+// The end of a curve is computed once, from the end of the trajectory
+bool TrajectoryManager::AddCurve(TrajDest &_dest)
+{
+	Float2 StartPos;
+	float StartAngle;
+	GetEndPose(StartPos, StartAngle);
+	CurveWalker Curve;
+	InitCurve(_dest, StartPos, StartAngle, Curve);
+	Curve.GetEnd(StartAngle, _dest.pos, _dest.angle);
+	return AddPoint(_dest, END);
+}
+
+void TrajectoryManager::GetEndPose(Float2 &_pos, float &_angle)
+{
+	if (m_Points.IsEmpty())
+	{
+		_pos = PositionManager::Instance.GetTheoreticalPosMm();
+		_angle = PositionManager::Instance.GetTheoreticalAngleRad();
+	}
+	else
+	{
+		_pos = m_Points.Back().plan.endPos;
+		_angle = m_Points.Back().plan.endAngle;
+	}
+}
+
+void TrajectoryManager::AdvancePose(const TrajDest &_dest, Float2 &_pos, float &_angle)
+{
+	if (IsCurve(_dest))
+	{
+		_pos = _dest.pos;
+		_angle = _dest.angle;
+	}
+	// it's a rotation
+	else if (!IS_UNDEFINED_ANGLE(_dest.angle))
+	{
+		_angle = _dest.angle;
+	}
+	else
+	{
+		_pos = _dest.pos;
+	}
+}
+
+bool TrajectoryManager::AddPoint(TrajDest point, TrajWhen when)
+{
+	Recorder::Instance.RecordPoint(point.pos, point.angle, point.curve, (uint8_t)point.movement, when == NOW);
+
+	if (TrajIsFull()) {
+		Serial.printf("[TrajectoryManager] Warning: List of points is full. Point not added.\n");
+		return false;
 	}
-	else if (when == NOW) {
-		if (TrajIsFull()) {
-			m_Points.PopBack();
-			Serial.printf("[TrajectoryManager] Warning: List of points is full. Last point was removed.\n");
-		}
 
+	if (m_Points.IsEmpty() || when == NOW)
+		m_FrontStartMs = GetMotionMs();
+	point.id = m_NextId++;
+
+	unsigned id;
+	if (when == END) {
+		/* New points are added at the end of the list */
+		id = m_Points.PushBack(point);
+	}
+	else {
 		/* Insert a point before the current one */
-		m_Points.PushFront(point);
+		id = m_Points.PushFront(point);
 	}
+	Plan(id);
+	return true;
 }
 
 
@@ -271,15 +465,38 @@ void TrajectoryManager::Update()
 	//Serial.printf("only rot %d", (int)m_IsOnlyRotation);
 	m_IsOnlyRotation = false;
 
+	// the points were planned with other limits
+	const ControlSetpoint &Setpoint = ControlSystem::Instance.GetSetpoint();
+	if (GetDistanceSpeed(Setpoint) != m_PlanDistanceSpeed || Setpoint.distanceMaxAcc != m_PlanDistanceAcc
+		|| Setpoint.angleMaxSpeed != m_PlanAngleSpeed || Setpoint.angleMaxAcc != m_PlanAngleAcc)
+	{
+		m_PlanDistanceSpeed = GetDistanceSpeed(Setpoint);
+		m_PlanDistanceAcc = Setpoint.distanceMaxAcc;
+		m_PlanAngleSpeed = Setpoint.angleMaxSpeed;
+		m_PlanAngleAcc = Setpoint.angleMaxAcc;
+		PlanAll();
+	}
+
 	/* Nothing to do if there is no point in the list */
 	if (m_Points.IsEmpty()) {
 		return;
 	}
 
+	// the motors were shut down, the robot won't reach the points
+	if (!MotorManager::Instance.Enabled)
+	{
+		Clear(TrajectoryStatus::BLOCKED);
+		return;
+	}
+
+	// the control system holds the stop of the brake
 	if (m_Pause)
+		return;
+
+	if (m_SegmentTimeoutMs && GetMotionMs() - m_FrontStartMs > m_SegmentTimeoutMs)
 	{
-		ControlSystem::Instance.SetDistanceTarget(m_PauseDist);
-		ControlSystem::Instance.SetRadAngleTarget(m_pauseAngle);
+		TRAJ_DEBUG("Timeout");
+		NextPoint(TrajectoryStatus::TIMEOUT);
 		return;
 	}
 
@@ -289,27 +506,12 @@ void TrajectoryManager::Update()
 	// position the robot want to reach
 	Float2 target;
 
-	if (next1.movement == CIRCULAR)
-	{
-		Float2 RC = PositionManager::Instance.GetPosMm() - next1.pos;//pos - center
-		Float2 Normal(-RC.y, RC.x);//trigonometric angle
-		float NormalAngle = Math::GetVectorAngle(Normal);
-		float RadiusDiff = next1.radius - RC.Length();
-		ControlSystem::Instance.SetRadAngleTarget(Math::Lerp(PositionManager::Instance.GetAngleRad(), NormalAngle, 0.02f) /*- 0.005f * RadiusDiff*/, false);
-		
-		float RemainingDist = next1.radius * (next1.angle - Math::GetVectorAngle(RC));
-
-		if (ABS(RemainingDist) < SMOOTH_TRAJ_DEFAULT_PRECISION_D_MM) {
-			NextPoint();
-		}
+	if (next1.movement != COMMON || !IS_UNDEFINED_ANGLE(next1.angle))
+		m_LeavingTangentDist = 0.f;
 
-		//if (ABS(WrapAngle(NormalAngle - PositionManager::Instance.GetAngleRad())) < DEG2RAD(10))
-			//RemainingDist = 0;
-		
-		ControlSystem::Instance.SetDistanceTarget(PositionManager::Instance.GetDistanceMm() + RemainingDist);
-		Serial.printf("%f   %f\r\n", RC.Length(), RemainingDist);
-
-		
+	if (IsCurve(next1))
+	{
+		FollowCurve();
 	}
 	// it's a rotation
 	else if (!IS_UNDEFINED_ANGLE(next1.angle))
@@ -322,71 +524,646 @@ void TrajectoryManager::Update()
 		m_IsOnlyRotation = true;
 		ControlSystem::Instance.SetRadAngleTarget(next1.angle);
 	}
+	else if (m_TrackingMode == PURE_PURSUIT)
+	{
+		Pursue();
+	}
 	else
 	{
-#ifdef TRAJ_STEERING
-		uint32_t next_id = (m_CurId + 1) % SMOOTH_TRAJ_MAX_NB_POINTS;
-
-		// at least two waypoints
-		if (next_id != m_LastId)
-		{
-			TRAJ_DEBUG("At least two waypoints");
-			// find the second waypoint
-			TrajDest* next2 = m_Points + next_id;
+		target = next1.pos;
+		bool Blending = false;
 
-			float d = SMOOTH_TRAJ_STEER_DISTANCE_MM;
-			d -= next1_dist;
+		// the distance setpoint goes on after the waypoint by the braking distance
+		// from its planned speed, the quadramp only slows down to it
+		float RemainingDist = next1_dist + 0.5f * SQUARE(next1.plan.endSpeed) / GetAccLimit(ControlSystem::Instance.GetSetpoint().distanceMaxAcc);
 
-			if (d > 0.f)
+		Float2 OutDir;
+		float TangentDist;
+		if (GetCornerBlend(next1, OutDir, TangentDist))
+		{
+			if (next1_dist < TangentDist)
 			{
-				float direction_x = next2->x - next1->x;
-				float direction_y = next2->y - next1->y;
-				float direction_length = sqrt(SQUARE(direction_x) + SQUARE(direction_y));
-				direction_x = direction_x / direction_length * d;
-				direction_y = direction_y / direction_length * d;
-
-				target_x = next1->x + direction_x;
-				target_y = next1->y + direction_y;
-
-				if (d > 0.5f * SMOOTH_TRAJ_STEER_DISTANCE_MM)
+				TRAJ_DEBUG("Blend corner");
+				// steer toward a point sliding along the next segment
+				target = next1.pos + OutDir * (TangentDist - next1_dist);
+				Blending = true;
+				if (next1_dist < 0.5f * TangentDist)
 				{
 					NextPoint();
+					m_LeavingTangentDist = TangentDist;
 				}
 			}
-			else // the next waypoint is too far, so it's our target
+		}
+		// Waypoint reachs
+		else if (next1_dist < SMOOTH_TRAJ_DEFAULT_PRECISION_D_MM)
+		{
+			TRAJ_DEBUG("one more waypoint");
+			NextPoint();
+		}
+
+		// after a blended corner, the target slides along the new segment until the robot is on it
+		if (!Blending && m_LeavingTangentDist > 0.f)
+		{
+			Float2 Start = PositionManager::Instance.GetTheoreticalPosMm();
+			Float2 Segment = next1.pos - Start;
+			Float2 Dir = Segment.Normalized();
+			float Along = (PositionManager::Instance.GetPosMm() - Start).DotProduct(Dir);
+			if (Along < m_LeavingTangentDist && Along + m_LeavingTangentDist < Segment.Length())
 			{
-				target_x = next1->x;
-				target_y = next1->y;
+				target = Start + Dir * (Along + m_LeavingTangentDist);
+				Blending = true;
 			}
+			else
+				m_LeavingTangentDist = 0.f;
+		}
 
-			// if the robot go away the current waypoint, we switch to the next
-			/*if (next1_dist > m_PreviousWaypointDist + 35.f)
-			{
-				Serial.printf("next1 dist %f, prev waypoint dist %f\r\n", next1_dist, m_PreviousWaypointDist);
-				NextPoint();
-			}*/
+		//Serial.printf("pos: %f, %f  target: %f, %f\r\n", PositionManager::Instance.GetXMm(), PositionManager::Instance.GetYMm(), target_x, target_y);
+		GotoTarget(next1, target, RemainingDist, Blending);
+	}
+}
+
+// Corner at _next1, between the segment from the last waypoint and the one to
+// the waypoint after it: false if the robot has to stop there. The robot turns
+// from _tangentDist before the corner, at the speed planned for the corner.
+bool TrajectoryManager::GetCornerBlend(const TrajDest &_next1, Float2 &_outDir, float &_tangentDist)
+{
+	if (_next1.plan.blendLength <= 0.f)
+		return false;
+	_tangentDist = _next1.plan.blendTangent;
+	_outDir = (m_Points[GetSecondId()].pos - _next1.pos).Normalized();
+	return true;
+}
+
+// Arc tangent to both segments of a corner, its middle m_CornerTolerance from
+// the corner: distance from the corner to the tangent points
+float TrajectoryManager::GetCornerTangent(float _turn, float _inLength, float _outLength)
+{
+	float Tangent = SMOOTH_TRAJ_STEER_DISTANCE_MM;
+	if (_turn > 0.001f)
+		Tangent = min(Tangent, m_CornerTolerance / tanf(0.25f * _turn));
+	return min(Tangent, 0.5f * min(_inLength, _outLength));
+}
+
+// Speed limited by the angular speed and the lateral acceleration on a path of _curvature
+float TrajectoryManager::GetCurvatureSpeed(float _curvature)
+{
+	const ControlSetpoint &Setpoint = ControlSystem::Instance.GetSetpoint();
+	float Speed = GetDistanceSpeed(Setpoint);
+	_curvature = ABS(_curvature);
+	if (_curvature > 1e-6f)
+	{
+		Speed = min(Speed, Setpoint.angleMaxSpeed / _curvature);
+		Speed = min(Speed, sqrtf(GetAccLimit(Setpoint.distanceMaxAcc) / _curvature));
+	}
+	return Speed;
+}
+
+// Look-ahead over the queue, as CNC planners do. The geometry of each point
+// gives the fastest speeds at its ends and at the junction with the next one;
+// a backward pass from the stop at the end brakes before the slow junctions,
+// a forward pass keeps the speeds reachable from m_EntrySpeed. The robot then
+// only slows down where the geometry or a stop requires it.
+// After _id is inserted, only its neighbours are planned again, and the
+// passes stop where the speeds no longer change: pushing a point or
+// splicing a detour costs constant time.
+void TrajectoryManager::Plan(unsigned _id)
+{
+	// the start of the next points changed, until the one their end pose doesn't depend on
+	unsigned Last = _id;
+	PlanSegment(_id);
+	for (unsigned Id = m_Points.GetNext(_id); Id != TrajQueue::NONE; Id = m_Points.GetNext(Id))
+	{
+		Last = Id;
+		if (!PlanSegment(Id))
+			break;
+	}
+
+	// the corners around them, and the junctions depending on these corners
+	unsigned First = _id;
+	for (int i = 0; i < 2 && m_Points.GetPrev(First) != TrajQueue::NONE; i++)
+		First = m_Points.GetPrev(First);
+	if (m_Points.GetNext(Last) != TrajQueue::NONE)
+		Last = m_Points.GetNext(Last);
+	unsigned End = m_Points.GetNext(Last);
+	for (unsigned Id = First; Id != End; Id = m_Points.GetNext(Id))
+		PlanCorner(Id);
+	for (unsigned Id = First; Id != End; Id = m_Points.GetNext(Id))
+	{
+		unsigned Next = m_Points.GetNext(Id);
+		TrajDest &Dest = m_Points[Id];
+		Dest.plan.junctionLimit = 0.f;
+		if (Next != TrajQueue::NONE)
+			Dest.plan.junctionLimit = min(GetJunctionSpeed(Id), min(Dest.plan.exitLimit, m_Points[Next].plan.entryLimit));
+	}
+
+	PlanSpeeds(First, Last);
+}
+
+// Every point, after the settings changed
+void TrajectoryManager::PlanAll()
+{
+	if (m_Points.IsEmpty())
+		return;
+	for (unsigned Id = m_Points.GetFront(); Id != TrajQueue::NONE; Id = m_Points.GetNext(Id))
+		PlanSegment(Id);
+	for (unsigned Id = m_Points.GetFront(); Id != TrajQueue::NONE; Id = m_Points.GetNext(Id))
+		PlanCorner(Id);
+	for (unsigned Id = m_Points.GetFront(); Id != TrajQueue::NONE; Id = m_Points.GetNext(Id))
+	{
+		unsigned Next = m_Points.GetNext(Id);
+		TrajDest &Dest = m_Points[Id];
+		Dest.plan.junctionLimit = 0.f;
+		if (Next != TrajQueue::NONE)
+			Dest.plan.junctionLimit = min(GetJunctionSpeed(Id), min(Dest.plan.exitLimit, m_Points[Next].plan.entryLimit));
+	}
+	PlanSpeeds(m_Points.GetFront(), m_Points.GetBack());
+}
 
+// Backward and forward passes, the junction limits from _first to _last changed
+void TrajectoryManager::PlanSpeeds(unsigned _first, unsigned _last)
+{
+	float Acc = GetAccLimit(ControlSystem::Instance.GetSetpoint().distanceMaxAcc);
+
+	// backward pass, from the unchanged speed after _last
+	unsigned Next = m_Points.GetNext(_last);
+	float Reachable = 0.f;
+	if (Next != TrajQueue::NONE)
+		Reachable = sqrtf(SQUARE(m_Points[Next].plan.maxEndSpeed) + 2.f * Acc * m_Points[Next].plan.length);
+	unsigned Start = _last;
+	bool Changed = true;
+	for (unsigned Id = _last; Id != TrajQueue::NONE; Id = m_Points.GetPrev(Id))
+	{
+		TrajDest &Dest = m_Points[Id];
+		float Speed = min(Dest.plan.junctionLimit, Reachable);
+		if (!Changed && Speed == Dest.plan.maxEndSpeed)
+			break;
+		Dest.plan.maxEndSpeed = Speed;
+		Reachable = sqrtf(SQUARE(Speed) + 2.f * Acc * Dest.plan.length);
+		Start = Id;
+		if (Id == _first)
+			Changed = false;
+	}
+
+	// forward pass, from the unchanged speed before
+	unsigned Prev = m_Points.GetPrev(Start);
+	float Speed = (Prev != TrajQueue::NONE) ? m_Points[Prev].plan.endSpeed : m_EntrySpeed;
+	Changed = true;
+	for (unsigned Id = Start; Id != TrajQueue::NONE; Id = m_Points.GetNext(Id))
+	{
+		TrajDest &Dest = m_Points[Id];
+		Speed = min(Dest.plan.maxEndSpeed, sqrtf(SQUARE(Speed) + 2.f * Acc * Dest.plan.length));
+		if (!Changed && Speed == Dest.plan.endSpeed)
+			break;
+		Dest.plan.endSpeed = Speed;
+		if (Id == _last)
+			Changed = false;
+	}
+}
+
+// Length, headings, speed limits and end pose of the point _id alone, from
+// the end of the previous one: false if its end pose didn't change
+bool TrajectoryManager::PlanSegment(unsigned _id)
+{
+	TrajDest &Dest = m_Points[_id];
+	Float2 Start = PositionManager::Instance.GetTheoreticalPosMm();
+	float StartAngle = PositionManager::Instance.GetTheoreticalAngleRad();
+	unsigned Prev = m_Points.GetPrev(_id);
+	float PrevHeading = StartAngle;
+	if (Prev != TrajQueue::NONE)
+	{
+		Start = m_Points[Prev].plan.endPos;
+		StartAngle = m_Points[Prev].plan.endAngle;
+		PrevHeading = m_Points[Prev].plan.endHeading;
+	}
+
+	float MaxSpeed = GetDistanceSpeed(ControlSystem::Instance.GetSetpoint());
+	Dest.plan.speedLimit = MaxSpeed;
+	if (IsCurve(Dest))
+	{
+		CurveWalker Curve;
+		InitCurve(Dest, Start, StartAngle, Curve);
+		float Length = Curve.GetLength();
+		Dest.plan.length = Length;
+		Dest.plan.startHeading = Curve.GetAngle();
+		Dest.plan.endHeading = Dest.angle;
+		Dest.plan.turn = ABS(Math::WrapAngle(Dest.plan.startHeading - PrevHeading));
+
+		// slow enough at the ends to brake before the tightest parts of the curve
+		float Acc = GetAccLimit(ControlSystem::Instance.GetSetpoint().distanceMaxAcc);
+		Dest.plan.entryLimit = Dest.plan.exitLimit = MaxSpeed;
+		while (true)
+		{
+			float S = Curve.GetDistance();
+			float CurvatureSpeed = GetCurvatureSpeed(Curve.GetCurvature());
+			float Speed = SQUARE(CurvatureSpeed);
+			Dest.plan.speedLimit = min(Dest.plan.speedLimit, CurvatureSpeed);
+			Dest.plan.entryLimit = min(Dest.plan.entryLimit, sqrtf(Speed + 2.f * Acc * S));
+			Dest.plan.exitLimit = min(Dest.plan.exitLimit, sqrtf(Speed + 2.f * Acc * (Length - S)));
+			if (S >= Length)
+				break;
+			Curve.Advance(min(SMOOTH_TRAJ_PLAN_STEP_MM, Length - S));
+		}
+	}
+	// it's a rotation
+	else if (!IS_UNDEFINED_ANGLE(Dest.angle))
+	{
+		Dest.plan.length = 0.f;
+		Dest.plan.startHeading = Dest.plan.endHeading = Dest.angle;
+		Dest.plan.turn = ABS(Dest.angle - StartAngle);
+		Dest.plan.entryLimit = Dest.plan.exitLimit = 0.f;
+	}
+	else
+	{
+		Float2 Segment = Dest.pos - Start;
+		Dest.plan.length = Segment.Length();
+		Dest.plan.entryLimit = Dest.plan.exitLimit = MaxSpeed;
+		// straight moves keep the heading of the robot
+		if (Dest.movement != COMMON)
+		{
+			Dest.plan.startHeading = Dest.plan.endHeading = StartAngle;
+			Dest.plan.turn = 0.f;
 		}
-		// only one more waypoint
 		else
-#endif
 		{
-			TRAJ_DEBUG("one more waypoint");
-			target = next1.pos;
+			Dest.plan.startHeading = Dest.plan.endHeading = (Dest.plan.length > 1e-3f) ? Math::GetVectorAngle(Segment) : StartAngle;
+			Dest.plan.turn = ABS(Math::WrapAngle(Dest.plan.startHeading - PrevHeading));
+		}
+	}
+
+	Float2 EndPos = Start;
+	float EndAngle = StartAngle;
+	AdvancePose(Dest, EndPos, EndAngle);
+	bool Changed = EndPos.x != Dest.plan.endPos.x || EndPos.y != Dest.plan.endPos.y || EndAngle != Dest.plan.endAngle;
+	Dest.plan.endPos = EndPos;
+	Dest.plan.endAngle = EndAngle;
+	return Changed;
+}
+
+// Arc rounding the corner between the point _id and the next waypoint, see GotoTarget
+void TrajectoryManager::PlanCorner(unsigned _id)
+{
+	TrajDest &Dest = m_Points[_id];
+	Dest.plan.blendTangent = Dest.plan.blendCurvature = Dest.plan.blendLength = 0.f;
+	unsigned Next = m_Points.GetNext(_id);
+	if (m_TrackingMode != WAYPOINTS || m_CornerTolerance <= 0.f || Next == TrajQueue::NONE)
+		return;
+	const TrajDest &To = m_Points[Next];
+	if (!IsPathPoint(Dest) || !IsPathPoint(To) || Dest.plan.length < 1.f || To.plan.length < 1.f)
+		return;
+	float Turn = Math::WrapAngle(To.plan.startHeading - Dest.plan.endHeading);
+	float AbsTurn = ABS(Turn);
+	if (AbsTurn > SMOOTH_TRAJ_MAX_BLEND_ANGLE_RAD)
+		return;
+
+	float Tangent = GetCornerTangent(AbsTurn, Dest.plan.length, To.plan.length);
+	Dest.plan.blendTangent = Tangent;
+	Dest.plan.blendCurvature = tanf(0.5f * Turn) / Tangent;
+	Dest.plan.blendLength = (AbsTurn > 0.001f) ? AbsTurn * Tangent / tanf(0.5f * AbsTurn) : 2.f * Tangent;
+}
+
+// Fastest speed from the point _id to the next one without stopping, 0 if the robot stops there
+float TrajectoryManager::GetJunctionSpeed(unsigned _id)
+{
+	const TrajDest &From = m_Points[_id];
+	const TrajDest &To = m_Points[m_Points.GetNext(_id)];
+	if (!(IsPathPoint(From) || IsCurve(From)) || !(IsPathPoint(To) || IsCurve(To)))
+		return 0.f;
+
+	// blended corner of consecutive waypoints: the angle loop builds up the
+	// turn rate of the arc along a quarter of it, from the one of the previous
+	// arc when they touch, and back to the one of the next
+	if (IsPathPoint(From) && IsPathPoint(To) && m_TrackingMode == WAYPOINTS)
+	{
+		if (From.plan.blendLength <= 0.f)
+			return 0.f;
+		float Curvature = From.plan.blendCurvature;
+		float Before = 0.f, After = 0.f;
+		unsigned Prev = m_Points.GetPrev(_id);
+		if (Prev != TrajQueue::NONE)
+		{
+			const TrajDest &Previous = m_Points[Prev];
+			if (Previous.plan.blendLength > 0.f && Previous.plan.blendTangent + From.plan.blendTangent >= From.plan.length - 1.f)
+				Before = Previous.plan.blendCurvature;
+		}
+		if (To.plan.blendLength > 0.f && From.plan.blendTangent + To.plan.blendTangent >= To.plan.length - 1.f)
+			After = To.plan.blendCurvature;
+		float Change = max(ABS(Curvature - Before), ABS(Curvature - After));
+		float Speed = GetCurvatureSpeed(Curvature);
+		if (Change > 1e-6f)
+			Speed = min(Speed, sqrtf(0.25f * GetAccLimit(ControlSystem::Instance.GetSetpoint().angleMaxAcc) * From.plan.blendLength / Change));
+		return Speed;
+	}
+
+	float Turn = ABS(Math::WrapAngle(To.plan.startHeading - From.plan.endHeading));
+
+	// pure pursuit rounds the corners over up to the lookahead, it limits the
+	// speed to the angular dynamics itself: only the curvature of the arc counts
+	if ((IsCurve(From) || IsCurve(To)) && Turn > PURSUIT_MAX_HEADING_ERROR_RAD)
+		return 0.f;
+	float Tangent = min(PURSUIT_MAX_LOOKAHEAD_MM, 0.5f * min(From.plan.length, To.plan.length));
+	if (Tangent < 1.f)
+		return 0.f;
+	return GetCurvatureSpeed(tanf(0.5f * Turn) / Tangent);
+}
+
+// Time to cover _dist from _startSpeed to _endSpeed with a trapezoidal
+// profile, the speed at most _maxSpeed and the acceleration _acc
+static float GetProfileTime(float _dist, float _startSpeed, float _endSpeed, float _maxSpeed, float _acc)
+{
+	if (_dist <= 0.f)
+		return 0.f;
+	_acc = GetAccLimit(_acc);
+	float Peak = min(_maxSpeed, sqrtf(_acc * _dist + 0.5f * (SQUARE(_startSpeed) + SQUARE(_endSpeed))));
+	Peak = max(Peak, max(_startSpeed, _endSpeed));
+	if (Peak < 1e-3f)
+		return 0.f;
+	float Cruise = _dist - (2.f * SQUARE(Peak) - SQUARE(_startSpeed) - SQUARE(_endSpeed)) / (2.f * _acc);
+	return (2.f * Peak - _startSpeed - _endSpeed) / _acc + max(Cruise, 0.f) / Peak;
+}
+
+float TrajectoryManager::GetPointEta(uint16_t _id)
+{
+	for (unsigned Id = m_Points.GetFront(); Id != TrajQueue::NONE; Id = m_Points.GetNext(Id))
+	{
+		if (m_Points[Id].id == _id)
+			return GetEta(Id);
+	}
+	return -1.f;
+}
+
+// Time until the point _last completes, the whole trajectory if NONE
+float TrajectoryManager::GetEta(unsigned _last)
+{
+	if (m_Points.IsEmpty())
+		return 0.f;
+	unsigned Id = m_Points.GetFront();
+	float Time = GetFrontDuration();
+	while (Id != _last && (Id = m_Points.GetNext(Id)) != TrajQueue::NONE)
+		Time += GetDuration(Id);
+	return Time;
+}
+
+// Duration of the point _id from its start, at the planned speeds
+float TrajectoryManager::GetDuration(unsigned _id)
+{
+	const TrajDest &Dest = m_Points[_id];
+	const ControlSetpoint &Setpoint = ControlSystem::Instance.GetSetpoint();
+	unsigned Prev = m_Points.GetPrev(_id);
+	float EntrySpeed = (Prev != TrajQueue::NONE) ? m_Points[Prev].plan.endSpeed : m_EntrySpeed;
+	float Time = GetProfileTime(Dest.plan.length, EntrySpeed, Dest.plan.endSpeed, Dest.plan.speedLimit, Setpoint.distanceMaxAcc);
+
+	// the robot turns in place after a stop, the small turns are done while moving, see GotoTarget
+	bool Rotation = !IsCurve(Dest) && !IS_UNDEFINED_ANGLE(Dest.angle);
+	if (Rotation || (EntrySpeed <= 0.f && Dest.plan.turn > 0.5f))
+		Time += GetProfileTime(Dest.plan.turn, 0.f, 0.f, Setpoint.angleMaxSpeed, Setpoint.angleMaxAcc);
+	return Time;
+}
+
+// Time left on the front point, from the pose and the speeds of the robot
+float TrajectoryManager::GetFrontDuration()
+{
+	const TrajDest &Dest = m_Points.Front();
+	const ControlSetpoint &Setpoint = ControlSystem::Instance.GetSetpoint();
+	float Speed = ABS(ControlSystem::Instance.GetDistanceProfile().GetVelocity());
+	float AngleSpeed = ABS(ControlSystem::Instance.GetAngleProfile().GetVelocity());
+	float Angle = PositionManager::Instance.GetAngleRad();
+
+	// it's a rotation
+	if (!IsCurve(Dest) && !IS_UNDEFINED_ANGLE(Dest.angle))
+		return GetProfileTime(ABS(Dest.angle - Angle), AngleSpeed, 0.f, Setpoint.angleMaxSpeed, Setpoint.angleMaxAcc);
+
+	float Time = 0.f;
+	float Remaining;
+	if (IsCurve(Dest))
+		Remaining = m_CurveStarted ? m_Curve.GetLength() - m_Curve.GetDistance() : Dest.plan.length;
+	else
+	{
+		Float2 ToEnd = Dest.pos - PositionManager::Instance.GetPosMm();
+		Remaining = ToEnd.Length();
+		// turn toward the waypoint first
+		float Turn = ABS(Math::WrapAngle(Math::GetVectorAngle(ToEnd) - Angle));
+		if (Dest.movement == COMMON && Remaining > SMOOTH_TRAJ_DEFAULT_PRECISION_D_MM && Turn > 0.5f)
+			Time += GetProfileTime(Turn, AngleSpeed, 0.f, Setpoint.angleMaxSpeed, Setpoint.angleMaxAcc);
+	}
+	return Time + GetProfileTime(Remaining, Speed, Dest.plan.endSpeed, Dest.plan.speedLimit, Setpoint.distanceMaxAcc);
+}
+
+bool TrajectoryManager::IsPathPoint(const TrajDest &_point)
+{
+	return _point.movement == COMMON && IS_UNDEFINED_ANGLE(_point.angle);
+}
+
+// Distance from _p to the segment [_a, _b], and the position of its projection along it
+static float GetSegmentDistance(const Float2 &_p, const Float2 &_a, const Float2 &_b, float *_along = nullptr)
+{
+	Float2 Segment = _b - _a;
+	float Length = Segment.Length();
+	float Along = 0.f;
+	if (Length > 1e-3f)
+		Along = Math::Clamp((_p - _a).DotProduct(Segment) / Length, 0.f, Length);
+	if (_along)
+		*_along = Along;
+	return (_p - (Length > 1e-3f ? _a + Segment * (Along / Length) : _a)).Length();
+}
+
+// Pure pursuit along the consecutive GotoXY points: the robot drives the arc
+// to the goal point, where the path leaves the lookahead circle around it.
+// The lookahead grows with the speed, the speed is limited by the curvature
+// of the arc and by the braking distance to the end of the path.
+void TrajectoryManager::Pursue()
+{
+	Float2 Pos = PositionManager::Instance.GetPosMm();
 
-			// Waypoint reachs
-			if (next1_dist < SMOOTH_TRAJ_DEFAULT_PRECISION_D_MM)
+	// waypoints the robot has gone past, or cut
+	for (unsigned Second = GetSecondId(); Second != TrajQueue::NONE; Second = GetSecondId())
+	{
+		const TrajDest &Next = m_Points[Second];
+		if (!IsPathPoint(Next) && !IsCurve(Next))
+			break;
+		Float2 Start = PositionManager::Instance.GetTheoreticalPosMm();
+		const Float2 &Corner = m_Points.Front().pos;
+		float Along;
+		float Dist = GetSegmentDistance(Pos, Start, Corner, &Along);
+		if (Along < (Corner - Start).Length() && (IsCurve(Next) || Dist <= GetSegmentDistance(Pos, Corner, Next.pos)))
+			break;
+		NextPoint();
+		if (IsCurve(m_Points.Front()))
+			return;
+	}
+
+	float Lookahead = GetLookahead();
+
+	// goal point, from the projection of the robot on the path, and path length to the end
+	Float2 Start = PositionManager::Instance.GetTheoreticalPosMm();
+	float Along;
+	GetSegmentDistance(Pos, Start, m_Points.Front().pos, &Along);
+	Start = Start + (m_Points.Front().pos - Start).Normalized() * Along;
+	float FrontDist = (m_Points.Front().pos - Start).Length();
+	Float2 Goal = Start;
+	bool GoalFound = false;
+	float RemainingDist = 0.f;
+	unsigned PathEnd = m_Points.GetFront();
+	unsigned PathSize = 0;
+	for (unsigned Id = PathEnd; Id != TrajQueue::NONE && IsPathPoint(m_Points[Id]); Id = m_Points.GetNext(Id))
+	{
+		const Float2 &End = m_Points[Id].pos;
+		Float2 Segment = End - Start;
+		if (!GoalFound)
+		{
+			// leaving point of the segment out of the lookahead circle
+			Float2 Offset = Start - Pos;
+			float A = Segment.DotProduct(Segment);
+			float B = Offset.DotProduct(Segment);
+			float C = Offset.DotProduct(Offset) - Lookahead * Lookahead;
+			float Delta = B * B - A * C;
+			if (C >= 0.f && PathSize == 0)
+				GoalFound = true;	// away from the path: back to it first
+			else if (A > 1e-3f && Delta >= 0.f)
 			{
-				NextPoint();
+				float T = (-B + sqrtf(Delta)) / A;
+				if (T <= 1.f)
+				{
+					Goal = Start + Segment * max(T, 0.f);
+					GoalFound = true;
+				}
 			}
+			if (!GoalFound)
+				Goal = End;
 		}
+		RemainingDist += Segment.Length();
+		Start = End;
+		PathEnd = Id;
+		PathSize++;
+	}
 
-		//Serial.printf("pos: %f, %f  target: %f, %f\r\n", PositionManager::Instance.GetXMm(), PositionManager::Instance.GetYMm(), target_x, target_y);
-		GotoTarget(next1, target);
+	// end of the path, unless a curve follows it
+	unsigned AfterPath = m_Points.GetNext(PathEnd);
+	bool Continues = AfterPath != TrajQueue::NONE && IsCurve(m_Points[AfterPath]);
+	if (!Continues && BrakeAtEnd(m_Points[PathEnd].pos, PositionManager::Instance.GetAngleRad(), RemainingDist))
+	{
+		TRAJ_DEBUG("Pursuit end");
+		for (unsigned i = 0; i < PathSize; i++)
+			NextPoint();
+		return;
+	}
+
+	FollowArc(Goal, 0.f, FrontDist, m_Points.Front().plan.endSpeed);
+}
+
+// The curve at the front of the trajectory is followed like a path: pure
+// pursuit of the point a lookahead distance ahead of the robot on the curve,
+// at the speed the curvature of the path and of the arc to the goal allow
+void TrajectoryManager::FollowCurve()
+{
+	const TrajDest &Dest = m_Points.Front();
+	if (!m_CurveStarted)
+	{
+		InitCurve(Dest, PositionManager::Instance.GetTheoreticalPosMm(), PositionManager::Instance.GetTheoreticalAngleRad(), m_Curve);
+		m_CurveStarted = true;
+	}
+
+	// the point of the curve below the robot, a step or two from the last one
+	Float2 Pos = PositionManager::Instance.GetPosMm();
+	for (int i = 0; i < 2; i++)
+	{
+		Float2 Tangent(-sinf(m_Curve.GetAngle()), cosf(m_Curve.GetAngle()));
+		float Ahead = (Pos - m_Curve.GetPos()).DotProduct(Tangent);
+		if (Ahead <= 0.f)
+			break;
+		m_Curve.Advance(Ahead);
+	}
+
+	// the trajectory goes on after the curve, or stops at its end
+	float RemainingDist = m_Curve.GetLength() - m_Curve.GetDistance();
+	unsigned Second = GetSecondId();
+	bool Continues = Second != TrajQueue::NONE && (IsCurve(m_Points[Second]) || IsPathPoint(m_Points[Second]));
+	if (Continues ? RemainingDist <= 0.f : BrakeAtEnd(Dest.pos, Dest.angle, RemainingDist))
+	{
+		TRAJ_DEBUG("Curve end");
+		NextPoint();
+		return;
+	}
+
+	// largest curvature between the robot and the goal
+	float Lookahead = GetLookahead();
+	CurveWalker Goal = m_Curve;
+	float Curvature = ABS(Goal.GetCurvature());
+	for (int i = 0; i < 2; i++)
+	{
+		Goal.Advance(0.5f * Lookahead);
+		Curvature = max(Curvature, ABS(Goal.GetCurvature()));
+	}
+
+	FollowArc(Goal.GetPos(), Curvature, RemainingDist, Dest.plan.endSpeed);
+}
+
+// Lookahead of the pure pursuit: the distance covered in PURSUIT_LOOKAHEAD_TIME_S
+float TrajectoryManager::GetLookahead()
+{
+	float Speed = ABS(ControlSystem::Instance.GetDistanceProfile().GetVelocity());
+	return Math::Clamp(PURSUIT_LOOKAHEAD_TIME_S * Speed, PURSUIT_MIN_LOOKAHEAD_MM, PURSUIT_MAX_LOOKAHEAD_MM);
+}
+
+// Drive the arc tangent to the heading through _goal, in velocity mode. The
+// speed is limited by the curvature of the arc and by _pathCurvature, the
+// largest one of the path until the goal, and by the braking distance to
+// _endSpeed, the speed planned at the end of the front point.
+void TrajectoryManager::FollowArc(const Float2 &_goal, float _pathCurvature, float _remainingDist, float _endSpeed)
+{
+	Float2 ToGoal = _goal - PositionManager::Instance.GetPosMm();
+	float GoalDist = ToGoal.Length();
+	float Alpha = Math::WrapAngle(Math::GetVectorAngle(ToGoal) - PositionManager::Instance.GetAngleRad());
+	if (ABS(Alpha) > PURSUIT_MAX_HEADING_ERROR_RAD)
+	{
+		TRAJ_DEBUG("Pursuit rot");
+		m_IsOnlyRotation = true;
+		ControlSystem::Instance.SetTargets(PositionManager::Instance.GetDistanceMm(), GetAngleRef(_goal));
+		return;
+	}
+
+	float Curvature = 2.f * sinf(Alpha) / max(GoalDist, 1.f);
+	const ControlSetpoint &Setpoint = ControlSystem::Instance.GetSetpoint();
+	float MaxSpeed = sqrtf(SQUARE(_endSpeed) + 2.f * GetAccLimit(Setpoint.distanceMaxAcc) * max(_remainingDist, 0.f));
+	float Turn = 2.f * ABS(Alpha);	// heading change along the arc
+	if (Turn > 1e-3f)
+	{
+		// slow enough for the angle profile to build up the heading change of the arc from rest
+		float ArcLength = GoalDist * Turn / (2.f * sinf(0.5f * Turn));
+		float TurnTime = max(Turn / Setpoint.angleMaxSpeed, sqrtf(2.f * Turn / GetAccLimit(Setpoint.angleMaxAcc)));
+		MaxSpeed = min(MaxSpeed, ArcLength / TurnTime);
 	}
+	MaxSpeed = min(MaxSpeed, GetCurvatureSpeed(max(ABS(Curvature), _pathCurvature)));
+	// the angular velocity follows the speed the robot actually has
+	float Speed = ABS(ControlSystem::Instance.GetDistanceProfile().GetVelocity());
+	ControlSystem::Instance.SetVelocities(MaxSpeed, min(Speed, MaxSpeed) * Curvature);
+}
+
+// Near the end of the trajectory, the profiles brake the robot to _pos and
+// turn it to _angle: false while it is further than the braking distance
+bool TrajectoryManager::BrakeAtEnd(const Float2 &_pos, float _angle, float _remainingDist)
+{
+	float Speed = ABS(ControlSystem::Instance.GetDistanceProfile().GetVelocity());
+	if (_remainingDist >= SMOOTH_TRAJ_DEFAULT_PRECISION_D_MM + 0.5f * Speed * Speed / GetAccLimit(ControlSystem::Instance.GetSetpoint().distanceMaxAcc))
+		return false;
+
+	Float2 Heading(-sinf(PositionManager::Instance.GetAngleRad()), cosf(PositionManager::Instance.GetAngleRad()));
+	float EndDist = (_pos - PositionManager::Instance.GetPosMm()).DotProduct(Heading);
+	float Angle = PositionManager::Instance.GetAngleRad();
+	ControlSystem::Instance.SetTargets(PositionManager::Instance.GetDistanceMm() + EndDist, Angle + Math::WrapAngle(_angle - Angle));
+	return true;
+}
+
+void TrajectoryManager::InitCurve(const TrajDest &_dest, const Float2 &_start, float _startAngle, CurveWalker &_curve)
+{
+	if (_dest.movement == CIRCULAR)
+		_curve.InitCircle(_start, Float2(_dest.curve[0], _dest.curve[1]), _dest.curve[2]);
+	else if (_dest.movement == BEZIER)
+		_curve.InitBezier(_start, Float2(_dest.curve[0], _dest.curve[1]), Float2(_dest.curve[2], _dest.curve[3]), _dest.pos);
+	else
+		_curve.InitClothoid(_start, _startAngle, _dest.curve[0], _dest.curve[1], _dest.curve[2]);
 }
 
-void TrajectoryManager::GotoTarget(const TrajDest &_nextPoint, const Float2 &_target)
+void TrajectoryManager::GotoTarget(const TrajDest &_nextPoint, const Float2 &_target, float _remainingDist, bool _blending)
 {
 	// Compute the angle and distance to send to the control system
 	//float angle_ref, remaining_dist;
@@ -401,7 +1178,7 @@ void TrajectoryManager::GotoTarget(const TrajDest &_nextPoint, const Float2 &_ta
 
 	float AngleRefDiff;
 	float AngleRef = GetAngleRef(_target, &AngleRefDiff);
-	float RemainingDist = (PositionManager::Instance.GetPosMm() - _target).Length();
+	float RemainingDist = _remainingDist;
 
 	//printf("tar x:%d  y:%d  dist:%f  a:%f\r\n", (int)_target.x, (int)_target.y, (double)_nextPoint., (double)angle_ref);
 
@@ -418,18 +1195,19 @@ void TrajectoryManager::GotoTarget(const TrajDest &_nextPoint, const Float2 &_ta
 	}
 	else
 	{
-		//float DiffAngle = WrapAngle(AngleRef - PositionManager::Instance.GetAngleRad());
+		//float DiffAngle = Math::WrapAngle(AngleRef - PositionManager::Instance.GetAngleRad());
 		//AngleRef = DiffAngle + PositionManager::Instance.GetAngleRad();
 
-		// only apply a rotation if the difference of angle is too important
+		// only apply a rotation if the difference of angle is too important,
+		// a blended corner is turned while moving
 		//Serial.printf("angle: %f,  %f\r\n", AngleRef, PositionManager::Instance.GetAngleRad());
-		if (AngleRefDiff > 0.5f)//fabs(AngleRef - PositionManager::Instance.GetAngleRad()) > 0.5f)
+		if (AngleRefDiff > 0.5f && !_blending)//fabs(AngleRef - PositionManager::Instance.GetAngleRad()) > 0.5f)
 		{
 			m_IsOnlyRotation = true;
 			RemainingDist = 0.f;
 		}
 
-		ControlSystem::Instance.SetDistanceTarget(PositionManager::Instance.GetDistanceMm() + RemainingDist);
-		ControlSystem::Instance.SetRadAngleTarget(AngleRef);
+		// the sliding target of a blended corner is smooth, the angle quadramp would only lag behind it
+		ControlSystem::Instance.SetTargets(PositionManager::Instance.GetDistanceMm() + RemainingDist, AngleRef, !_blending);
 	}
 }
\ No newline at end of file
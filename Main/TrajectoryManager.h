@@ -3,21 +3,68 @@
 
 #include "Globals.h"
 #include "ControlSystem.h"
+#include "CurveWalker.h"
+#include "SegmentQueue.h"
+#include "EventQueue.h"
 
 
 #define SMOOTH_TRAJ_UPDATE_PERIOD_S 0.01 // 100 ms
 
 #define SMOOTH_TRAJ_MAX_NB_POINTS 50
+#define SMOOTH_TRAJ_CURVE_PARAMS 4 // floats describing a curved segment
 
 #define SMOOTH_TRAJ_DEFAULT_PRECISION_D_MM  40.0
 #define SMOOTH_TRAJ_DEFAULT_PRECISION_A_RAD (DEG2RAD(5.0f))
 
-#define SMOOTH_TRAJ_STEER_DISTANCE_MM 70
+#define SMOOTH_TRAJ_STEER_DISTANCE_MM 70 // longest tangent of a blended corner
+
+#define SMOOTH_TRAJ_DEFAULT_CORNER_TOLERANCE_MM 20.0 // 0: stop and turn at every waypoint
+#define SMOOTH_TRAJ_MAX_BLEND_ANGLE_RAD (DEG2RAD(60.0f)) // sharper corners stop and turn in place
+
+#define SMOOTH_TRAJ_PLAN_STEP_MM 20.f // curvature sampling of the curves by the look-ahead planner
+
+// Pure pursuit: the lookahead is the distance covered in PURSUIT_LOOKAHEAD_TIME_S
+#define PURSUIT_LOOKAHEAD_TIME_S 0.6f
+#define PURSUIT_MIN_LOOKAHEAD_MM 60.f
+#define PURSUIT_MAX_LOOKAHEAD_MM 200.f
+#define PURSUIT_MAX_HEADING_ERROR_RAD (DEG2RAD(60.0f)) // further, stop and turn in place
+
+#define TRAJ_DEFAULT_BRAKE_DISTANCE_ACC 1000.f // mm/s^2, deceleration of the pauses
+#define TRAJ_DEFAULT_BRAKE_ANGLE_ACC_DEG 500.f // deg/s^2
+
+#define TRAJ_EVENT_QUEUE_SIZE 16 // completion events kept for the consumers, a power of 2
+
+// Why a point left the trajectory
+enum class TrajectoryStatus : uint8_t
+{
+	REACHED,	// the robot reached it, or went past it without stopping
+	TIMEOUT,	// not reached in the segment timeout, skipped
+	BLOCKED,	// the motors were shut down while it was the current point, the trajectory is dropped
+	CANCELLED	// removed by Reset, or after a blocked point
+};
+
+struct TrajectoryEvent
+{
+	uint16_t id;			// of the point, see GetLastId
+	TrajectoryStatus status;
+	float distanceError;	// mm, from the robot to the end of the point
+	float angleError;		// rad, to the end angle of the rotations and curves
+	uint32_t durationMs;	// since it became the current point, without the pauses
+	uint32_t timeUs;		// when it completed
+	bool forward;			// the point moves forward, see IsForwardMovement
+};
+
+typedef void (*TrajectoryListener)(const TrajectoryEvent &_event);
 
 
 class TrajectoryManager {
 public:
-	static TrajectoryManager Instance;
+	enum TrackingMode {
+		WAYPOINTS,		// turn toward the next waypoint and advance the distance target
+		PURE_PURSUIT	// follow the path with coupled linear and angular velocities
+	};
+
+	static HAL_THREAD_LOCAL TrajectoryManager Instance;
 	void Init();
 
 	void Task();
@@ -26,23 +73,75 @@ public:
 	void Reset();
 	/* Check whether points remain in the trajectory*/
 	int IsEnded() { return m_Points.IsEmpty(); }
+	/* Number of points that can still be queued, the Goto functions return false when it is too low */
+	unsigned GetFreeSize() { return m_Points.GetFreeSize(); }
 
-	void NextPoint();
+	void NextPoint(TrajectoryStatus _status = TrajectoryStatus::REACHED);
 
 	void Print();
 	bool IsForwardMovement();
 	bool IsOnlyRotation(); 
 
 	bool IsPaused();
+	// The robot stops as fast as the brake decelerations allow and holds there,
+	// the current point goes on from there after Resume
 	void Pause();
 	void Resume();
-
-	void GotoXY(const Float2 &_pos_mm);
-
-	void GotoDistance(float d_mm);
-	void GotoDegreeAngle(float a);
-	void GotoRadianAngle(float a);
-	void GotoCircular(const Float2 &_center, float _angle);
+	// Decelerations of the pauses, in mm/s^2 and rad/s^2
+	void SetBrakeDeceleration(float _distanceAcc, float _angleAcc) { m_BrakeDistanceAcc = _distanceAcc; m_BrakeAngleAcc = _angleAcc; }
+
+	bool GotoXY(const Float2 &_pos_mm);
+	// Position the current point goes to, false if it isn't a GotoXY point
+	bool GetCurrentTarget(Float2 &_pos_mm);
+	// Waypoints to go through before the current point, a detour: nothing is
+	// inserted if they don't all fit
+	bool InsertXY(const Float2 *_pos_mm, unsigned _count);
+
+	bool GotoDistance(float d_mm);
+	bool GotoDegreeAngle(float a);
+	bool GotoRadianAngle(float a);
+	// Curved segments, from the end of the previous one. Angles and curvatures
+	// are positive counter-clockwise.
+	bool GotoCircular(const Float2 &_center, float _angle);
+	bool GotoBezier(const Float2 &_control1, const Float2 &_control2, const Float2 &_pos_mm);
+	// Bezier curve to _pos_mm arriving with the _angle heading, its control points
+	// _startDist along the current heading and _endDist before _pos_mm
+	bool GotoBezier(const Float2 &_pos_mm, float _angle, float _startDist, float _endDist);
+	// Curvature changing linearly from _startCurvature to _endCurvature (1/mm) over _length mm
+	bool GotoClothoid(float _length, float _startCurvature, float _endCurvature);
+
+	// Distance the robot may cut the corners of consecutive GotoXY by, in mm,
+	// without stopping at the waypoints. 0 to stop at every waypoint.
+	void SetCornerTolerance(float _mm) { m_CornerTolerance = _mm; PlanAll(); }
+	float GetCornerTolerance() const { return m_CornerTolerance; }
+
+	// How consecutive GotoXY are followed
+	void SetTrackingMode(TrackingMode _mode) { m_TrackingMode = _mode; PlanAll(); }
+	TrackingMode GetTrackingMode() const { return m_TrackingMode; }
+
+	// Id of the last point a Goto function queued, in its completion event
+	uint16_t GetLastId() const { return m_NextId - 1; }
+
+	// Completion events of the points, in order. Each consumer reads them with
+	// its own cursor, from GetEventCursor().
+	uint32_t GetEventCursor() const { return m_Events.GetHead(); }
+	bool PopEvent(uint32_t &_cursor, TrajectoryEvent &_event) const { return m_Events.Pop(_cursor, _event); }
+	// Called from Task as soon as points complete: the points it queues start
+	// in the same task, not a main loop later
+	void SetListener(TrajectoryListener _listener) { m_Listener = _listener; m_ListenerCursor = m_Events.GetHead(); }
+
+	// Predicted time until the point _id (see GetLastId) completes, in s, from
+	// the state of the robot, the planned speeds and the profile limits of
+	// ControlSystem, without the pauses: -1 if it isn't queued
+	float GetPointEta(uint16_t _id);
+	// Predicted time until the whole trajectory completes, in s
+	float GetTrajectoryEta() { return GetEta(TrajQueue::NONE); }
+
+	// The current point is skipped after _ms, not counting the pauses. 0: no timeout
+	void SetSegmentTimeout(uint32_t _ms) { m_SegmentTimeoutMs = _ms; }
+
+	// Point of a recording, see Recorder
+	void ReplayPoint(const Float2 &_pos, float _angle, const float *_curve, uint8_t _movement, bool _now);
 
 private:
 	enum TrajWhen {
@@ -50,25 +149,102 @@ private:
 	};
 
 	enum OrderType {
-		COMMON, FORWARD, BACKWARD, CIRCULAR
+		COMMON, FORWARD, BACKWARD, CIRCULAR, BEZIER, CLOTHOID
 	};
 
 	struct TrajDest {
 
-		Float2 pos;//mm
-		float angle;//rad
-		float radius;//only for circular
+		Float2 pos;//mm, the end of curves
+		float angle;//rad, the heading at the end of curves
+		// only for curves
+		// CIRCULAR: center, angle
+		// BEZIER: control points after the start and before pos
+		// CLOTHOID: length, curvature at the start and at the end
+		float curve[SMOOTH_TRAJ_CURVE_PARAMS] = {};
 		OrderType movement;
+		uint16_t id;	// see GetLastId
+
+		// look-ahead plan, see Plan()
+		struct {
+			Float2 endPos;					// pose after the point, see AdvancePose
+			float endAngle;
+			float length;					// mm, from the end of the previous point
+			float startHeading, endHeading;	// rad, of the path
+			float turn;						// rad, from the heading at the end of the previous point
+			float speedLimit;				// mm/s, fastest speed along it
+			float entryLimit, exitLimit;	// mm/s, fastest speeds at the ends the geometry allows
+			// arc rounding the corner with the next waypoint, no length if the robot stops there
+			float blendTangent, blendCurvature, blendLength;
+			float junctionLimit;			// mm/s, fastest speed at the end the geometry allows
+			float maxEndSpeed;				// mm/s, to brake before the next stops
+			float endSpeed;					// mm/s, planned speed at the end
+		} plan = {};
 	};
+	typedef SegmentQueue<TrajDest, SMOOTH_TRAJ_MAX_NB_POINTS> TrajQueue;
 
 	bool TrajIsFull() { return m_Points.IsFull(); }
-	void AddPoint(TrajDest point, TrajWhen when);
-	void GotoTarget(const TrajDest &_nextPoint, const Float2 &_target);
+	// Point after the front one, NONE if there isn't any
+	unsigned GetSecondId() { return m_Points.IsEmpty() ? TrajQueue::NONE : m_Points.GetNext(m_Points.GetFront()); }
+	// A GotoXY point, part of the path
+	static bool IsPathPoint(const TrajDest &_point);
+	static bool IsCurve(const TrajDest &_point) { return _point.movement >= CIRCULAR; }
+	static void InitCurve(const TrajDest &_dest, const Float2 &_start, float _startAngle, CurveWalker &_curve);
+	// Position and angle after _dest, from the ones before it
+	static void AdvancePose(const TrajDest &_dest, Float2 &_pos, float &_angle);
+	// Position and angle at the end of the trajectory
+	void GetEndPose(Float2 &_pos, float &_angle);
+	void Plan(unsigned _id);
+	void PlanAll();
+	bool PlanSegment(unsigned _id);
+	void PlanCorner(unsigned _id);
+	float GetJunctionSpeed(unsigned _id);
+	void PlanSpeeds(unsigned _first, unsigned _last);
+	float GetCornerTangent(float _turn, float _inLength, float _outLength);
+	static float GetCurvatureSpeed(float _curvature);
+	bool AddCurve(TrajDest &_dest);
+	bool AddPoint(TrajDest point, TrajWhen when);
+	void GotoTarget(const TrajDest &_nextPoint, const Float2 &_target, float _remainingDist, bool _blending);
+	bool GetCornerBlend(const TrajDest &_next1, Float2 &_outDir, float &_tangentDist);
+	void Pursue();
+	void FollowCurve();
+	float GetLookahead();
+	void FollowArc(const Float2 &_goal, float _pathCurvature, float _remainingDist, float _endSpeed);
+	bool BrakeAtEnd(const Float2 &_pos, float _angle, float _remainingDist);
 	void Update();
-
-	CircularBuffer<TrajDest, SMOOTH_TRAJ_MAX_NB_POINTS> m_Points;
+	float GetEta(unsigned _last);
+	float GetDuration(unsigned _id);
+	float GetFrontDuration();
+	void Complete(const TrajDest &_point, TrajectoryStatus _status);
+	void Clear(TrajectoryStatus _status);
+	uint32_t GetMotionMs();
+	bool NotifyListener();
+
+	TrajQueue m_Points;
 	bool m_Pause;
-	float m_PauseDist, m_pauseAngle;
+	float m_BrakeDistanceAcc = TRAJ_DEFAULT_BRAKE_DISTANCE_ACC;
+	float m_BrakeAngleAcc = DEG2RAD(TRAJ_DEFAULT_BRAKE_ANGLE_ACC_DEG);
 	bool m_IsOnlyRotation;
+
+	float m_CornerTolerance = SMOOTH_TRAJ_DEFAULT_CORNER_TOLERANCE_MM;
+	float m_LeavingTangentDist = 0.f;	// tangent of the corner the robot is leaving, 0 when done
+	TrackingMode m_TrackingMode = WAYPOINTS;
+	float m_EntrySpeed = 0.f;	// planned speed at the start of the front point
+	// limits the points were planned with, see Update
+	float m_PlanDistanceSpeed = 0.f;
+	float m_PlanDistanceAcc = 0.f;
+	float m_PlanAngleSpeed = 0.f;
+	float m_PlanAngleAcc = 0.f;
+
+	CurveWalker m_Curve;		// point of the front curve below the robot
+	bool m_CurveStarted = false;
+
+	uint16_t m_NextId = 0;
+	EventQueue<TrajectoryEvent, TRAJ_EVENT_QUEUE_SIZE> m_Events;
+	TrajectoryListener m_Listener = nullptr;
+	uint32_t m_ListenerCursor = 0;
+	uint32_t m_FrontStartMs = 0;	// when the front point became the current one, shifted by the pauses
+	uint32_t m_PauseStartMs = 0;
+	uint32_t m_PausedMs = 0;		// time spent in the pauses, see GetMotionMs
+	uint32_t m_SegmentTimeoutMs = 0;
 };
 #endif /* TRAJECTORY_MANAGER_H */
@@ -19,6 +19,7 @@
 
 #include "Arduino.h"
 #include "XL320.h"
+#include "Hal.h"
 
 
 #define SERVO_TIME_DELAY 12000
@@ -29,18 +30,12 @@
 
 void enableTX()
 {
-	uint8_t c;
-	c = UART1_C3;
-	c |= UART_C3_TXDIR;
-	UART1_C3 = c;
+	Hal::SetServoTx(true);
 }
 
 void enableRX()
 {
-	uint8_t c;
-	c = UART1_C3;
-	c &= ~UART_C3_TXDIR;
-	UART1_C3 = c;
+	Hal::SetServoTx(false);
 }
 
 void XL320::Begin(Stream &stream)